@@ -3,15 +3,41 @@
         {
             "target_name": "freefare",
             "defines": [ 'V8_DEPRECATION_WARNINGS=1', '_FILE_OFFSET_BITS=32' ],
-            "sources": [ "src/addon.cpp", "src/freefare.cpp",  "src/device.cpp", "src/tag.cpp", "src/tag_mifareultralight.cpp", "src/tag_mifareclassic.cpp", "src/tag_mifaredesfire.cpp", "src/tag_ntag21x.cpp" ],
+            "sources": [ "src/addon.cpp", "src/freefare.cpp",  "src/device.cpp", "src/tag.cpp", "src/tag_mifareultralight.cpp", "src/tag_mifareclassic.cpp", "src/tag_mifaredesfire.cpp", "src/tag_ntag21x.cpp", "src/desfire_file_cache.cpp", "src/scheduler.cpp", "src/server.cpp", "src/tag_claims.cpp", "src/tag_prefetch.cpp", "src/tag_session.cpp", "src/memory.cpp", "src/device_profile.cpp", "src/tag_filter.cpp", "src/result_table.cpp", "src/arena.cpp", "src/thread_policy.cpp", "src/personalize.cpp", "src/tag_felica.cpp", "src/discovery.cpp", "src/classic_access.cpp", "src/classic_journal.cpp", "src/key_rotation.cpp" ],
             "include_dirs" : [
                 "<!(node -e \"require('nan')\")",
                 "/usr/include"
             ],
+            'link_settings': {
+                 'libraries': [ '-lnfc', '-lfreefare', '-lrt', '-ldl' ],
+                 'library_dirs': [ ]
+            }
+        },
+        {
+            "target_name": "native_check",
+            "type": "executable",
+            "sources": [ "test/native_check.cpp", "src/classic_access.cpp", "src/classic_journal.cpp", "src/key_rotation.cpp", "src/tag_session.cpp", "src/desfire_file_cache.cpp" ],
+            "include_dirs" : [
+                "/usr/include"
+            ],
             'link_settings': {
                  'libraries': [ '-lnfc', '-lfreefare' ],
                  'library_dirs': [ ]
             }
+        },
+        {
+            "target_name": "nfc_trace",
+            "type": "shared_library",
+            "product_prefix": "",
+            "sources": [ "src/nfc_trace.cpp", "src/nfc_emulator.cpp" ],
+            "cflags_cc": [ "-fPIC" ],
+            "include_dirs" : [
+                "/usr/include"
+            ],
+            'link_settings': {
+                 'libraries': [ '-ldl' ],
+                 'library_dirs': [ ]
+            }
         }
     ]
 }
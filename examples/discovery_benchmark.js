@@ -0,0 +1,66 @@
+'use strict';
+
+// Measure the discovery latency of listTags() with several discovery configurations, with one tag in the field.
+// Usage: node discovery_benchmark.js [listings]
+
+const Freefare = require('../index');
+
+const listings = parseInt(process.argv[2] || '200');
+
+function now() {
+	let time = process.hrtime();
+	return time[0] * 1e3 + time[1] / 1e6;
+}
+
+function measure(device, label, options) {
+	device.setDiscovery(options);
+	let latencies = [];
+	let missed = 0;
+	let next = () => {
+		if(latencies.length >= listings) {
+			latencies.sort((a, b) => a - b);
+			let mean = latencies.reduce((sum, latency) => sum + latency, 0) / latencies.length;
+			let percentile = p => latencies[Math.min(latencies.length - 1, Math.floor(latencies.length * p))].toFixed(2);
+			console.log(label + ': mean ' + mean.toFixed(2) + ' ms, p50 ' + percentile(0.5) + ' ms, p99 ' + percentile(0.99)
+				+ ' ms, ' + missed + ' listings without the tag');
+			return Promise.resolve();
+		}
+		let start = now();
+		return device.listTags()
+		.then(tags => {
+			latencies.push(now() - start);
+			if(!tags.length) {
+				missed++;
+			}
+		})
+		.then(next);
+	};
+	return next();
+}
+
+let freefare = new Freefare();
+freefare.listDevices()
+.then(devices => {
+	if(!devices.length) {
+		throw new Error('No device found');
+	}
+	let device = devices[0];
+	return device.open()
+	.then(() => device.listTags())
+	.then(tags => {
+		if(!tags.length) {
+			throw new Error('No tag found on ' + device.name);
+		}
+		let type = tags[0].getType();
+		console.log(listings + ' listings of ' + tags[0].getFriendlyName() + ' (' + type + ') on ' + device.name);
+		return measure(device, 'default', null)
+		.then(() => measure(device, 'ISO14443A only', {modulations: ['ISO14443A']}))
+		.then(() => measure(device, 'expected ' + type, {types: [type]}))
+		.then(() => measure(device, 'ISO14443A and expected ' + type, {modulations: ['ISO14443A'], types: [type]}));
+	})
+	.then(() => device.setDiscovery())
+	.then(() => device.close());
+})
+.catch(error => {
+	console.log(error);
+});
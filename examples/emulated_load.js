@@ -0,0 +1,117 @@
+'use strict';
+
+// Load test of the scheduler on emulated readers: cards arrive with Poisson inter-arrival times, stay in the field for
+// a random dwell time and some are removed early. Each tap lists the card, reads it and writes a page.
+// Usage: node emulated_load.js [readers] [rate] [duration] [dwell] [early]
+// like `node emulated_load.js 16 2 60 800 0.1` for 16 readers, 2 cards per second and reader, during 60 s.
+// It restarts itself with the emulation library preloaded (see README, Load testing on emulated readers).
+
+const path = require('path');
+const fs = require('fs');
+const os = require('os');
+const childProcess = require('child_process');
+
+const readers = parseInt(process.argv[2] || '8');
+const rate = parseFloat(process.argv[3] || '1');
+const duration = parseFloat(process.argv[4] || '30') * 1000;
+const dwell = parseInt(process.argv[5] || '800');
+const early = parseFloat(process.argv[6] || '0.1');
+
+// Pages of the emulated cards (NFF_EMULATOR_*_PAGE in src/nfc_emulator.h)
+const ARRIVAL_PAGE = 4;
+const SEQUENCE_PAGE = 6;
+const WRITE_PAGE = 8;
+
+if(!process.env.NFF_EMULATE) {
+	let stats = path.join(os.tmpdir(), 'nff_emulated_load_' + process.pid + '.json');
+	let env = Object.assign({}, process.env, {
+		LD_PRELOAD: path.join(__dirname, '..', 'build', 'Release', 'lib.target', 'nfc_trace.so'),
+		NFF_EMULATE: 'readers=' + readers + ',rate=' + rate + ',dwell=' + dwell + ',early=' + early + ',stats=' + stats,
+		// Each reader blocks a pool thread during its commands
+		UV_THREADPOOL_SIZE: process.env.UV_THREADPOOL_SIZE || Math.min(128, readers + 4),
+	});
+	let child = childProcess.spawn(process.execPath, process.argv.slice(1), {env, stdio: 'inherit'});
+	child.on('exit', code => {
+		try {
+			fs.unlinkSync(stats);
+		}
+		catch(error) {}
+		process.exit(code);
+	});
+	return;
+}
+
+const Freefare = require('../index');
+
+function now() {
+	let time = process.hrtime();
+	return time[0] * 1e3 + time[1] / 1e6;
+}
+
+let latencies = [];
+let errors = 0;
+let start = now();
+
+// Tap the cards of a reader until the end of the run, each card once
+function run(device) {
+	let tapped = new Set();
+	let next = () => {
+		if(now() - start >= duration) {
+			return Promise.resolve();
+		}
+		return device.listTags()
+		.then(tags => Promise.all(tags.filter(tag => !tapped.has(tag.getUID())).map(tag => {
+			return tag.open()
+			.then(() => Promise.all([tag.read(ARRIVAL_PAGE), tag.read(ARRIVAL_PAGE + 1), tag.read(SEQUENCE_PAGE)]))
+			.then(pages => {
+				let arrival = (pages[0].readUInt32LE(0) + pages[1].readUInt32LE(0) * 0x100000000) / 1000;
+				return tag.write(WRITE_PAGE, pages[2])
+				.then(() => tag.close())
+				.then(() => {
+					tapped.add(tag.getUID());
+					latencies.push(now() - arrival);
+				});
+			})
+			.catch(() => {
+				// Removed during the tap, it is retried while it is in the field
+				errors++;
+			});
+		})))
+		.then(next, () => {
+			errors++;
+			return next();
+		});
+	};
+	return next();
+}
+
+let freefare = new Freefare();
+freefare.listDevices()
+.then(devices => Promise.all(devices.map(device => device.open().then(() => device))))
+.then(devices => {
+	console.log('Emulating ' + devices.length + ' readers, ' + rate + ' cards/s each, ' + dwell + ' ms dwell, ' + (early * 100) + '% early removals');
+	return Promise.all(devices.map(run))
+	.then(() => Promise.all(devices.map(device => device.close())));
+})
+.then(() => {
+	let elapsed = (now() - start) / 1000;
+	let arrivals = 0;
+	let earlyRemovals = 0;
+	for (let line of fs.readFileSync(process.env.NFF_EMULATE.match(/stats=([^,]*)/)[1], 'utf8').split('\n')) {
+		if(line) {
+			let reader = JSON.parse(line);
+			arrivals += reader.arrivals;
+			earlyRemovals += reader.earlyRemovals;
+		}
+	}
+
+	latencies.sort((a, b) => a - b);
+	let percentile = p => latencies.length ? latencies[Math.min(latencies.length - 1, Math.floor(latencies.length * p))].toFixed(1) : '-';
+	console.log('Taps: ' + latencies.length + ' of ' + arrivals + ' cards in ' + elapsed.toFixed(1) + ' s, ' + (latencies.length / elapsed).toFixed(2) + ' taps/s');
+	console.log('Tap latency: p50 ' + percentile(0.5) + ' ms, p90 ' + percentile(0.9) + ' ms, p99 ' + percentile(0.99) + ' ms, max ' + percentile(1) + ' ms');
+	console.log('Failed taps: ' + (arrivals - latencies.length) + ' (' + earlyRemovals + ' early removals), ' + errors + ' failed operations');
+})
+.catch(error => {
+	console.log(error);
+	process.exit(1);
+});
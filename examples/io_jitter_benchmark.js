@@ -0,0 +1,76 @@
+'use strict';
+
+// Measure the latency jitter of small tag reads, with the default I/O threads and then with a policy.
+// Usage: node io_jitter_benchmark.js [cpus] [policy] [priority] [reads]
+// like `node io_jitter_benchmark.js 2,3 fifo 50 1000`. Run it while the host is loaded to see the difference.
+// It can run without reader on a recording (see README, Recording and replaying reader traffic).
+
+const Freefare = require('../index');
+
+const cpus = process.argv[2] ? process.argv[2].split(',').map(cpu => parseInt(cpu)) : undefined;
+const policy = process.argv[3] || 'fifo';
+const priority = parseInt(process.argv[4] || '50');
+const reads = parseInt(process.argv[5] || '500');
+
+// One small read of the tag, by type
+function read(tag) {
+	switch(tag.getType()) {
+		case 'NTAG_21x':
+		case 'MIFARE_ULTRALIGHT':
+		return tag.read(0);
+		case 'MIFARE_DESFIRE':
+		return tag.getApplicationIds();
+	}
+	throw new Error('Use a NTAG 21x, MIFARE Ultralight or DESFire tag');
+}
+
+function measure(tag, label) {
+	let latencies = [];
+	let errors = 0;
+	let next = () => {
+		if(latencies.length + errors >= reads) {
+			latencies.sort((a, b) => a - b);
+			let mean = latencies.reduce((sum, latency) => sum + latency, 0) / latencies.length;
+			let deviation = Math.sqrt(latencies.reduce((sum, latency) => sum + (latency - mean) * (latency - mean), 0) / latencies.length);
+			let percentile = p => latencies[Math.min(latencies.length - 1, Math.floor(latencies.length * p))].toFixed(2);
+			console.log(label + ': mean ' + mean.toFixed(2) + ' ms, stddev ' + deviation.toFixed(2) + ' ms, p50 ' + percentile(0.5)
+				+ ' ms, p99 ' + percentile(0.99) + ' ms, max ' + latencies[latencies.length - 1].toFixed(2) + ' ms, ' + errors + ' errors');
+			return Promise.resolve();
+		}
+		let start = process.hrtime();
+		return read(tag)
+		.then(() => {
+			let time = process.hrtime(start);
+			latencies.push(time[0] * 1e3 + time[1] / 1e6);
+		}, () => errors++)
+		.then(next);
+	};
+	return next();
+}
+
+let freefare = new Freefare();
+freefare.listDevices()
+.then(devices => {
+	if(!devices.length) {
+		throw new Error('No device found');
+	}
+	let device = devices[0];
+	return device.open()
+	.then(() => device.listTags())
+	.then(tags => {
+		if(!tags.length) {
+			throw new Error('No tag found on ' + device.name);
+		}
+		let tag = tags[0];
+		console.log(reads + ' reads of ' + tag.getFriendlyName() + ' ' + tag.getUID() + ' (' + device.name + ')');
+		return tag.open()
+		.then(() => measure(tag, 'default'))
+		.then(() => device.setIoThread({cpus, policy, priority}))
+		.then(() => measure(tag, policy + (cpus ? ' on CPUs ' + cpus.join(',') : '')))
+		.then(() => tag.close());
+	})
+	.then(() => device.close());
+})
+.catch(error => {
+	console.log(error);
+});
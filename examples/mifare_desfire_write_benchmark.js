@@ -0,0 +1,67 @@
+'use strict';
+
+// Write multi-KB payloads on a DESFire data file and report the throughput.
+// Usage: node mifare_desfire_write_benchmark.js [aid] [file] [keyNo] [key] [rounds]
+// The file must be at least 8 KB, the key is a 3DES key in hex (16 bytes of 0xff by default).
+// It can run without reader on a recording (see README, Recording and replaying reader traffic).
+
+const Freefare = require('../index');
+
+const aid = new Buffer(process.argv[2] || 'ffffff', 'hex');
+const file = parseInt(process.argv[3] || '2');
+const keyNo = parseInt(process.argv[4] || '3');
+const key = new Buffer(process.argv[5] || 'ffffffffffffffffffffffffffffffff', 'hex');
+const rounds = parseInt(process.argv[6] || '10');
+const sizes = [1024, 2048, 4096, 8192];
+
+function benchmark(tag, size) {
+	let data = new Buffer(size);
+	for (let i = 0; i < size; i++) {
+		data[i] = i & 0xff;
+	}
+
+	let start = process.hrtime();
+	let round = 0;
+	let next = () => {
+		if(round++ >= rounds) {
+			let time = process.hrtime(start);
+			let ms = time[0] * 1e3 + time[1] / 1e6;
+			console.log(size + ' bytes: ' + (ms / rounds).toFixed(1) + ' ms per write, ' + (size * rounds / ms).toFixed(2) + ' kB/s');
+			return Promise.resolve();
+		}
+		return tag.write(file, 0, size, data).then(next);
+	};
+	return next();
+}
+
+let freefare = new Freefare();
+freefare.listDevices()
+.then(devices => {
+	if(!devices.length) {
+		throw new Error('No device found');
+	}
+	let device = devices[0];
+	return device.open()
+	.then(() => device.listTags())
+	.then(tags => {
+		let tag = tags.find(tag => tag.getType() == 'MIFARE_DESFIRE');
+		if(!tag) {
+			throw new Error('No DESFire tag found on ' + device.name);
+		}
+		console.log('Benchmark ' + rounds + ' writes per size on ' + tag.getUID() + ' (' + device.name + ')');
+
+		let memory = freefare.getMemoryStats();
+		return tag.open()
+		.then(() => tag.selectApplication(aid))
+		.then(() => tag.authenticate3DES(keyNo, key))
+		.then(() => sizes.reduce((previous, size) => previous.then(() => benchmark(tag, size)), Promise.resolve()))
+		.then(() => {
+			console.log('Native buffers: ' + memory.buffers + ' bytes before, ' + freefare.getMemoryStats().buffers + ' bytes after');
+			return tag.close();
+		});
+	})
+	.then(() => device.close());
+})
+.catch(error => {
+	console.log(error);
+});
@@ -10,6 +10,69 @@ var device = new objectwrapper.Device();
 
 const ERROR_INIT_LIBNFC = 10; // TODO move that to binding class from C++
 const ERROR_OPEN_DEVICE = 11; // TODO move that to binding class from C++
+const ERROR_CALIBRATION_UNSUPPORTED = 16;
+const ERROR_THREAD_POLICY = 17;
+const ERROR_PERSONALIZATION_JOB = 18;
+const ERROR_PERSONALIZATION_EMPTY = 19;
+const ERROR_PERSONALIZATION_TIMEOUT = 20;
+const ERROR_ABORTED = 107;
+const ERROR_JOURNAL = 22;
+const ERROR_ROTATION = 23;
+const ERROR_ROTATION_TIMEOUT = 24;
+const ERROR_ROTATION_FULL = 25;
+
+// Scheduler priority classes (NFF_PRIORITY_* in src/scheduler.h)
+const PRIORITIES = {
+	interactive: 0,
+	normal: 1,
+	bulk: 2,
+};
+
+// Device queue policies (NFF_QUEUE_* in src/scheduler.h)
+const QUEUE_POLICIES = {
+	'reject': 0,
+	'drop-oldest': 1,
+	'coalesce': 2,
+};
+
+// Scheduling classes of the I/O threads (NFF_THREAD_* in src/thread_policy.h)
+const THREAD_POLICIES = {
+	other: 0,
+	fifo: 1,
+	rr: 2,
+};
+
+// Tag kinds of the personalization jobs (NFF_PERSO_* in src/personalize.h)
+const PERSONALIZATION_TYPES = {
+	MIFARE_ULTRALIGHT: 0,
+	MIFARE_CLASSIC: 1,
+	MIFARE_DESFIRE: 2,
+	NTAG_21x: 3,
+};
+
+// Tag types known to the native filter
+const TAG_TYPES = ['MIFARE_CLASSIC_1K', 'MIFARE_CLASSIC_4K', 'MIFARE_DESFIRE', 'MIFARE_ULTRALIGHT', 'MIFARE_ULTRALIGHT_C', 'NTAG_21x', 'FELICA'];
+
+// Modulations known to the native discovery
+const MODULATIONS = ['ISO14443A', 'FELICA_212', 'FELICA_424'];
+
+// Service codes of the FeliCa Lite user blocks (FELICA_SC_* in freefare.h)
+const FELICA_SERVICE_RW = 0x0009;
+
+// Record layouts of the batch results (name: [offset, type])
+const RESULT_FIELDS = {
+	applicationIds: {aid: [0, 'uint32']},
+	fileIds: {file: [0, 'uint8']},
+	values: {error: [0, 'int32'], value: [4, 'int32'], adr: [8, 'uint8']},
+	blocks: {error: [0, 'int32'], keyType: [4, 'uint8'], data: [8, 'bytes', 16]},
+	writtenBlocks: {error: [0, 'int32'], keyType: [4, 'uint8']},
+};
+
+// Outcomes of a Classic journal check (NFF_JOURNAL_* in src/classic_journal.h)
+const JOURNAL_OUTCOMES = ['clean', 'recovered', 'torn'];
+
+// Outcomes of a key rotation tap (NFF_ROTATION_* in src/key_rotation.h)
+const ROTATION_OUTCOMES = ['rotated', 'skipped', 'failed'];
 
 // This symbol is used to make cpp wrapped object private
 var cppObj = Symbol();
@@ -51,16 +114,61 @@ class Freefare {
 		});
 	}
 
+	/**
+	* Deduplicate cards seen by several devices with overlapping fields.
+	* The first device listing a card claims it, other devices leave it out of `listTags()`
+	* and their operations on it fail with error 15, until the claim is not refreshed for the window.
+	* @param {Number} window Claim window in ms, 0 to disable (default)
+	*/
+	setDedupeWindow(window) {
+		freefare.setDedupeWindow(window);
+	}
+
+	/**
+	* Native memory held by the binding, which is also reported to V8 as external memory
+	* @return {Object} Bytes held by `tags`, `workers`, `buffers`, `caches`, `shared` rings, their `total` and what was `reported` to V8,
+	* and for batch arenas the `arenaBlockSize`, the `arenaHighWater` used by one batch and the number of `arenaOverflows` of the first block
+	*/
+	getMemoryStats() {
+		return freefare.getMemoryStats();
+	}
+
+	/**
+	* Size the first block of the arenas holding the native intermediates of `readFiles()` and of the `listTags()` prefetch,
+	* the only operations using one.
+	* Batches needing more memory grow their arena, which shows in `getMemoryStats().arenaOverflows`.
+	* @param {Number} size Size in bytes, 0 for the default (4 kB)
+	*/
+	setArenaBlockSize(size) {
+		freefare.setArenaBlockSize(size || 0);
+	}
+
+	/**
+	* Serve the devices of this process to other local processes.
+	* Payloads from `threshold` bytes go through a shared memory ring of `ringSize` bytes per client.
+	* Clients may open, close and list the tags of devices and operate tags, device configuration is not exposed.
+	* @param {String} path Unix domain socket path
+	* @param {Object} [options] `{ringSize, threshold}`, 1 MB and 4 kB by default
+	* @return {ReaderServer} The listening server
+	*/
+	serve(path, options) {
+		let server = new ReaderServer(this, options);
+		server.listen(path);
+		return server;
+	}
+
 }
 
 /**
 * A NibNFC compatible device that can read NFC tag.
 * The `open()` method have to be executed before any other.
+* Emits `congested` and `drained` with the queue depth when a queue limit is set.
 *
 * @class Device
 */
-class Device {
+class Device extends EventEmitter {
 	constructor(cppDevice) {
+		super();
 		this[cppObj] = cppDevice;
 		this.name = this[cppObj].getConnstring();
 	}
@@ -117,6 +225,7 @@ class Device {
 						default:
 						reject(new Error('Unknown error (' + error + ')'));
 					}
+					return;
 				}
 
 				let res = [];
@@ -135,6 +244,9 @@ class Device {
 						case 'NTAG_21x':
 						res.push(new NTag21xTag(cppTag));
 						break;
+						case 'FELICA':
+						res.push(new FelicaTag(cppTag));
+						break;
 						case '':
 						case 'MIFARE_ULTRALIGHT_C':
 						default:
@@ -147,7 +259,428 @@ class Device {
 	}
 
 	/**
-	* Try to abort the current blocking command
+	* Set the priority of the next operations of this device (`interactive` by default).
+	* Operations of a device and its tags run one at a time, by priority class then earliest deadline.
+	* @param {String} priority `interactive`, `normal` or `bulk`
+	* @param {Number} [deadline] Deadline in ms from the time the operation is requested
+	*/
+	setPriority(priority, deadline) {
+		assert(priority in PRIORITIES, 'Priority must be interactive, normal or bulk');
+		this[cppObj].setPriority(PRIORITIES[priority], deadline || 0);
+	}
+
+	/**
+	* Bound the number of waiting operations of this device and its tags.
+	* `congested` is emitted when the queue is full, `drained` when it is back to half its limit.
+	* @param {Number} limit Maximum number of waiting operations, 0 for no limit
+	* @param {String} [policy] When full: `reject` the new operation (default), `drop-oldest` waiting
+	* operation of the least urgent class, or `coalesce` identical reads and reject others
+	*/
+	setQueueLimit(limit, policy) {
+		policy = policy || 'reject';
+		assert(policy in QUEUE_POLICIES, 'Policy must be reject, drop-oldest or coalesce');
+		this[cppObj].setQueueLimit(limit, QUEUE_POLICIES[policy], (depth, congested) => {
+			// The native queue can signal from within a request, emit later
+			setImmediate(() => this.emit(congested ? 'congested' : 'drained', depth));
+		});
+	}
+
+	/**
+	* Number of waiting and running operations of this device and its tags
+	* @return {Number} The queue depth
+	*/
+	getQueueDepth() {
+		return this[cppObj].getQueueDepth();
+	}
+
+	/**
+	* Set a LibNFC property of the opened device. It is set again if the device is reopened by the health monitor.
+	* @param {String} name Property name like `NP_TIMEOUT_COMMAND` or `NP_INFINITE_SELECT`
+	* @param {Number|Boolean} value Timeout in ms for `NP_TIMEOUT_*` properties, boolean for others
+	* @return {Promise} A promise to the end of the action.
+	*/
+	setProperty(name, value) {
+		return new Promise((resolve, reject) => {
+			this[cppObj].setProperty(name, value, (error) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+				}
+				resolve();
+			});
+		});
+	}
+
+	/**
+	* Reopen the device when it is lost (USB reset, unplugged reader, ...).
+	* `state` is emitted with `lost` and the error, then `reconnected` or `failed` and the number of attempts.
+	* Pending operations of tags found before the loss fail with error 14, operations run while the device is not reopened with error 11.
+	* @param {Object|Boolean} options `false` to disable, or `{attempts, interval}` (defaults to 10 attempts and 100 ms first interval)
+	*/
+	setHealthMonitor(options) {
+		if(options === false) {
+			this[cppObj].setHealthMonitor(false, 0, 0);
+			return;
+		}
+		options = options || {};
+		this[cppObj].setHealthMonitor(true, options.attempts || 10, options.interval || 100, (state, detail) => {
+			// The native monitor signals from within a request, emit later
+			setImmediate(() => this.emit('state', state, detail));
+		});
+	}
+
+	/**
+	* Set regions read natively from each tag found by `listTags()`, before the tag is handed to JS.
+	* Reads of these regions are then answered in queue order without reading the tag again, until the tag is written.
+	* Regions read with a key are only used once JS authenticated the tag with the same key.
+	* @param {Array<Object>} profile List of `{type, start, count, ...}` where `type` is `MIFARE_ULTRALIGHT`, `NTAG_21x`
+	* (pages), `MIFARE_CLASSIC` (blocks, with `key` and `keyType`) or `MIFARE_DESFIRE` (`aid`, `file`, optional `keyNo` and `key`,
+	* `start` offset and `count` bytes or 0 for the whole file)
+	*/
+	setPrefetch(profile) {
+		this[cppObj].setPrefetch(profile || []);
+	}
+
+	/**
+	* Keep only the tags matching one of the rules in `listTags()`, other tags are dropped natively without creating
+	* any object for them. Fields of a rule which are not set match any tag.
+	* @param {Array<Object>} rules List of `{type, uidPrefix, atqa, atqaMask, sak, sakMask}`, where `type` is a tag type
+	* as `getType()`, `uidPrefix` an hex string and `atqa` (16 bits) and `sak` are compared under their mask (all bits by default).
+	* An empty list keeps all tags (default).
+	*/
+	setTagFilter(rules) {
+		rules = rules || [];
+		for (let rule of rules) {
+			assert(rule.type === undefined || TAG_TYPES.indexOf(rule.type) >= 0, 'Unknown tag type ' + rule.type);
+		}
+		this[cppObj].setTagFilter(rules);
+	}
+
+	/**
+	* Restrict how `listTags()` and the personalization polling look for tags, on gates expecting a single card family.
+	* By default all modulations supported by libfreefare are polled and the type of each tag is detected with probe
+	* commands (Ultralight C and NTAG checks). Polling only some modulations skips the polls of the others, and declaring
+	* the expected types drops the other tags from their anticollision data and creates a tag matching a single
+	* type without probe (with a libfreefare version supporting FeliCa, which has the typed constructors).
+	* @param {Object} [options] `{modulations, types}`: list of `ISO14443A` (106 kbps), `FELICA_212` and `FELICA_424`
+	* (all supported by default), and list of tag types as `getType()` (any by default). No options restores the defaults.
+	*/
+	setDiscovery(options) {
+		options = options || {};
+		let modulations = options.modulations || [];
+		let types = options.types || [];
+		for (let modulation of modulations) {
+			assert(MODULATIONS.indexOf(modulation) >= 0, 'Unknown modulation ' + modulation);
+		}
+		for (let type of types) {
+			assert(TAG_TYPES.indexOf(type) >= 0, 'Unknown tag type ' + type);
+		}
+		this[cppObj].setDiscovery(modulations, types);
+	}
+
+	/**
+	* Measure the command latency and frame limits of this reader with a tag in its field.
+	* The resulting profile sets the chunk sizes of the NTAG and DESFire reads of its tags, and the card answer timeout (`NP_TIMEOUT_COM`).
+	* NTAG 21x tags measure the FAST_READ frame limit and transfer time, MIFARE Ultralight and DESFire tags only the latency.
+	* @param {Tag} tag A NTAG 21x, MIFARE Ultralight or DESFire tag found on this device
+	* @return {Promise<Object>} A promise to the profile
+	*/
+	calibrate(tag) {
+		return new Promise((resolve, reject) => {
+			tag[cppObj].calibrate((error, profile) => {
+				if(error) {
+					switch (error) {
+						case ERROR_CALIBRATION_UNSUPPORTED:
+						reject(new Error('This tag can not be used to calibrate the device'));
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				this.setProperty('NP_TIMEOUT_COM', profile.timeout).then(() => resolve(profile), reject);
+			});
+		});
+	}
+
+	/**
+	* Get the timings of this reader, all 0 until it is calibrated
+	* @return {Object} `{maxPages, chunkSize, commandLatency, byteLatency, timeout}`: pages of a FAST_READ frame, DESFire bytes
+	* read per command, latency of a command in µs, transfer time of a byte in ns and card answer timeout in ms
+	*/
+	getProfile() {
+		return this[cppObj].getProfile();
+	}
+
+	/**
+	* Restore a profile from `calibrate()` or `getProfile()`, to skip calibrating the same reader again
+	* @param {Object} profile The reader profile
+	* @return {Promise} A promise to the end of the action.
+	*/
+	setProfile(profile) {
+		this[cppObj].setProfile(profile);
+		if(!profile.timeout) {
+			return Promise.resolve();
+		}
+		return this.setProperty('NP_TIMEOUT_COM', profile.timeout);
+	}
+
+	/**
+	* Pin the threads running the operations of this device to some CPUs and raise their priority, to reduce the RF timing
+	* jitter caused by other work of the host. Set it before `open()` so it applies to all operations.
+	* Realtime classes and any nice value change need the `CAP_SYS_NICE` capability (or a matching `RLIMIT_RTPRIO`/`RLIMIT_NICE`),
+	* a positive nice value is refused when the pool thread could not get its previous value back.
+	* @param {Object|Boolean} options `false` to disable, or `{cpus, policy, priority, nice}`: CPU numbers (any if not set),
+	* scheduling class `other` (default), `fifo` or `rr`, realtime priority (1 to 99) for `fifo` and `rr`, nice value for `other`
+	* @return {Promise} A promise to the end of the action, rejected if the thread can not take the policy
+	*/
+	setIoThread(options) {
+		let enabled = options !== false;
+		options = options || {};
+		let policy = options.policy || 'other';
+		assert(policy in THREAD_POLICIES, 'Policy must be other, fifo or rr');
+		return new Promise((resolve, reject) => {
+			this[cppObj].setIoThread(enabled, options.cpus || [], THREAD_POLICIES[policy], options.priority || 0, options.nice || 0, (error, errno) => {
+				if(error) {
+					switch (error) {
+						case ERROR_THREAD_POLICY:
+						reject(new Error('Can not apply the I/O thread policy (errno ' + errno + ')'));
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve();
+			});
+		});
+	}
+
+	/**
+	* Personalize a stream of cards. Jobs are pipelined: while a card is written, the job of the next card is computed by
+	* `next()` and laid out natively on a pool thread (image split in pages or blocks, sector trailers and keys built), and the
+	* next card is written as soon as it is detected. Cards already personalized and cards of another type are skipped.
+	* A job is `{type, ...}` where `type` is:
+	* - `MIFARE_ULTRALIGHT` or `NTAG_21x`: `image` Buffer written from page `start`, the last page padded with 0
+	* - `MIFARE_CLASSIC`: `image` Buffer written in the data blocks from block `start`, skipping block 0 and the sector
+	* trailers, sectors authenticated with `key` and `keyType`, then `trailers`: list of `{sector, keyA, keyB, access, gpb}`
+	* where `access` gives the C1C2C3 bits of the blocks 0, 1, 2 and of the trailer (`[0, 0, 0, 1]` by default)
+	* - `MIFARE_DESFIRE`: `files`: list of `{aid, file, offset, data, keyNo, key}`, authenticated with a DES or 3DES `key` if set
+	* @param {Function|Array<Object>} next Function called with the card index, returning its job or a promise to it,
+	* `null` when there is no more card. Or the list of the jobs.
+	* @param {Object} [options] `{timeout, interval, attempts, onCard}`: longest wait for a card in ms (0 for none, default, until `abort()`),
+	* polling interval in ms (50 by default), writes of a job before giving up (3 by default), and function called with
+	* `{index, uid, error, step, wait, write}` after each written card
+	* @return {Promise<Object>} A promise to `{cards, failures}`, rejected if a job is invalid, no card comes before the
+	* timeout or a job fails `attempts` times
+	*/
+	personalize(next, options) {
+		options = options || {};
+		if(Array.isArray(next)) {
+			let jobs = next;
+			next = index => jobs[index];
+		}
+		let timeout = options.timeout || 0;
+		let interval = options.interval || 50;
+		let attempts = options.attempts || 3;
+		let stats = {cards: 0, failures: 0};
+		let index = 0;
+		let pending = Promise.resolve();
+
+		// Compute the next job and lay it out natively
+		let prepare = () => {
+			let current = index++;
+			let prepared = Promise.resolve(next(current)).then(job => {
+				if(!job) {
+					return null;
+				}
+				assert(job.type in PERSONALIZATION_TYPES, 'Unknown personalization type ' + job.type);
+				return new Promise((resolve, reject) => {
+					this[cppObj].preparePersonalization(job, PERSONALIZATION_TYPES[job.type], (error) => {
+						if(error) {
+							switch (error) {
+								case ERROR_PERSONALIZATION_JOB:
+								reject(new Error('Personalization job ' + current + ' does not fit the tag'));
+								default:
+								reject(new Error('Unknown error (' + error + ')'));
+							}
+							return;
+						}
+						resolve({index: current, job});
+					});
+				});
+			});
+			pending = prepared.catch(() => null);
+			return prepared;
+		};
+
+		// Write the next prepared job on the next card
+		let write = (prepared) => {
+			return new Promise((resolve, reject) => {
+				this[cppObj].personalizeNext(timeout, interval, (error, uid, step, wait, written) => {
+					switch (error) {
+						case 0:
+						resolve({index: prepared.index, uid, error, step: 0, wait, write: written});
+						break;
+						case ERROR_PERSONALIZATION_TIMEOUT:
+						reject(new Error('No card to personalize before the timeout'));
+						break;
+						case ERROR_PERSONALIZATION_EMPTY:
+						reject(new Error('No prepared personalization job'));
+						break;
+						case ERROR_ABORTED:
+						reject(new Error('Personalization aborted'));
+						break;
+						default:
+						if(!uid) {
+							reject(new Error('Unknown error (' + error + ')'));
+							break;
+						}
+						resolve({index: prepared.index, uid, error, step, wait, write: written});
+					}
+				});
+			});
+		};
+
+		let run = (prepared, following, failures) => {
+			if(!prepared) {
+				return Promise.resolve(stats);
+			}
+			// The job of the next card is computed while this one is written
+			following = following || prepare();
+			return write(prepared).then(result => {
+				if(options.onCard) {
+					options.onCard(result);
+				}
+				if(!result.error) {
+					stats.cards++;
+					return following.then(job => run(job, null, 0));
+				}
+				stats.failures++;
+				if(failures + 1 >= attempts) {
+					throw new Error('Personalization job ' + prepared.index + ' failed ' + attempts + ' times (' + result.error + ')');
+				}
+				return run(prepared, following, failures + 1);
+			});
+		};
+
+		return prepare()
+		.then(prepared => run(prepared, null, 0))
+		.catch(error => {
+			// Drop the jobs prepared ahead, once the last one is queued
+			return pending.then(() => {
+				this[cppObj].clearPersonalization();
+				throw error;
+			});
+		});
+	}
+
+	/**
+	* Set the key rotation campaign of the device, replacing the previous one. Its progress is kept by card UID
+	* in a memory mapped file, created if needed, so the campaign survives restarts and is shared by the runs
+	* of `rotateKeys()`. Devices of the process giving the same file share its table, other processes can not
+	* open it meanwhile.
+	* @param {Object} options `{table, capacity, classic, desfire}`: progress file path, number of cards of a new
+	* file (65536 by default, 16 bytes each). `classic`: `{key, keyType, trailers}`, the old key of the sectors and
+	* their new trailers, as for the `MIFARE_CLASSIC` jobs of `personalize()`. `desfire`: list of `{aid, keyNo, oldKey,
+	* newKey}`, DES or 3DES keys, `aid` being omitted for the PICC master key
+	* @return {Promise} A promise to the end of the action.
+	*/
+	setKeyRotation(options) {
+		assert(options && options.table, 'setKeyRotation expects a progress table path');
+		return new Promise((resolve, reject) => {
+			this[cppObj].setKeyRotation(options, options.table, options.capacity || 65536, (error, errno) => {
+				if(error) {
+					switch (error) {
+						case ERROR_ROTATION:
+						reject(new Error(errno ? 'Can not open the progress table (errno ' + errno + ')' : 'Invalid rotation keys or sectors'));
+						break;
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve();
+			});
+		});
+	}
+
+	/**
+	* Rotate the keys of the cards tapped on the device. On each tap, the progress table is checked natively and a
+	* card not rotated yet gets its new keys in the session of its detection, before the next poll. Sectors and keys
+	* already rotated by an interrupted attempt are detected and skipped.
+	* @param {Object} options `{timeout, interval, onCard}`: longest wait for a card in ms (0 for none, default),
+	* polling interval in ms (50 by default), function called with `{uid, outcome, error, step}` after each tap,
+	* `outcome` being `rotated`, `skipped` (already in the table) or `failed`, `step` the failed sector or key. The
+	* run stops when `onCard` returns `false`
+	* @return {Promise<Object>} A promise to `{rotated, skipped, failures}`, resolved when no card comes before the timeout, rejected by `abort()`
+	*/
+	rotateKeys(options) {
+		options = options || {};
+		let timeout = options.timeout || 0;
+		let interval = options.interval || 50;
+		let stats = {rotated: 0, skipped: 0, failures: 0};
+
+		let next = () => new Promise((resolve, reject) => {
+			this[cppObj].rotateNext(timeout, interval, (error, uid, outcome, step) => {
+				switch (error) {
+					case ERROR_ROTATION_TIMEOUT:
+					resolve(null);
+					break;
+					case ERROR_ROTATION_FULL:
+					reject(new Error('The progress table is full'));
+					break;
+					case ERROR_ABORTED:
+					reject(new Error('Key rotation aborted'));
+					break;
+					default:
+					if(error && !uid) {
+						reject(new Error(error == ERROR_ROTATION ? 'No key rotation campaign' : 'Unknown error (' + error + ')'));
+						break;
+					}
+					resolve({uid, outcome: ROTATION_OUTCOMES[outcome], error, step});
+				}
+			});
+		});
+
+		let run = () => next().then(result => {
+			if(!result) {
+				return stats;
+			}
+			if(result.outcome == 'rotated') {
+				stats.rotated++;
+			}
+			else if(result.outcome == 'skipped') {
+				stats.skipped++;
+			}
+			else {
+				stats.failures++;
+			}
+			if(options.onCard && options.onCard(result) === false) {
+				return stats;
+			}
+			return run();
+		});
+		return run();
+	}
+
+	/**
+	* Progress of the key rotation campaign
+	* @return {Object} `{capacity, cards, rotated}`: entries of the progress table, cards seen, cards rotated
+	*/
+	getKeyRotationStats() {
+		return this[cppObj].getKeyRotationStats();
+	}
+
+	/**
+	* Drop the key rotation campaign, its progress table is flushed and closed once no device uses it
+	*/
+	clearKeyRotation() {
+		this[cppObj].clearKeyRotation();
+	}
+
+	/**
+	* Try to abort the current blocking command, and stop waiting for a card to personalize or rotate
 	* @return {Promise} A promise to the end of the action.
 	*/
 	abort() {
@@ -166,6 +699,74 @@ class Device {
 }
 
 
+/**
+* Records of a batch result, stored in a single Buffer: uint32 count, uint32 record size, then the records.
+* Fields are decoded when they are read.
+*
+* @class ResultView
+*/
+class ResultView {
+	constructor(buffer, fields) {
+		this.buffer = buffer;
+		this.fields = fields;
+		this.length = buffer.length ? buffer.readUInt32LE(0) : 0;
+		this.stride = buffer.length ? buffer.readUInt32LE(4) : 0;
+	}
+
+	/**
+	* Decode a field of a record
+	* @param {Number} index The record index
+	* @param {String} name The field name
+	* @return {Number|Buffer} The field value, `bytes` fields are slices sharing the memory of the result
+	*/
+	field(index, name) {
+		let [offset, type, length] = this.fields[name];
+		let position = 8 + index * this.stride + offset;
+		switch(type) {
+			case 'int32':
+			return this.buffer.readInt32LE(position);
+			case 'uint32':
+			return this.buffer.readUInt32LE(position);
+			case 'bytes':
+			return this.buffer.slice(position, position + length);
+			default:
+			return this.buffer.readUInt8(position);
+		}
+	}
+
+	/**
+	* Decode a whole record
+	* @param {Number} index The record index
+	* @return {Object} The record fields
+	*/
+	get(index) {
+		let record = {};
+		for (let name in this.fields) {
+			record[name] = this.field(index, name);
+		}
+		return record;
+	}
+
+	/**
+	* Decode a field of all records
+	* @param {String} name The field name
+	* @return {Array<Number>} The field values
+	*/
+	column(name) {
+		let values = new Array(this.length);
+		for (let i = 0; i < this.length; i++) {
+			values[i] = this.field(i, name);
+		}
+		return values;
+	}
+
+	*[Symbol.iterator]() {
+		for (let i = 0; i < this.length; i++) {
+			yield this.get(i);
+		}
+	}
+}
+
 /**
 * A Freefare compatible NFC tag
 *
@@ -199,6 +800,25 @@ class Tag {
 	getUID() {
 		return this[cppObj].getTagUID();
 	}
+
+	/**
+	* Set the priority of the next operations of this tag (`normal` by default).
+	* Batch operations yield between steps to more urgent operations of the same device.
+	* @param {String} priority `interactive`, `normal` or `bulk`
+	* @param {Number} [deadline] Deadline in ms from the time the operation is requested
+	*/
+	setPriority(priority, deadline) {
+		assert(priority in PRIORITIES, 'Priority must be interactive, normal or bulk');
+		this[cppObj].setPriority(PRIORITIES[priority], deadline || 0);
+	}
+
+	/**
+	* Disconnect the tag after some time without operation. It is connected again on the next operation.
+	* @param {Number} timeout Idle time in ms, 0 to stay connected (default)
+	*/
+	setIdleTimeout(timeout) {
+		this[cppObj].setIdleTimeout(timeout || 0);
+	}
 }
 
 /**
@@ -439,6 +1059,136 @@ class MifareClassicTag extends Tag {
 		});
 	}
 
+	/**
+	* Read several value blocks in one operation, of sectors the tag is authenticated on.
+	* The result is a single buffer, fields are decoded when they are read.
+	* @param {Array<Number>} blocks The block numbers
+	* @return {Promise<ResultView>} A promise to a view of `{error, value, adr}` records, in the order of the blocks
+	*/
+	readValues(blocks) {
+		assert(Array.isArray(blocks), 'readValues expects an array of blocks');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareClassic_readValues(blocks, (error, result) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve(new ResultView(result, RESULT_FIELDS.values));
+			});
+		});
+	}
+
+	/**
+	* Read blocks of several sectors in one operation, authenticating once per sector with the key its access
+	* conditions allow. Conditions missing from the access map are read from the sector trailers, when the
+	* available keys allow it, otherwise key A then key B are tried.
+	* @param {Array<Number>} blocks The block numbers
+	* @param {Object} keys The available keys: `{A: Buffer, B: Buffer}`, at least one of them
+	* @param {Object} [access] Access conditions by sector: `{sector: [C1C2C3 of block 0, 1, 2, of the trailer]}`, as 3 bits numbers
+	* @return {Promise<ResultView>} A promise to a view of `{error, keyType, data}` records, in the order of the blocks. `keyType` is 0 for key A, 1 for key B, 255 when no key was usable, and `error` is 21 when no available key may read the block
+	*/
+	readBlocks(blocks, keys, access) {
+		assert(Array.isArray(blocks), 'readBlocks expects an array of blocks');
+		assert(keys && (keys.A || keys.B), 'readBlocks expects key A or key B');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareClassic_readBlocks(blocks, keys.A, keys.B, access, (error, result) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve(new ResultView(result, RESULT_FIELDS.blocks));
+			});
+		});
+	}
+
+	/**
+	* Write data blocks of several sectors in one operation, authenticating once per sector with the key its
+	* access conditions allow, as `readBlocks` does. Sector trailers are refused.
+	* @param {Array<Number>} blocks The block numbers
+	* @param {Buffer} data 16 bytes per block, in the order of the blocks
+	* @param {Object} keys The available keys: `{A: Buffer, B: Buffer}`, at least one of them
+	* @param {Object} [access] Access conditions by sector: `{sector: [C1C2C3 of block 0, 1, 2, of the trailer]}`
+	* @return {Promise<ResultView>} A promise to a view of `{error, keyType}` records, in the order of the blocks
+	*/
+	writeBlocks(blocks, data, keys, access) {
+		assert(Array.isArray(blocks), 'writeBlocks expects an array of blocks');
+		assert(Buffer.isBuffer(data) && data.length == blocks.length * 16, 'writeBlocks expects 16 bytes per block');
+		assert(keys && (keys.A || keys.B), 'writeBlocks expects key A or key B');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareClassic_writeBlocks(blocks, data, keys.A, keys.B, access, (error, result) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve(new ResultView(result, RESULT_FIELDS.writtenBlocks));
+			});
+		});
+	}
+
+	/**
+	* Write blocks of one sector so that pulling the tag never leaves them half written. The new contents are
+	* first written to the same blocks of a shadow sector, then a journal record, then the blocks themselves.
+	* A transaction interrupted on a previous tap is finished first.
+	* @param {Array<Number>} blocks Data blocks of a single sector
+	* @param {Buffer} data 16 bytes per block, in the order of the blocks
+	* @param {Object} options `{journal, shadow, keys, access}`: the journal block, outside of both sectors, the shadow sector, of the same size as the target one, the keys and access map as for `readBlocks`
+	* @return {Promise<Number>} A promise to the version of the journal record, incremented by each transaction
+	*/
+	writeJournaled(blocks, data, options) {
+		assert(Array.isArray(blocks), 'writeJournaled expects an array of blocks');
+		assert(Buffer.isBuffer(data) && data.length == blocks.length * 16, 'writeJournaled expects 16 bytes per block');
+		assert(options && options.keys && (options.keys.A || options.keys.B), 'writeJournaled expects key A or key B');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareClassic_writeJournaled(blocks, data, options.journal, options.shadow, options.keys.A, options.keys.B, options.access, (error, version) => {
+				if(error) {
+					switch (error) {
+						case ERROR_JOURNAL:
+						reject(new Error('Invalid journaled write'));
+						break;
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve(version);
+			});
+		});
+	}
+
+	/**
+	* Check the journal of `writeJournaled` on a new tap, reading only the journal block, and the shadow sector
+	* when a transaction was interrupted after the new contents were complete; it is then finished.
+	* @param {Object} options `{journal, keys, access}`, as for `writeJournaled`
+	* @return {Promise<Object>} A promise to `{state, version}`, `state` being `clean`, `recovered` or `torn` (the tag was pulled while writing the record itself, the blocks are consistent)
+	*/
+	recoverJournal(options) {
+		assert(options && options.keys && (options.keys.A || options.keys.B), 'recoverJournal expects key A or key B');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareClassic_recoverJournal(options.journal, options.keys.A, options.keys.B, options.access, (error, outcome, version) => {
+				if(error) {
+					switch (error) {
+						case ERROR_JOURNAL:
+						reject(new Error('Corrupted journal shadow'));
+						break;
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve({state: JOURNAL_OUTCOMES[outcome], version});
+			});
+		});
+	}
+
 	/**
 	* Increment the block value by a given amount and store it in the internal data register
 	* @param {Number} block The block number between 0 and 63 (for 1k)
@@ -611,6 +1361,14 @@ class MifareDesfireTag extends Tag {
 	* @return {Promise<Number[]>} A promise to the AID list
 	*/
 	getApplicationIds() {
+		return this.getApplicationIdView().then((view) => view.column('aid'));
+	}
+
+	/**
+	* List application IDs (AID) without decoding them
+	* @return {Promise<ResultView>} A promise to a view of `{aid}` records, decoded when they are read
+	*/
+	getApplicationIdView() {
 		return new Promise((resolve, reject) => {
 			this[cppObj].mifareDesfire_getApplicationIds((error, result) => {
 				if(error) {
@@ -618,8 +1376,9 @@ class MifareDesfireTag extends Tag {
 						default:
 						reject(new Error('Unknown error (' + error + ')'));
 					}
+					return;
 				}
-				resolve(result);
+				resolve(new ResultView(result, RESULT_FIELDS.applicationIds));
 			});
 		});
 	}
@@ -648,6 +1407,14 @@ class MifareDesfireTag extends Tag {
 	* @return {Promise<Number[]>} A promise to the File ID list
 	*/
 	getFileIds() {
+		return this.getFileIdView().then((view) => view.column('file'));
+	}
+
+	/**
+	* List file IDs without decoding them
+	* @return {Promise<ResultView>} A promise to a view of `{file}` records, decoded when they are read
+	*/
+	getFileIdView() {
 		return new Promise((resolve, reject) => {
 			this[cppObj].mifareDesfire_getFileIds((error, result) => {
 				if(error) {
@@ -655,8 +1422,9 @@ class MifareDesfireTag extends Tag {
 						default:
 						reject(new Error('Unknown error (' + error + ')'));
 					}
+					return;
 				}
-				resolve(result);
+				resolve(new ResultView(result, RESULT_FIELDS.fileIds));
 			});
 		});
 	}
@@ -666,7 +1434,7 @@ class MifareDesfireTag extends Tag {
 	* Read the given file
 	* @param {Number} file The file ID
 	* @param {Number} offset The number of bytes before we start reading in the file
-	* @param {Number} length The number of bytes we will read in the file
+	* @param {Number} length The number of bytes we will read in the file, 0 to read up to the end of the file
 	* @return {Promise<Buffer>} A promise to the read data
 	*/
 	read(file, offset, length) {
@@ -683,22 +1451,136 @@ class MifareDesfireTag extends Tag {
 		});
 	}
 
+	/**
+	* Read several files, possibly from several applications, in one native call.
+	* Requests are reordered natively to select each application and authenticate each key only once.
+	* @param {Object[]} requests List of `{aid, keyNo, key, file, offset, length}`, `key` is an optional DES (8 bytes) or 3DES (16 bytes) Buffer, other lengths reject with a TypeError
+	* and a `length` of 0 reads up to the end of the file
+	* @return {Promise<Buffer[]>} A promise to the read data, in request order
+	*/
+	readFiles(requests) {
+		assert(Array.isArray(requests), 'readFiles expects an array of requests');
+		return new Promise((resolve, reject) => {
+			this[cppObj].mifareDesfire_readFiles(requests, (error, result) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+
+				// Decode the index table, payloads are returned as views on the result
+				let res = [];
+				let count = result.readUInt32LE(0);
+				for (let i = 0; i < count; i++) {
+					let entry = 4 + i * 12;
+					let fileError = result.readInt32LE(entry);
+					if(fileError) {
+						reject(new Error('Unknown error (' + fileError + ') while reading file ' + requests[i].file));
+						return;
+					}
+					let start = result.readUInt32LE(entry + 4);
+					res.push(result.slice(start, start + result.readUInt32LE(entry + 8)));
+				}
+				resolve(res);
+			});
+		});
+	}
+
 	/**
 	* Write on the given file
 	* @param {Number} file The file ID
 	* @param {Number} offset The number of bytes before we start reading in the file
 	* @param {Number} length The number of bytes we will read in the file
-	* @param {Buffer} data A data buffer
-	* @return {Promise} A promise to the end of the action.
+	* @param {Buffer} data A data buffer, written without copy: it must not be modified until the promise is settled
+	* @return {Promise<Number>} A promise to the number of bytes written
 	*/
 	write(file, offset, length, data) {		
 		return new Promise((resolve, reject) => {
-			this[cppObj].mifareDesfire_write(file, offset, length, data, (error) => {
+			this[cppObj].mifareDesfire_write(file, offset, length, data, (error, count) => {
 				if(error) {
 					switch (error) {
 						default:
 						reject(new Error('Unknown error (' + error + ')'));
 					}
+					return;
+				}
+				resolve(count);
+			});
+		});
+	}
+}
+
+/**
+* A FeliCa tag, available when libfreefare supports FeliCa
+*
+* @class FelicaTag
+* @extends Tag
+*/
+class FelicaTag extends Tag {
+	constructor(cppTag) {
+		super(cppTag);
+	}
+
+	/**
+	* Open tag for further communication, FeliCa tags need no connection
+	* @return {Promise} A promise to the end of the action.
+	*/
+	open() {
+		return Promise.resolve();
+	}
+
+	/**
+	* Close tag to release memory and device
+	* @return {Promise} A promise to the end of the action.
+	*/
+	close() {
+		return Promise.resolve();
+	}
+
+	/**
+	* Read blocks of a service without encryption, sending several blocks per command in one operation
+	* @param {Number} service The service code (`0x0009`, read/write user blocks of FeliCa Lite, by default)
+	* @param {Array<Number>} blocks The block numbers
+	* @param {Number} [perCommand] Blocks read per command, 1 to 4 (4 by default), larger values are clamped
+	* @return {Promise<Buffer>} A promise to the read data, 16 bytes per block in the order of `blocks`
+	*/
+	read(service, blocks, perCommand) {
+		assert(Array.isArray(blocks), 'read expects an array of blocks');
+		return new Promise((resolve, reject) => {
+			this[cppObj].felica_read(service === undefined ? FELICA_SERVICE_RW : service, blocks, perCommand || 0, (error, result) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
+				}
+				resolve(result);
+			});
+		});
+	}
+
+	/**
+	* Write blocks of a service without encryption, sending several blocks per command in one operation
+	* @param {Number} service The service code (`0x0009`, read/write user blocks of FeliCa Lite, by default)
+	* @param {Array<Number>} blocks The block numbers
+	* @param {Buffer} data 16 bytes per block, written without copy: it must not be modified until the promise is settled
+	* @param {Number} [perCommand] Blocks written per command, only 1 is supported by every card, larger values are clamped
+	* @return {Promise} A promise to the end of the action.
+	*/
+	write(service, blocks, data, perCommand) {
+		assert(Array.isArray(blocks), 'write expects an array of blocks');
+		assert(data.length >= blocks.length * 16, 'FeliCa blocks are 16 bytes long');
+		return new Promise((resolve, reject) => {
+			this[cppObj].felica_write(service === undefined ? FELICA_SERVICE_RW : service, blocks, data, perCommand || 0, (error) => {
+				if(error) {
+					switch (error) {
+						default:
+						reject(new Error('Unknown error (' + error + ')'));
+					}
+					return;
 				}
 				resolve();
 			});
@@ -837,4 +1719,349 @@ class NTag21xTag extends Tag {
 	}
 }
 
+// Value types of the reader socket protocol
+const WIRE_NULL = 0;
+const WIRE_NUMBER = 1;
+const WIRE_BOOLEAN = 2;
+const WIRE_STRING = 3;
+const WIRE_BUFFER = 4;
+const WIRE_JSON = 5;
+const WIRE_OBJECTS = 6;
+
+function wireEncode(value) {
+	let body;
+	let type;
+	if(value === undefined || value === null) {
+		return Buffer.from([WIRE_NULL]);
+	}
+	else if(typeof value === 'number') {
+		body = Buffer.alloc(8);
+		body.writeDoubleLE(value, 0);
+		return Buffer.concat([Buffer.from([WIRE_NUMBER]), body]);
+	}
+	else if(typeof value === 'boolean') {
+		return Buffer.from([WIRE_BOOLEAN, value ? 1 : 0]);
+	}
+	else if(typeof value === 'string') {
+		type = WIRE_STRING;
+		body = Buffer.from(value);
+	}
+	else if(Buffer.isBuffer(value)) {
+		type = WIRE_BUFFER;
+		body = value;
+	}
+	else {
+		type = WIRE_JSON;
+		body = Buffer.from(JSON.stringify(value));
+	}
+	let head = Buffer.alloc(5);
+	head.writeUInt8(type, 0);
+	head.writeUInt32LE(body.length, 1);
+	return Buffer.concat([head, body]);
+}
+
+function wireDecode(buf, offset) {
+	let type = buf.readUInt8(offset);
+	switch(type) {
+		case WIRE_NULL:
+		return {value: null, end: offset + 1};
+		case WIRE_NUMBER:
+		return {value: buf.readDoubleLE(offset + 1), end: offset + 9};
+		case WIRE_BOOLEAN:
+		return {value: buf.readUInt8(offset + 1) !== 0, end: offset + 2};
+	}
+	let length = buf.readUInt32LE(offset + 1);
+	let body = buf.slice(offset + 5, offset + 5 + length);
+	let value;
+	switch(type) {
+		case WIRE_STRING:
+		value = body.toString();
+		break;
+		case WIRE_BUFFER:
+		value = body;
+		break;
+		default:
+		value = JSON.parse(body.toString(), (key, val) => {
+			return (val && val.type === 'Buffer' && Array.isArray(val.data)) ? Buffer.from(val.data) : val;
+		});
+	}
+	return {value: value, type: type, end: offset + 5 + length};
+}
+
+// Methods a ReaderServer client may call, device configuration stays with the serving process
+const REMOTE_DEVICE_METHODS = ['open', 'close', 'listTags', 'getQueueDepth', 'getProfile'];
+const REMOTE_TAG_METHODS = ['getType', 'getFriendlyName', 'getUID', 'setPriority', 'setIdleTimeout', 'open', 'close',
+	'read', 'write', 'authenticate', 'initValue', 'readValue', 'readValues', 'readBlocks', 'writeBlocks', 'writeJournaled',
+	'recoverJournal', 'incrementValue', 'decrementValue', 'restoreValue', 'transferValue', 'authenticateDES', 'authenticate3DES',
+	'getApplicationIds', 'getApplicationIdView', 'selectApplication', 'getFileIds', 'getFileIdView', 'readFiles', 'fastRead', 'getSubType'];
+
+/**
+* Serve the devices of this process to other local processes on a Unix domain socket.
+* Emits `connection` and `disconnection` with the connection id.
+*
+* @class ReaderServer
+*/
+class ReaderServer extends EventEmitter {
+	constructor(freefare, options) {
+		super();
+		options = options || {};
+		this.freefare = freefare;
+		this[cppObj] = new objectwrapper.ReaderServer(
+			options.ringSize === undefined ? 1024 * 1024 : options.ringSize,
+			options.threshold === undefined ? 4096 : options.threshold
+		);
+
+		// Remote handles by connection, devices are shared by all connections
+		this.objects = new Map();
+		this.nextHandle = 1;
+		this.devices = new Map();
+		this.opened = new Map();
+		this.clientOpened = new Map();
+	}
+
+	/**
+	* Listen on the given socket path
+	* @param {String} path Socket path
+	*/
+	listen(path) {
+		let error = this[cppObj].listen(path, (connection, id, payload) => {
+			this._request(connection, id, payload);
+		}, (connection) => {
+			this.objects.delete(connection);
+
+			// Devices opened by the client are closed with their last user
+			for(let [name, count] of this.clientOpened.get(connection) || []) {
+				this._release(name, count).catch(() => {});
+			}
+			this.clientOpened.delete(connection);
+			this.emit('disconnection', connection);
+		});
+		if(error) {
+			throw new Error('Could not listen on ' + path + ' (' + error + ')');
+		}
+	}
+
+	/**
+	* Stop listening and close all connections
+	*/
+	close() {
+		this[cppObj].close();
+	}
+
+	// Drop opens of a device, closing it when none is left
+	_release(name, count) {
+		let opened = this.opened.get(name);
+		this.opened.set(name, Math.max(opened - count, 0));
+		return (opened && opened <= count) ? this.devices.get(name).close() : Promise.resolve();
+	}
+
+	_register(connection, object) {
+		let handle = this.nextHandle++;
+		if(!this.objects.has(connection)) {
+			this.objects.set(connection, new Map());
+			this.emit('connection', connection);
+		}
+		this.objects.get(connection).set(handle, object);
+		return handle;
+	}
+
+	_describe(connection, object) {
+		if(object instanceof Device) {
+			return {handle: this._register(connection, object), name: object.name};
+		}
+		return {
+			handle: this._register(connection, object),
+			type: object.getType(),
+			friendlyName: object.getFriendlyName(),
+			uid: object.getUID(),
+		};
+	}
+
+	_call(connection, target, method, args) {
+		if(target === this.freefare && method === 'listDevices') {
+			return this.freefare.listDevices().then((list) => {
+				// The same Device object is shared by all clients of a reader
+				return list.map((dev) => {
+					if(!this.devices.has(dev.name)) {
+						this.devices.set(dev.name, dev);
+						this.opened.set(dev.name, 0);
+					}
+					return this.devices.get(dev.name);
+				});
+			});
+		}
+		if(target instanceof Device && method === 'open') {
+			let count = this.opened.get(target.name);
+			this.opened.set(target.name, count + 1);
+			if(!this.clientOpened.has(connection)) {
+				this.clientOpened.set(connection, new Map());
+			}
+			let client = this.clientOpened.get(connection);
+			client.set(target.name, (client.get(target.name) || 0) + 1);
+			return count ? Promise.resolve() : target.open();
+		}
+		if(target instanceof Device && method === 'close') {
+			let client = this.clientOpened.get(connection);
+			if(!client || !client.get(target.name)) {
+				return Promise.resolve();
+			}
+			client.set(target.name, client.get(target.name) - 1);
+			return this._release(target.name, 1);
+		}
+		let allowed = (target instanceof Device) ? REMOTE_DEVICE_METHODS : (target instanceof Tag) ? REMOTE_TAG_METHODS : [];
+		if(!target || allowed.indexOf(method) < 0 || typeof target[method] !== 'function') {
+			return Promise.reject(new Error('Unknown method ' + method));
+		}
+		return Promise.resolve(target[method].apply(target, args));
+	}
+
+	_request(connection, id, payload) {
+		let result;
+		try {
+			let handle = payload.readUInt32LE(0);
+			let nameLength = payload.readUInt8(4);
+			let method = payload.toString('utf8', 5, 5 + nameLength);
+			let args = [];
+			let offset = 5 + nameLength;
+			while(offset < payload.length) {
+				let decoded = wireDecode(payload, offset);
+				args.push(decoded.value);
+				offset = decoded.end;
+			}
+			// Handles are only valid on the connection they were given to
+			let objects = this.objects.get(connection);
+			let target = handle ? (objects && objects.get(handle)) : this.freefare;
+			result = this._call(connection, target, method, args);
+		}
+		catch(e) {
+			result = Promise.reject(e);
+		}
+
+		result.then((value) => {
+			let objects = Array.isArray(value) && value.length && value.every((v) => v instanceof Device || v instanceof Tag);
+			if(objects || value instanceof Device || value instanceof Tag) {
+				let described = Array.isArray(value) ? value.map((object) => this._describe(connection, object)) : this._describe(connection, value);
+				let body = Buffer.from(JSON.stringify(described));
+				let head = Buffer.alloc(5);
+				head.writeUInt8(WIRE_OBJECTS, 0);
+				head.writeUInt32LE(body.length, 1);
+				this[cppObj].reply(connection, id, 0, Buffer.concat([head, body]));
+			}
+			else {
+				this[cppObj].reply(connection, id, 0, wireEncode(value));
+			}
+		}, (error) => {
+			this[cppObj].reply(connection, id, 1, wireEncode(error.message));
+		});
+	}
+}
+
+/**
+* Client of a `ReaderServer`, devices and tags it gives have the same methods as local ones.
+* Emits `close` when the connection is lost.
+*
+* @class ReaderClient
+*/
+class ReaderClient extends EventEmitter {
+	constructor() {
+		super();
+		this[cppObj] = new objectwrapper.ReaderClient();
+		this.pending = new Map();
+		this.nextId = 1;
+	}
+
+	/**
+	* Connect to a reader server
+	* @param {String} path Socket path
+	* @return {Promise<ReaderClient>} A promise to the connected client
+	*/
+	static connect(path) {
+		let client = new ReaderClient();
+		return new Promise((resolve, reject) => {
+			client[cppObj].connect(path, (status) => {
+				if(status) {
+					reject(new Error('Could not connect to ' + path + ' (' + status + ')'));
+				}
+				resolve(client);
+			}, (id, status, payload) => {
+				let request = client.pending.get(id);
+				if(!request) {
+					return;
+				}
+				client.pending.delete(id);
+				let decoded = wireDecode(payload, 0);
+				let value = decoded.value;
+				if(status) {
+					request.reject(new Error(value));
+				}
+				else if(decoded.type === WIRE_OBJECTS) {
+					let objects = value;
+					request.resolve(Array.isArray(objects) ? objects.map((desc) => client._remote(desc)) : client._remote(objects));
+				}
+				else {
+					request.resolve(value);
+				}
+			}, () => {
+				for(let request of client.pending.values()) {
+					request.reject(new Error('Connection to the reader server closed'));
+				}
+				client.pending.clear();
+				client.emit('close');
+			});
+		});
+	}
+
+	/**
+	* Give a list of the devices of the server
+	* @return {Promise<Device[]>} A promise to the remote `Device` list.
+	*/
+	listDevices() {
+		return this._call(0, 'listDevices', []);
+	}
+
+	/**
+	* Close the connection
+	*/
+	close() {
+		this[cppObj].close();
+	}
+
+	_call(handle, method, args) {
+		return new Promise((resolve, reject) => {
+			let id = this.nextId++;
+			let name = Buffer.from(method);
+			let head = Buffer.alloc(5);
+			head.writeUInt32LE(handle, 0);
+			head.writeUInt8(name.length, 4);
+			let payload = Buffer.concat([head, name].concat(args.map(wireEncode)));
+			this.pending.set(id, {resolve: resolve, reject: reject});
+			if(!this[cppObj].request(id, payload)) {
+				this.pending.delete(id);
+				reject(new Error('Not connected to the reader server'));
+			}
+		});
+	}
+
+	_remote(desc) {
+		let local = {
+			name: desc.name,
+			getType: () => desc.type,
+			getFriendlyName: () => desc.friendlyName,
+			getUID: () => desc.uid,
+		};
+		return new Proxy(local, {
+			get: (target, method) => {
+				// Not a thenable, so it can be resolved and awaited
+				if(method in target || typeof method !== 'string' || method === 'then') {
+					return target[method];
+				}
+				return (...args) => this._call(desc.handle, method, args);
+			}
+		});
+	}
+}
+
 module.exports = Freefare;
+module.exports.ReaderServer = ReaderServer;
+module.exports.ReaderClient = ReaderClient;
+module.exports.ResultView = ResultView;
@@ -1,5 +1,6 @@
 #include "device.h"
 #include "freefare.h"
+#include "server.h"
 #include "common.h"
 
 // Global vars init
@@ -10,6 +11,8 @@ NAN_MODULE_INIT(Init) {
 	Freefare::Init(target);
 	Device::Init(target);
 	Tag::Init(target);
+	ReaderServer::Init(target);
+	ReaderClient::Init(target);
 }
 
 NODE_MODULE(freefare, Init)
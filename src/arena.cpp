@@ -0,0 +1,73 @@
+#include "arena.h"
+#include "memory.h"
+
+#include <cstdlib>
+
+std::atomic<size_t> Arena::blockSize(NFF_ARENA_BLOCK_SIZE);
+std::atomic<size_t> Arena::highWater(0);
+std::atomic<size_t> Arena::overflows(0);
+
+Arena::Arena() : head(NULL), used(0), blocks(0) {}
+Arena::~Arena() {
+	size_t seen = highWater;
+	while(used > seen && !highWater.compare_exchange_weak(seen, used)) {}
+	if(blocks > 1) {
+		overflows++;
+	}
+
+	while(head) {
+		Block *next = head->next;
+		NativeMemory::Released(NFF_MEMORY_BUFFERS, sizeof(Block) + head->size);
+		free(head);
+		head = next;
+	}
+}
+
+void* Arena::Allocate(size_t size, size_t align) {
+	if(head) {
+		uintptr_t base = reinterpret_cast<uintptr_t>(head + 1);
+		size_t offset = (base + head->used + align - 1) / align * align - base;
+		if(offset + size <= head->size) {
+			head->used = offset + size;
+			used += size;
+			return reinterpret_cast<void*>(base + offset);
+		}
+	}
+
+	// New block, at least twice the last one
+	size_t capacity = head ? head->size * 2 : (size_t) blockSize;
+	while(capacity < size + align) {
+		capacity *= 2;
+	}
+	Block *block = static_cast<Block*>(malloc(sizeof(Block) + capacity));
+	if(!block) {
+		return NULL;
+	}
+	NativeMemory::Allocated(NFF_MEMORY_BUFFERS, sizeof(Block) + capacity);
+	block->next = head;
+	block->size = capacity;
+	block->used = 0;
+	head = block;
+	blocks++;
+	return Allocate(size, align);
+}
+
+size_t Arena::Used() const {
+	return used;
+}
+
+void Arena::SetBlockSize(size_t size) {
+	blockSize = size ? size : NFF_ARENA_BLOCK_SIZE;
+}
+
+size_t Arena::BlockSize() {
+	return blockSize;
+}
+
+size_t Arena::HighWater() {
+	return highWater;
+}
+
+size_t Arena::Overflows() {
+	return overflows;
+}
@@ -0,0 +1,64 @@
+#ifndef NFF_ARENA_H
+#define NFF_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// Size of the first block of an arena, until set with Arena::SetBlockSize()
+#define NFF_ARENA_BLOCK_SIZE 4096
+
+
+
+/**
+* Bump allocator for the intermediates of a batch operation. Memory is taken
+* from blocks which are all released at once with the arena, when its worker
+* is destroyed after HandleOKCallback(). A block twice as large is added when
+* one is full. The largest amount of memory used by an arena is kept, to size
+* the first block for the usual batches. Used by readFiles and the listTags
+* prefetch: results handed to JS and lists allocated by libfreefare stay outside.
+*/
+class Arena {
+
+public:
+	Arena();
+	~Arena();
+
+	// NULL when a new block can not be allocated
+	void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+	template<typename T> T* New(size_t count) {
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Bytes handed out by the arena
+	size_t Used() const;
+
+	static void SetBlockSize(size_t size);
+	static size_t BlockSize();
+
+	// Largest Used() of an arena, and number of arenas which needed more than their first block
+	static size_t HighWater();
+	static size_t Overflows();
+
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	struct Block {
+		Block *next;
+		size_t size;
+		size_t used;
+	};
+	Block *head;
+	size_t used;
+	size_t blocks;
+
+	static std::atomic<size_t> blockSize;
+	static std::atomic<size_t> highWater;
+	static std::atomic<size_t> overflows;
+};
+
+
+
+#endif /* NFF_ARENA_H */
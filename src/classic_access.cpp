@@ -0,0 +1,179 @@
+#include "classic_access.h"
+
+#include <string.h>
+
+bool ClassicAccess::Parse(const uint8_t *bytes, Conditions *conditions) {
+	uint8_t c1 = bytes[1] >> 4;
+	uint8_t c2 = bytes[2] & 0x0f;
+	uint8_t c3 = bytes[2] >> 4;
+	if((~bytes[0] & 0x0f) != c1 || ((~bytes[0] >> 4) & 0x0f) != c2 || (~bytes[1] & 0x0f) != c3) {
+		return false;
+	}
+	for(int group = 0; group < 4; group++) {
+		(*conditions)[group] = (((c1 >> group) & 1) << 2) | (((c2 >> group) & 1) << 1) | ((c3 >> group) & 1);
+	}
+	return true;
+}
+
+int ClassicAccess::Group(MifareClassicBlockNumber block) {
+	MifareClassicSectorNumber sector = mifare_classic_block_sector(block);
+	MifareClassicBlockNumber first = mifare_classic_sector_first_block(sector);
+	MifareClassicBlockNumber last = mifare_classic_sector_last_block(sector);
+	if(block == last) {
+		return NFF_ACCESS_TRAILER;
+	}
+
+	// Sectors of 16 blocks have groups of 5 blocks
+	return (last - first == 3) ? block - first : (block - first) / 5;
+}
+
+bool ClassicAccess::KeyFor(const Conditions &conditions, MifareClassicBlockNumber block, int operation, bool hasKeyA, bool hasKeyB,
+  MifareClassicKeyType *keyType) {
+	int group = Group(block);
+	uint8_t condition = conditions[group];
+	bool a = false;
+	bool b = false;
+
+	if(group == NFF_ACCESS_TRAILER) {
+		// Access bits are readable with key A, and key B for the conditions 100, 110, 011, 101 and 111
+		if(operation == NFF_ACCESS_READ) {
+			a = true;
+			b = condition >= 3;
+		}
+	}
+	else {
+		switch(condition) {
+			case 0:
+				a = b = true;
+				break;
+			case 2:
+			case 1:
+				a = b = (operation == NFF_ACCESS_READ);
+				break;
+			case 4:
+			case 6:
+				a = (operation == NFF_ACCESS_READ);
+				b = true;
+				break;
+			case 3:
+				b = true;
+				break;
+			case 5:
+				b = (operation == NFF_ACCESS_READ);
+				break;
+		}
+
+		// A readable key B is data, it can not authenticate
+		uint8_t trailer = conditions[NFF_ACCESS_TRAILER];
+		if(trailer == 0 || trailer == 2 || trailer == 1) {
+			b = false;
+		}
+	}
+
+	if(a && hasKeyA) {
+		*keyType = MFC_KEY_A;
+		return true;
+	}
+	if(b && hasKeyB) {
+		*keyType = MFC_KEY_B;
+		return true;
+	}
+	return false;
+}
+
+void ClassicAccess::Set(MifareClassicSectorNumber sector, const Conditions &conditions) {
+	sectors[sector] = conditions;
+}
+
+bool ClassicAccess::Get(MifareClassicSectorNumber sector, Conditions *conditions) const {
+	std::map<MifareClassicSectorNumber, Conditions>::const_iterator it = sectors.find(sector);
+	if(it == sectors.end()) {
+		return false;
+	}
+	*conditions = it->second;
+	return true;
+}
+
+
+ClassicAuthenticator::ClassicAuthenticator(MifareTag tag, TagSession *session, const unsigned char *keyA, const unsigned char *keyB,
+  const ClassicAccess &access)
+: tag(tag), session(session), hasKeyA(keyA != NULL), hasKeyB(keyB != NULL), access(access), authenticated(-1) {
+	memset(this->keyA, 0, sizeof(MifareClassicKey));
+	memset(this->keyB, 0, sizeof(MifareClassicKey));
+	if(hasKeyA) {
+		memcpy(this->keyA, keyA, sizeof(MifareClassicKey));
+	}
+	if(hasKeyB) {
+		memcpy(this->keyB, keyB, sizeof(MifareClassicKey));
+	}
+}
+
+int ClassicAuthenticator::Authenticate(MifareClassicBlockNumber block, int operation, MifareClassicKeyType *keyType) {
+	MifareClassicSectorNumber sector = mifare_classic_block_sector(block);
+	ClassicAccess::Conditions conditions;
+	if(!access.Get(sector, &conditions) && !learned.count(sector)) {
+		Learn(sector);
+	}
+
+	if(access.Get(sector, &conditions)) {
+		if(!ClassicAccess::KeyFor(conditions, block, operation, hasKeyA, hasKeyB, keyType)) {
+			return NFF_ERROR_CLASSIC_ACCESS;
+		}
+		return Use(sector, *keyType);
+	}
+
+	// Unknown conditions
+	int error = NFF_ERROR_CLASSIC_ACCESS;
+	if(hasKeyA) {
+		*keyType = MFC_KEY_A;
+		error = Use(sector, MFC_KEY_A);
+	}
+	if(error && hasKeyB) {
+		*keyType = MFC_KEY_B;
+		error = Use(sector, MFC_KEY_B);
+	}
+	return error;
+}
+
+void ClassicAuthenticator::Reset() {
+	authenticated = -1;
+}
+
+void ClassicAuthenticator::Reselect() {
+	authenticated = -1;
+	session->Disconnect();
+	session->Connect();
+}
+
+void ClassicAuthenticator::Learn(MifareClassicSectorNumber sector) {
+	learned.insert(sector);
+
+	// Key A can always read the access bits
+	MifareClassicKeyType keyType = hasKeyA ? MFC_KEY_A : MFC_KEY_B;
+	if((!hasKeyA && !hasKeyB) || Use(sector, keyType)) {
+		return;
+	}
+
+	MifareClassicBlock trailer;
+	ClassicAccess::Conditions conditions;
+	if(mifare_classic_read(tag, mifare_classic_sector_last_block(sector), &trailer) < 0) {
+		Reselect();
+		return;
+	}
+	if(ClassicAccess::Parse(trailer + 6, &conditions)) {
+		access.Set(sector, conditions);
+	}
+}
+
+int ClassicAuthenticator::Use(MifareClassicSectorNumber sector, MifareClassicKeyType keyType) {
+	int state = sector * 2 + (keyType == MFC_KEY_B);
+	if(authenticated == state) {
+		return 0;
+	}
+	if(mifare_classic_authenticate(tag, mifare_classic_sector_last_block(sector), keyType == MFC_KEY_A ? keyA : keyB, keyType) < 0) {
+		Reselect();
+		return NFF_ERROR_LIBNFC_EMFCAUTHFAIL;
+	}
+	authenticated = state;
+	return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef NFF_CLASSIC_ACCESS_H
+#define NFF_CLASSIC_ACCESS_H
+
+#include <map>
+#include <set>
+#include <array>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+#include "tag_session.h"
+
+/* Operations on a Classic block */
+#define NFF_ACCESS_READ 0
+#define NFF_ACCESS_WRITE 1
+
+// Group of the sector trailer
+#define NFF_ACCESS_TRAILER 3
+
+// Key type reported for a block no key could be used for
+#define NFF_ACCESS_NO_KEY 0xff
+
+
+
+/**
+* Access conditions of MIFARE Classic sectors: C1C2C3 (as 3 bits values) of
+* the three data block groups and of the trailer, parsed from the access
+* bits of the trailers or given by the caller. They tell which key allows an
+* operation on a block, so batch operations authenticate once per sector with
+* the right key instead of trying key A then key B.
+*/
+class ClassicAccess {
+
+public:
+	typedef std::array<uint8_t, 4> Conditions;
+
+	// Conditions from the access bytes (6 to 8) of a trailer, false if their inverted copy does not match
+	static bool Parse(const uint8_t *bytes, Conditions *conditions);
+
+	// Group of a block in its sector: 0 to 2 for data blocks, NFF_ACCESS_TRAILER for the trailer
+	static int Group(MifareClassicBlockNumber block);
+
+	// Key allowing an operation on a block, preferring key A, false if none of the available keys does
+	static bool KeyFor(const Conditions &conditions, MifareClassicBlockNumber block, int operation, bool hasKeyA, bool hasKeyB,
+		MifareClassicKeyType *keyType);
+
+	void Set(MifareClassicSectorNumber sector, const Conditions &conditions);
+	bool Get(MifareClassicSectorNumber sector, Conditions *conditions) const;
+
+private:
+	std::map<MifareClassicSectorNumber, Conditions> sectors;
+};
+
+
+/**
+* Authentication of a worker on the sectors it operates on: once per sector
+* with the key the access conditions allow for the operation. Conditions of
+* the sectors missing from the given access map are learned by reading their
+* trailer, otherwise key A then key B are tried.
+* Runs on worker threads.
+*/
+class ClassicAuthenticator {
+
+public:
+	// Keys may be NULL when unknown
+	ClassicAuthenticator(MifareTag tag, TagSession *session, const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access);
+
+	// 0 once authenticated for an operation on a block, NFF_ERROR_CLASSIC_ACCESS if no available key allows it
+	int Authenticate(MifareClassicBlockNumber block, int operation, MifareClassicKeyType *keyType);
+
+	// Another worker may have authenticated meanwhile
+	void Reset();
+
+	// A failed command halts the tag, it has to be selected again
+	void Reselect();
+
+private:
+	// Read the access bits of the trailer of a sector
+	void Learn(MifareClassicSectorNumber sector);
+
+	// Authenticate on a sector unless already done with this key
+	int Use(MifareClassicSectorNumber sector, MifareClassicKeyType keyType);
+
+	// Our current tag
+	MifareTag tag;
+
+	// Connection state of our tag
+	TagSession *session;
+
+	MifareClassicKey keyA;
+	MifareClassicKey keyB;
+	bool hasKeyA;
+	bool hasKeyB;
+
+	// Known access conditions, and sectors whose trailer was already read
+	ClassicAccess access;
+	std::set<MifareClassicSectorNumber> learned;
+
+	// Sector * 2 + key type of the current authentication, or -1
+	int authenticated;
+};
+
+
+#endif /* NFF_CLASSIC_ACCESS_H */
@@ -0,0 +1,69 @@
+#include "classic_journal.h"
+
+#include <string.h>
+
+ClassicJournal::ClassicJournal() : version(0), state(0), target(0), shadow(0), mask(0), crc(0) {}
+
+bool ClassicJournal::Decode(const MifareClassicBlock block) {
+	if(block[0] != NFF_JOURNAL_MAGIC || Crc(block, 14) != (block[14] | (block[15] << 8))) {
+		return false;
+	}
+	version = block[1];
+	state = block[2];
+	target = block[3];
+	shadow = block[4];
+	mask = block[5] | (block[6] << 8);
+	crc = block[7] | (block[8] << 8);
+	return state == NFF_JOURNAL_PENDING || state == NFF_JOURNAL_COMMITTED;
+}
+
+void ClassicJournal::Encode(MifareClassicBlock *block) const {
+	uint8_t *data = *block;
+	memset(data, 0, sizeof(MifareClassicBlock));
+	data[0] = NFF_JOURNAL_MAGIC;
+	data[1] = version;
+	data[2] = state;
+	data[3] = target;
+	data[4] = shadow;
+	data[5] = mask & 0xff;
+	data[6] = mask >> 8;
+	data[7] = crc & 0xff;
+	data[8] = crc >> 8;
+	uint16_t check = Crc(data, 14);
+	data[14] = check & 0xff;
+	data[15] = check >> 8;
+}
+
+bool ClassicJournal::Blank(const MifareClassicBlock block) {
+	for(size_t i = 0; i < sizeof(MifareClassicBlock); i++) {
+		if(block[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<MifareClassicBlockNumber> ClassicJournal::Blocks() const {
+	std::vector<MifareClassicBlockNumber> blocks;
+	MifareClassicBlockNumber first = mifare_classic_sector_first_block(target);
+	for(int i = 0; i < 16; i++) {
+		if(mask & (1 << i)) {
+			blocks.push_back(first + i);
+		}
+	}
+	return blocks;
+}
+
+MifareClassicBlockNumber ClassicJournal::Shadow(MifareClassicBlockNumber block) const {
+	return mifare_classic_sector_first_block(shadow) + (block - mifare_classic_sector_first_block(target));
+}
+
+uint16_t ClassicJournal::Crc(const uint8_t *data, size_t length) {
+	uint16_t crc = 0x6363;
+	for(size_t i = 0; i < length; i++) {
+		uint8_t byte = data[i] ^ (crc & 0xff);
+		byte ^= byte << 4;
+		crc = (crc >> 8) ^ ((uint16_t) byte << 8) ^ ((uint16_t) byte << 3) ^ (byte >> 4);
+	}
+	return crc;
+}
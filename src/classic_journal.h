@@ -0,0 +1,74 @@
+#ifndef NFF_CLASSIC_JOURNAL_H
+#define NFF_CLASSIC_JOURNAL_H
+
+#include <vector>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+
+/* States of a journal record */
+#define NFF_JOURNAL_PENDING 1
+#define NFF_JOURNAL_COMMITTED 2
+
+/* Outcomes of a journal check, reported to JS */
+#define NFF_JOURNAL_CLEAN 0
+#define NFF_JOURNAL_RECOVERED 1
+#define NFF_JOURNAL_TORN 2
+
+// First byte of a journal record
+#define NFF_JOURNAL_MAGIC 0x4a
+
+
+
+/**
+* Journal record of a tear-safe multi-block write on a MIFARE Classic, one
+* block long. A transaction writes the new contents to the same blocks of a
+* shadow sector, the record as pending, the target blocks, then the record as
+* committed. A pending record means the shadow holds the complete update, so
+* the next tap rolls it forward by reading the journal block and the shadow
+* sector only. A torn record means the tag was pulled while writing the record
+* itself, before or after all the target blocks were written: they are
+* consistent either way.
+*
+* Layout: magic, version, state, target sector, shadow sector, uint16 block
+* mask, uint16 CRC of the new contents, 5 reserved bytes, uint16 CRC of the
+* first 14 bytes. Integers are little endian, CRCs are ISO/IEC 14443-A ones.
+*/
+class ClassicJournal {
+
+public:
+	ClassicJournal();
+
+	// false if the record is empty or torn
+	bool Decode(const MifareClassicBlock block);
+	void Encode(MifareClassicBlock *block) const;
+
+	// An erased block, never written as a journal
+	static bool Blank(const MifareClassicBlock block);
+
+	// Target blocks of the record, in ascending order
+	std::vector<MifareClassicBlockNumber> Blocks() const;
+
+	// Shadow of a target block
+	MifareClassicBlockNumber Shadow(MifareClassicBlockNumber block) const;
+
+	static uint16_t Crc(const uint8_t *data, size_t length);
+
+	uint8_t version;
+	uint8_t state;
+	MifareClassicSectorNumber target;
+	MifareClassicSectorNumber shadow;
+
+	// Bit i for the block i of the sector
+	uint16_t mask;
+
+	// CRC of the new contents of the blocks, in ascending order
+	uint16_t crc;
+};
+
+
+#endif /* NFF_CLASSIC_JOURNAL_H */
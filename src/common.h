@@ -6,6 +6,20 @@ extern "C" {
 
 #define NFF_ERROR_OPEN_DEVICE 11
 #define NFF_ERROR_INIT_LIBNFC 10
+#define NFF_ERROR_QUEUE_FULL 12
+#define NFF_ERROR_QUEUE_DROPPED 13
+#define NFF_ERROR_DEVICE_RESET 14
+#define NFF_ERROR_TAG_CLAIMED 15
+#define NFF_ERROR_CALIBRATION_UNSUPPORTED 16
+#define NFF_ERROR_THREAD_POLICY 17
+#define NFF_ERROR_PERSONALIZATION_JOB 18
+#define NFF_ERROR_PERSONALIZATION_EMPTY 19
+#define NFF_ERROR_PERSONALIZATION_TIMEOUT 20
+#define NFF_ERROR_CLASSIC_ACCESS 21
+#define NFF_ERROR_JOURNAL 22
+#define NFF_ERROR_ROTATION 23
+#define NFF_ERROR_ROTATION_TIMEOUT 24
+#define NFF_ERROR_ROTATION_FULL 25
 
 /* LibNFC errors binding */
 #define NFF_ERROR_LIBNFC_UNKNOWN 100
@@ -0,0 +1,74 @@
+#include "desfire_file_cache.h"
+
+DesfireFileCache::DesfireFileCache() : selected(false), aid(0) {}
+DesfireFileCache::~DesfireFileCache() {}
+
+void DesfireFileCache::Reset() {
+	std::lock_guard<std::mutex> lock(mutex);
+	selected = false;
+	aid = 0;
+	files.clear();
+}
+
+void DesfireFileCache::Select(uint32_t aid) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!selected || this->aid != aid) {
+		files.clear();
+	}
+	selected = true;
+	this->aid = aid;
+}
+
+bool DesfireFileCache::IsSelected(uint32_t aid) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return selected && this->aid == aid;
+}
+
+bool DesfireFileCache::GetSelected(uint32_t *aid) {
+	std::lock_guard<std::mutex> lock(mutex);
+	*aid = this->aid;
+	return selected;
+}
+
+bool DesfireFileCache::HasSettings(uint8_t file) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return files.find(file) != files.end();
+}
+
+int DesfireFileCache::GetSettings(MifareTag tag, uint8_t file, struct mifare_desfire_file_settings *settings) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = files.find(file);
+		if(it != files.end()) {
+			*settings = it->second;
+			return 0;
+		}
+	}
+
+	// Do not hold the lock during the RF exchange
+	int error = mifare_desfire_get_file_settings(tag, file, settings);
+	if(error < 0) {
+		return error;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	files[file] = *settings;
+	return 0;
+}
+
+ssize_t DesfireFileCache::GetFileSize(MifareTag tag, uint8_t file) {
+	struct mifare_desfire_file_settings settings;
+	int error = GetSettings(tag, file, &settings);
+	if(error < 0) {
+		return error;
+	}
+
+	switch(settings.file_type) {
+		case MDFT_STANDARD_DATA_FILE:
+		case MDFT_BACKUP_DATA_FILE:
+			return settings.settings.standard_file.file_size;
+		default:
+			// Only data files can be read with mifare_desfire_read_data
+			return -1;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef NFF_DESFIRE_FILE_CACHE_H
+#define NFF_DESFIRE_FILE_CACHE_H
+
+#include <map>
+#include <mutex>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+
+
+
+/**
+* Cache of the DESFire file settings of the currently selected application.
+* It is filled lazily by workers and dropped whenever another application
+* is selected or the tag is connected/disconnected.
+*/
+class DesfireFileCache {
+
+public:
+	DesfireFileCache();
+	~DesfireFileCache();
+
+	// Forget everything, including the selected application
+	void Reset();
+
+	// Record a successful application selection
+	void Select(uint32_t aid);
+	bool IsSelected(uint32_t aid);
+	bool GetSelected(uint32_t *aid);
+
+	// Settings of a file in the selected application, from the cache or the tag
+	int GetSettings(MifareTag tag, uint8_t file, struct mifare_desfire_file_settings *settings);
+	bool HasSettings(uint8_t file);
+
+	// Size of a data file, or a negative error
+	ssize_t GetFileSize(MifareTag tag, uint8_t file);
+
+private:
+	std::mutex mutex;
+
+	// Selected application
+	bool selected;
+	uint32_t aid;
+
+	// File settings by file ID
+	std::map<uint8_t, struct mifare_desfire_file_settings> files;
+};
+
+
+#endif /* NFF_DESFIRE_FILE_CACHE_H */
@@ -1,9 +1,82 @@
 #include "device.h"
 
+#include <unistd.h>
+#include <algorithm>
+
 using namespace Nan;
 
-Device::Device(std::string connstring) : connstring(connstring) {}
-Device::~Device() {}
+// Longest wait between two reconnection attempts (ms)
+#define NFF_RECONNECT_MAX_INTERVAL 5000
+
+static const struct {
+	const char *name;
+	nfc_property property;
+	bool isInt;
+} deviceProperties[] = {
+	{"NP_TIMEOUT_COMMAND", NP_TIMEOUT_COMMAND, true},
+	{"NP_TIMEOUT_ATR", NP_TIMEOUT_ATR, true},
+	{"NP_TIMEOUT_COM", NP_TIMEOUT_COM, true},
+	{"NP_HANDLE_CRC", NP_HANDLE_CRC, false},
+	{"NP_HANDLE_PARITY", NP_HANDLE_PARITY, false},
+	{"NP_ACTIVATE_FIELD", NP_ACTIVATE_FIELD, false},
+	{"NP_ACTIVATE_CRYPTO1", NP_ACTIVATE_CRYPTO1, false},
+	{"NP_INFINITE_SELECT", NP_INFINITE_SELECT, false},
+	{"NP_ACCEPT_INVALID_FRAMES", NP_ACCEPT_INVALID_FRAMES, false},
+	{"NP_ACCEPT_MULTIPLE_FRAMES", NP_ACCEPT_MULTIPLE_FRAMES, false},
+	{"NP_AUTO_ISO14443_4", NP_AUTO_ISO14443_4, false},
+	{"NP_EASY_FRAMING", NP_EASY_FRAMING, false},
+	{"NP_FORCE_ISO14443_A", NP_FORCE_ISO14443_A, false},
+	{"NP_FORCE_ISO14443_B", NP_FORCE_ISO14443_B, false},
+	{"NP_FORCE_SPEED_106", NP_FORCE_SPEED_106, false}
+};
+
+// Tag type from its name in JS, false if it is unknown
+static bool tagType(const std::string &name, mifare_tag_type *type) {
+	if(name == "MIFARE_CLASSIC_1K") *type = CLASSIC_1K;
+	else if(name == "MIFARE_CLASSIC_4K") *type = CLASSIC_4K;
+	else if(name == "MIFARE_DESFIRE") *type = DESFIRE;
+	else if(name == "MIFARE_ULTRALIGHT") *type = ULTRALIGHT;
+	else if(name == "MIFARE_ULTRALIGHT_C") *type = ULTRALIGHT_C;
+	else if(name == "NTAG_21x") *type = NTAG_21x;
+#ifdef FELICA_SC_RW
+	else if(name == "FELICA") *type = FELICA;
+#endif
+	else return false;
+	return true;
+}
+
+// Tags of a device, listed by libfreefare unless a filter or discovery hints are set
+static MifareTag* listTags(nfc_device *device, const TagFilter &filter, const Discovery &discovery) {
+	if(filter.Empty() && discovery.Empty()) {
+		return freefare_get_tags(device);
+	}
+	return filter.List(device, discovery);
+}
+
+static int applyProperty(nfc_device *device, const DeviceProperty &property) {
+	if(property.isInt) {
+		return nfc_device_set_property_int(device, property.property, property.value);
+	}
+	return nfc_device_set_property_bool(device, property.property, property.value != 0);
+}
+
+Device::Device(std::string connstring) : device(NULL), connstring(connstring), priority(NFF_PRIORITY_INTERACTIVE), deadline(0),
+  monitor(false), attempts(0), interval(0), healthCallback(NULL), reconnecting(false), reconnectAttempt(0), reconnectWait(0), reconnectTimer(NULL) {
+	scheduler.SetDevice(&device, [this](int error) {
+		DeviceError(error);
+	});
+}
+Device::~Device() {
+	delete healthCallback;
+	if(reconnectTimer) {
+		uv_close(reinterpret_cast<uv_handle_t*>(reconnectTimer), [](uv_handle_t *handle) {
+			delete reinterpret_cast<uv_timer_t*>(handle);
+		});
+	}
+	for(size_t i = 0; i < plans.size(); i++) {
+		delete plans[i];
+	}
+}
 
 
 NAN_MODULE_INIT(Device::Init) {
@@ -16,6 +89,24 @@ NAN_MODULE_INIT(Device::Init) {
 	Nan::SetPrototypeMethod(tpl, "listTags", Device::ListTags);
 	Nan::SetPrototypeMethod(tpl, "getConnstring", Device::GetConnstring);
 	Nan::SetPrototypeMethod(tpl, "abort", Device::Abort);
+	Nan::SetPrototypeMethod(tpl, "setPriority", Device::SetPriority);
+	Nan::SetPrototypeMethod(tpl, "setQueueLimit", Device::SetQueueLimit);
+	Nan::SetPrototypeMethod(tpl, "getQueueDepth", Device::GetQueueDepth);
+	Nan::SetPrototypeMethod(tpl, "setProperty", Device::SetProperty);
+	Nan::SetPrototypeMethod(tpl, "setHealthMonitor", Device::SetHealthMonitor);
+	Nan::SetPrototypeMethod(tpl, "setPrefetch", Device::SetPrefetch);
+	Nan::SetPrototypeMethod(tpl, "getProfile", Device::GetProfile);
+	Nan::SetPrototypeMethod(tpl, "setProfile", Device::SetProfile);
+	Nan::SetPrototypeMethod(tpl, "setTagFilter", Device::SetTagFilter);
+	Nan::SetPrototypeMethod(tpl, "setDiscovery", Device::SetDiscovery);
+	Nan::SetPrototypeMethod(tpl, "setIoThread", Device::SetIoThread);
+	Nan::SetPrototypeMethod(tpl, "preparePersonalization", Device::PreparePersonalization);
+	Nan::SetPrototypeMethod(tpl, "personalizeNext", Device::PersonalizeNext);
+	Nan::SetPrototypeMethod(tpl, "clearPersonalization", Device::ClearPersonalization);
+	Nan::SetPrototypeMethod(tpl, "setKeyRotation", Device::SetKeyRotation);
+	Nan::SetPrototypeMethod(tpl, "rotateNext", Device::RotateNext);
+	Nan::SetPrototypeMethod(tpl, "getKeyRotationStats", Device::GetKeyRotationStats);
+	Nan::SetPrototypeMethod(tpl, "clearKeyRotation", Device::ClearKeyRotation);
 
 	constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
 	Nan::Set(target, Nan::New("Device").ToLocalChecked(),
@@ -50,16 +141,264 @@ v8::Handle<v8::Value> Device::Instantiate(std::string connstring) {
 	return scope.Escape(Nan::NewInstance(cons, 1, argv).ToLocalChecked());
 }
 
+Scheduler* Device::GetScheduler() {
+	return &scheduler;
+}
+
+DeviceProfile* Device::GetProfile() {
+	return &profile;
+}
+
+void Device::Queue(DeviceWorker *worker) {
+	// Keep the device alive until the worker completes
+	worker->SaveToPersistent("device", handle());
+	scheduler.Queue(worker, this, 0, priority, deadline ? Scheduler::Now() + deadline : 0);
+}
+
+std::shared_ptr<std::atomic<bool>> Device::AbortToken() {
+	// Forget the workers gone
+	abortTokens.erase(std::remove_if(abortTokens.begin(), abortTokens.end(), [](const std::weak_ptr<std::atomic<bool>> &token) {
+		return token.expired();
+	}), abortTokens.end());
+
+	std::shared_ptr<std::atomic<bool>> token = std::make_shared<std::atomic<bool>>(false);
+	abortTokens.push_back(token);
+	return token;
+}
+
+/**
+* Set the priority class and relative deadline of the next device operations
+*/
+NAN_METHOD(Device::SetPriority) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	obj->priority = info[0]->Uint32Value();
+	obj->deadline = info[1]->Uint32Value();
+}
+
+/**
+* Bound the number of waiting operations of the device and its tags
+*/
+NAN_METHOD(Device::SetQueueLimit) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	if(info[2]->IsFunction()) {
+		obj->scheduler.SetDepthCallback(new Callback(info[2].As<v8::Function>()));
+	}
+	obj->scheduler.SetLimit(info[0]->Uint32Value(), info[1]->Uint32Value());
+}
+
+NAN_METHOD(Device::GetQueueDepth) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	info.GetReturnValue().Set(Nan::New<v8::Number>(obj->scheduler.Depth()));
+}
+
+/**
+* Set a libnfc property, it is replayed when the device is reopened
+*/
+class SetPropertyWorker : public DeviceWorker {
+public:
+	SetPropertyWorker(Callback *callback, nfc_device **device, DeviceProperty property)
+	: DeviceWorker(callback), device(device), property(property), error(0) {}
+	~SetPropertyWorker() {}
+
+	void Execute () {
+		error = applyProperty(*device, property);
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error)
+		};
+
+		callback->Call(1, argv);
+	}
+
+private:
+
+	// LibNFC device
+	nfc_device** device;
+
+	// Property to set
+	DeviceProperty property;
+
+	// Error ID or 0
+	int error;
+};
+NAN_METHOD(Device::SetProperty) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	std::string name = std::string(*v8::String::Utf8Value(info[0]->ToString()));
+	Callback *callback = new Callback(info[2].As<v8::Function>());
+
+	size_t i = 0;
+	while(i < sizeof(deviceProperties) / sizeof(deviceProperties[0]) && name != deviceProperties[i].name) {
+		i++;
+	}
+	if(i == sizeof(deviceProperties) / sizeof(deviceProperties[0])) {
+		v8::Local<v8::Value> argv[] = {
+			Nan::New<v8::Number>(NFF_ERROR_LIBNFC_EINVARG)
+		};
+		callback->Call(1, argv);
+		delete callback;
+		return;
+	}
+
+	DeviceProperty property;
+	property.property = deviceProperties[i].property;
+	property.isInt = deviceProperties[i].isInt;
+	property.value = property.isInt ? info[1]->Int32Value() : info[1]->BooleanValue();
+
+	// Only the last value of each property is replayed
+	obj->properties.erase(std::remove_if(obj->properties.begin(), obj->properties.end(), [&property](const DeviceProperty &p) {
+		return p.property == property.property;
+	}), obj->properties.end());
+	obj->properties.push_back(property);
+
+	obj->Queue(new SetPropertyWorker(callback, &(obj->device), property));
+}
+
+/**
+* One attempt to reopen the device after it was lost, the device schedules
+* the next one on a timer so no pool thread sleeps during the backoff
+*/
+class ReconnectWorker : public DeviceWorker {
+public:
+	ReconnectWorker(Device *owner, std::string connstring, nfc_device **device, std::vector<DeviceProperty> properties)
+	: DeviceWorker(NULL), owner(owner), connstring(connstring), device(device), properties(properties) {}
+	~ReconnectWorker() {}
+
+	bool NeedsDevice() const {
+		return false;
+	}
+
+	void Execute () {
+		if(*device) {
+			nfc_close(*device);
+			*device = NULL;
+		}
+
+		*device = nfc_open(libnfc_context, connstring.c_str());
+		if(*device) {
+			for(size_t i = 0; i < properties.size(); i++) {
+				applyProperty(*device, properties[i]);
+			}
+		}
+	}
+
+	void HandleOKCallback () {
+		owner->Reconnected(*device != NULL);
+	}
+
+private:
+
+	// Device to notify, kept alive by the persistent handle
+	Device *owner;
+
+	// Description of the connexion to the device
+	std::string connstring;
+
+	// LibNFC device
+	nfc_device** device;
+
+	// Properties to replay
+	std::vector<DeviceProperty> properties;
+};
+
+/**
+* Watch device errors and reconnect it when it is lost
+*/
+NAN_METHOD(Device::SetHealthMonitor) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	obj->monitor = info[0]->BooleanValue();
+	obj->attempts = info[1]->Uint32Value();
+	obj->interval = info[2]->Uint32Value();
+	if(info[3]->IsFunction()) {
+		delete obj->healthCallback;
+		obj->healthCallback = new Callback(info[3].As<v8::Function>());
+	}
+}
+
+void Device::DeviceError(int error) {
+	if(!monitor || !healthCallback || reconnecting || (error != NFC_EIO && error != NFC_ENOTSUCHDEV)) {
+		return;
+	}
+	Nan::HandleScope scope;
+
+	reconnecting = true;
+
+	// Tags of the lost device are gone, their pending operations are rejected
+	scheduler.NextGeneration();
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::String>("lost").ToLocalChecked(),
+		Nan::New<v8::Number>(LIBNFC_ERROR_TO_NFF(error))
+	};
+	healthCallback->Call(2, argv);
+
+	// Exponential backoff, the first attempt is immediate
+	reconnectAttempt = 0;
+	reconnectWait = interval;
+	Reconnect();
+}
+
+void Device::Reconnect() {
+	ReconnectWorker *worker = new ReconnectWorker(this, connstring, &device, properties);
+	worker->SaveToPersistent("device", handle());
+	scheduler.Queue(worker, this, 0, NFF_PRIORITY_SYSTEM, 0);
+}
+
+void Device::Reconnected(bool opened) {
+	Nan::HandleScope scope;
+
+	reconnectAttempt++;
+	if(!opened && reconnectAttempt < attempts) {
+		if(!reconnectTimer) {
+			reconnectTimer = new uv_timer_t;
+			uv_timer_init(uv_default_loop(), reconnectTimer);
+			reconnectTimer->data = this;
+		}
+
+		// Kept alive until the timer fires
+		Ref();
+		uv_timer_start(reconnectTimer, Device::OnReconnectTimer, reconnectWait, 0);
+		reconnectWait = std::min<uint32_t>(reconnectWait * 2, NFF_RECONNECT_MAX_INTERVAL);
+		return;
+	}
+
+	reconnecting = false;
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::String>(opened ? "reconnected" : "failed").ToLocalChecked(),
+		Nan::New<v8::Number>(reconnectAttempt)
+	};
+	healthCallback->Call(2, argv);
+}
+
+void Device::OnReconnectTimer(uv_timer_t *timer) {
+	Device *obj = static_cast<Device*>(timer->data);
+	Nan::HandleScope scope;
+	obj->Reconnect();
+	obj->Unref();
+}
+
 /**
 * OpenDevice
 */
-class OpenWorker : public AsyncWorker {
+class OpenWorker : public DeviceWorker {
 public:
 	OpenWorker(Callback *callback, std::string connstring, nfc_device **devicecde)
-	: AsyncWorker(callback), connstring(connstring), deviceabc(devicecde) {}
+	: DeviceWorker(callback), connstring(connstring), deviceabc(devicecde) {}
 
 	~OpenWorker() {}
 
+	bool NeedsDevice() const {
+		return false;
+	}
+
 	void Execute () {
 		// open Device
 		*deviceabc = nfc_open(libnfc_context, connstring.c_str());
@@ -94,20 +433,28 @@ NAN_METHOD(Device::Open) {
 	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
 
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new OpenWorker(callback, obj->connstring, &(obj->device)));
+	obj->Queue(new OpenWorker(callback, obj->connstring, &(obj->device)));
 }
 
 /**
 * CloseDevice
 */
-class CloseWorker : public AsyncWorker {
+class CloseWorker : public DeviceWorker {
 public:
-	CloseWorker(Callback *callback, nfc_device *device)
-	: AsyncWorker(callback), device(device) {}
+	CloseWorker(Callback *callback, nfc_device **device)
+	: DeviceWorker(callback), device(device) {}
 	~CloseWorker() {}
 
+	// Closing a closed or lost device does nothing
+	bool NeedsDevice() const {
+		return false;
+	}
+
 	void Execute () {
-		nfc_close(device);
+		if(*device) {
+			nfc_close(*device);
+			*device = NULL;
+		}
 	}
 
 	void HandleOKCallback () {
@@ -123,13 +470,13 @@ public:
 private:
 
 	// LibNFC device
-	nfc_device* device;
+	nfc_device** device;
 };
 NAN_METHOD(Device::Close) {
 	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
 
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new CloseWorker(callback, obj->device));
+	obj->Queue(new CloseWorker(callback, &(obj->device)));
 }
 
 
@@ -141,36 +488,76 @@ NAN_METHOD(Device::GetConnstring) {
 
 
 
-class ListTagsWorker : public AsyncWorker {
+class ListTagsWorker : public DeviceWorker {
 public:
-	ListTagsWorker(Callback *callback, nfc_device *devicecde)
-	: AsyncWorker(callback), deviceabc(devicecde) {}
+	ListTagsWorker(Callback *callback, nfc_device **devicecde, Scheduler *scheduler, TagFilter filter, Discovery discovery, std::vector<PrefetchEntry> prefetch)
+	: DeviceWorker(callback), deviceabc(devicecde), scheduler(scheduler), filter(filter), discovery(discovery), prefetch(prefetch), tags(NULL) {}
 
-	~ListTagsWorker() {}
+	~ListTagsWorker() {
+		// Tags not handed over to Tag objects
+		if(tags) {
+			freefare_free_tags(tags);
+		}
+	}
 
 	void Execute () {
-		// open Device
-		tags = freefare_get_tags(deviceabc);
+		// open Device, tags not matching the filter are never created
+		tags = listTags(*deviceabc, filter, discovery);
+
+		// Drop tags claimed by another device
+		if(tags) {
+			size_t count = 0;
+			for(size_t i = 0; tags[i]; i++) {
+				char *uid = freefare_get_tag_uid(tags[i]);
+				bool claimed = !uid || TagClaims::Claim(uid, scheduler);
+				if(claimed) {
+					tags[count++] = tags[i];
+				}
+				else {
+					lost.push_back(uid);
+					freefare_free_tag(tags[i]);
+				}
+				free(uid);
+			}
+			tags[count] = NULL;
+
+			// Read what JS asks next while the tag is in the field
+			if(!prefetch.empty()) {
+				prefetched.resize(count);
+				for(size_t i = 0; i < count; i++) {
+					prefetched[i].Fill(tags[i], prefetch, &arena);
+				}
+			}
+		}
 	}
 
 	void HandleOKCallback () {
 		Nan:: HandleScope scope;
 
+		// Operations still waiting on the tags now claimed by another device
+		for (size_t i = 0; i < lost.size(); i++) {
+			scheduler->DropClaimed(lost[i]);
+		}
+
 		v8::Local<v8::Value> err = Null();
 
 		// Find number of tags
 		size_t count = 0;
-		while(tags[count]) {
+		while(tags && tags[count]) {
 			count++;
 		}
 
 		// Return tags objects
 		v8::Local<v8::Array> results = New<v8::Array>(count);
 		for (size_t i = 0; i < count; i++) {
-			v8::Local<v8::Value> tmp = Tag::Instantiate(tags[i]);
+			v8::Local<v8::Value> tmp = Tag::Instantiate(tags[i], GetFromPersistent("device"), i < prefetched.size() ? &prefetched[i] : NULL);
 			Nan::Set(results, i, tmp);
 		}
 
+		// Each Tag object now owns its tag, only the list is left
+		free(tags);
+		tags = NULL;
+
 		v8::Local<v8::Value> argv[] = {
 			err,
 			results
@@ -183,16 +570,91 @@ public:
 private:
 
 	// LibNFC device
-	nfc_device* deviceabc;
+	nfc_device** deviceabc;
+
+	// Claim owner of the device
+	Scheduler *scheduler;
+
+	// Tags to keep
+	TagFilter filter;
+
+	// Modulations polled and expected tag types
+	Discovery discovery;
+
+	// Prefetch profile and data read from each tag
+	std::vector<PrefetchEntry> prefetch;
+	std::vector<PrefetchCache> prefetched;
+
+	// Read buffers of the prefetch, released with the worker
+	Arena arena;
 
 	// Found tags
 	MifareTag* tags;
+
+	// UIDs claimed by another device
+	std::vector<std::string> lost;
 };
 NAN_METHOD(Device::ListTags) {
 	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
 
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new ListTagsWorker(callback, obj->device));
+	obj->Queue(new ListTagsWorker(callback, &(obj->device), &(obj->scheduler), obj->filter, obj->discovery, obj->prefetch));
+}
+
+/**
+* Set the regions read from each tag found by listTags()
+*/
+NAN_METHOD(Device::SetPrefetch) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	v8::Local<v8::Array> list = info[0].As<v8::Array>();
+	obj->prefetch.clear();
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		v8::Local<v8::Object> item = Nan::Get(list, i).ToLocalChecked()->ToObject();
+		PrefetchEntry entry;
+		memset(&entry, 0, sizeof(entry));
+
+		std::string type = std::string(*v8::String::Utf8Value(Nan::Get(item, Nan::New("type").ToLocalChecked()).ToLocalChecked()->ToString()));
+		if(type == "MIFARE_ULTRALIGHT") {
+			entry.type = NFF_PREFETCH_ULTRALIGHT;
+		}
+		else if(type == "MIFARE_CLASSIC") {
+			entry.type = NFF_PREFETCH_CLASSIC;
+		}
+		else if(type == "MIFARE_DESFIRE") {
+			entry.type = NFF_PREFETCH_DESFIRE;
+		}
+		else if(type == "NTAG_21x") {
+			entry.type = NFF_PREFETCH_NTAG21X;
+		}
+		else {
+			continue;
+		}
+
+		entry.start = Nan::Get(item, Nan::New("start").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+		entry.count = Nan::Get(item, Nan::New("count").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+		entry.file = Nan::Get(item, Nan::New("file").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+		entry.keyNo = Nan::Get(item, Nan::New("keyNo").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+
+		v8::Local<v8::Value> aid = Nan::Get(item, Nan::New("aid").ToLocalChecked()).ToLocalChecked();
+		if(node::Buffer::HasInstance(aid) && node::Buffer::Length(aid) >= 3) {
+			uint8_t *bytes = reinterpret_cast<uint8_t*>(node::Buffer::Data(aid));
+			entry.aid = bytes[2] | (bytes[1]<<8) | (bytes[0]<<16);
+		}
+
+		v8::Local<v8::Value> key = Nan::Get(item, Nan::New("key").ToLocalChecked()).ToLocalChecked();
+		if(node::Buffer::HasInstance(key)) {
+			entry.keyLength = std::min<size_t>(node::Buffer::Length(key), sizeof(entry.key));
+			memcpy(entry.key, node::Buffer::Data(key), entry.keyLength);
+			if(entry.type == NFF_PREFETCH_DESFIRE) {
+				entry.keyLength = (entry.keyLength >= 16) ? 16 : 8;
+			}
+		}
+		v8::Local<v8::Value> keyType = Nan::Get(item, Nan::New("keyType").ToLocalChecked()).ToLocalChecked();
+		entry.keyType = (keyType->IsString() && std::string(*v8::String::Utf8Value(keyType->ToString())) == "B") ? MFC_KEY_B : MFC_KEY_A;
+
+		obj->prefetch.push_back(entry);
+	}
 }
 
 /**
@@ -206,15 +668,18 @@ public:
 	~AbortWorker() {}
 
 	void Execute () {
-		error = nfc_abort_command(deviceabc);
+		// Nothing runs on a closed device
+		error = deviceabc ? nfc_abort_command(deviceabc) : 0;
 	}
 
 	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
 		v8::Local<v8::Value> argv[] = {
 			New<v8::Number>(error)
 		};
 
-		callback->Call(2, argv);
+		callback->Call(1, argv);
 	}
 private:
 	// LibNFC device
@@ -227,6 +692,749 @@ private:
 NAN_METHOD(Device::Abort) {
 	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
 
+	// Not queued on the device scheduler: it has to run while another worker blocks the device
+	for(size_t i = 0; i < obj->abortTokens.size(); i++) {
+		std::shared_ptr<std::atomic<bool>> token = obj->abortTokens[i].lock();
+		if(token) {
+			*token = true;
+		}
+	}
+	obj->abortTokens.clear();
 	Callback *callback = new Callback(info[0].As<v8::Function>());
 	AsyncQueueWorker(new AbortWorker(callback, obj->device));
 }
+
+/**
+* Reader timings used by batch reads
+*/
+NAN_METHOD(Device::GetProfile) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+	info.GetReturnValue().Set(obj->profile.ToObject());
+}
+
+NAN_METHOD(Device::SetProfile) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+	obj->profile.FromObject(info[0]->ToObject());
+}
+
+/**
+* Keep only the tags matching one of the rules in listTags(), all tags if there is none
+*/
+NAN_METHOD(Device::SetTagFilter) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	v8::Local<v8::Array> list = info[0].As<v8::Array>();
+	std::vector<TagFilterRule> rules;
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		v8::Local<v8::Object> item = Nan::Get(list, i).ToLocalChecked()->ToObject();
+		TagFilterRule rule;
+		rule.hasType = false;
+		rule.type = CLASSIC_1K;
+		rule.hasAtqa = false;
+		rule.atqa = rule.atqaMask = 0;
+		rule.hasSak = false;
+		rule.sak = rule.sakMask = 0;
+
+		v8::Local<v8::Value> type = Nan::Get(item, Nan::New("type").ToLocalChecked()).ToLocalChecked();
+		if(type->IsString()) {
+			rule.hasType = true;
+			if(!tagType(std::string(*v8::String::Utf8Value(type->ToString())), &rule.type)) {
+				continue;
+			}
+		}
+
+		v8::Local<v8::Value> uidPrefix = Nan::Get(item, Nan::New("uidPrefix").ToLocalChecked()).ToLocalChecked();
+		if(uidPrefix->IsString()) {
+			rule.uidPrefix = std::string(*v8::String::Utf8Value(uidPrefix->ToString()));
+		}
+
+		v8::Local<v8::Value> atqa = Nan::Get(item, Nan::New("atqa").ToLocalChecked()).ToLocalChecked();
+		if(atqa->IsNumber()) {
+			v8::Local<v8::Value> mask = Nan::Get(item, Nan::New("atqaMask").ToLocalChecked()).ToLocalChecked();
+			rule.hasAtqa = true;
+			rule.atqa = atqa->Uint32Value();
+			rule.atqaMask = mask->IsNumber() ? mask->Uint32Value() : 0xffff;
+		}
+
+		v8::Local<v8::Value> sak = Nan::Get(item, Nan::New("sak").ToLocalChecked()).ToLocalChecked();
+		if(sak->IsNumber()) {
+			v8::Local<v8::Value> mask = Nan::Get(item, Nan::New("sakMask").ToLocalChecked()).ToLocalChecked();
+			rule.hasSak = true;
+			rule.sak = sak->Uint32Value();
+			rule.sakMask = mask->IsNumber() ? mask->Uint32Value() : 0xff;
+		}
+
+		rules.push_back(rule);
+	}
+	obj->filter.SetRules(rules);
+}
+
+/**
+* Restrict the modulations polled to find tags and declare the expected tag types
+*/
+NAN_METHOD(Device::SetDiscovery) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	std::vector<nfc_modulation> modulations;
+	v8::Local<v8::Array> list = info[0].As<v8::Array>();
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		std::string name = std::string(*v8::String::Utf8Value(Nan::Get(list, i).ToLocalChecked()->ToString()));
+		nfc_modulation modulation;
+		if(name == "ISO14443A") {
+			modulation.nmt = NMT_ISO14443A;
+			modulation.nbr = NBR_106;
+		}
+		else if(name == "FELICA_212") {
+			modulation.nmt = NMT_FELICA;
+			modulation.nbr = NBR_212;
+		}
+		else if(name == "FELICA_424") {
+			modulation.nmt = NMT_FELICA;
+			modulation.nbr = NBR_424;
+		}
+		else {
+			continue;
+		}
+		modulations.push_back(modulation);
+	}
+
+	std::vector<mifare_tag_type> types;
+	list = info[1].As<v8::Array>();
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		mifare_tag_type type;
+		if(tagType(std::string(*v8::String::Utf8Value(Nan::Get(list, i).ToLocalChecked()->ToString())), &type)) {
+			types.push_back(type);
+		}
+	}
+
+	obj->discovery.SetModulations(modulations);
+	obj->discovery.SetTypes(types);
+}
+
+/**
+* Set the CPU set and scheduling class of the threads running the device operations
+*/
+class SetThreadPolicyWorker : public DeviceWorker {
+public:
+	SetThreadPolicyWorker(Callback *callback, ThreadPolicy *target, ThreadPolicy policy)
+	: DeviceWorker(callback), target(target), policy(policy), error(0) {}
+	~SetThreadPolicyWorker() {}
+
+	// Applied to the pool threads, the device may be opened later
+	bool NeedsDevice() const {
+		return false;
+	}
+
+	bool SelectsTarget() const {
+		return false;
+	}
+
+	void Execute () {
+		// Only kept if this thread can take it
+		if(policy.enabled) {
+			error = policy.Apply();
+			policy.Restore();
+		}
+		if(!error) {
+			*target = policy;
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error ? NFF_ERROR_THREAD_POLICY : 0),
+			New<v8::Number>(error)
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+
+	// Policy of the device scheduler
+	ThreadPolicy *target;
+	ThreadPolicy policy;
+
+	// errno or 0
+	int error;
+};
+NAN_METHOD(Device::SetIoThread) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	ThreadPolicy policy;
+	policy.enabled = info[0]->BooleanValue();
+	v8::Local<v8::Array> cpus = info[1].As<v8::Array>();
+	for (uint32_t i = 0; i < cpus->Length(); i++) {
+		policy.cpus.push_back(Nan::Get(cpus, i).ToLocalChecked()->Int32Value());
+	}
+	policy.policy = info[2]->Int32Value();
+	policy.priority = info[3]->Int32Value();
+	policy.nice = info[4]->Int32Value();
+
+	Callback *callback = new Callback(info[5].As<v8::Function>());
+	obj->Queue(new SetThreadPolicyWorker(callback, obj->scheduler.GetThreadPolicy(), policy));
+}
+
+/**
+* Turn a personalization job into its writes, on a pool thread: it runs while
+* the device writes the previous card
+*/
+class PreparePersonalizationWorker : public AsyncWorker {
+public:
+	PreparePersonalizationWorker(Callback *callback, std::deque<PersonalizationPlan*> *plans, PersonalizationPlan *plan)
+	: AsyncWorker(callback), plans(plans), plan(plan), error(0) {}
+	~PreparePersonalizationWorker() {
+		delete plan;
+	}
+
+	void Execute () {
+		if(!plan->Prepare()) {
+			error = NFF_ERROR_PERSONALIZATION_JOB;
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		size_t steps = plan->Steps();
+		if(!error) {
+			plans->push_back(plan);
+			plan = NULL;
+		}
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::Number>(steps)
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+
+	// Prepared plans of the device
+	std::deque<PersonalizationPlan*> *plans;
+
+	// Plan being prepared, owned until it is queued
+	PersonalizationPlan *plan;
+
+	// Error ID or 0
+	int error;
+};
+
+static std::string bufferField(v8::Local<v8::Object> object, const char *name) {
+	v8::Local<v8::Value> value = Nan::Get(object, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+	if(!node::Buffer::HasInstance(value)) {
+		return std::string();
+	}
+	return std::string(node::Buffer::Data(value), node::Buffer::Length(value));
+}
+
+static uint32_t numberField(v8::Local<v8::Object> object, const char *name, uint32_t fallback) {
+	v8::Local<v8::Value> value = Nan::Get(object, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+	return value->IsNumber() ? value->Uint32Value() : fallback;
+}
+
+// Sector trailer of a personalization job or a key rotation
+static PersonalizationTrailer trailerField(v8::Local<v8::Object> entry) {
+	PersonalizationTrailer trailer;
+	trailer.sector = numberField(entry, "sector", 0);
+	std::string keyA = bufferField(entry, "keyA");
+	std::string keyB = bufferField(entry, "keyB");
+	memset(trailer.keyA, 0xff, sizeof(trailer.keyA));
+	memcpy(trailer.keyA, keyA.data(), std::min(keyA.size(), sizeof(trailer.keyA)));
+	memset(trailer.keyB, 0xff, sizeof(trailer.keyB));
+	memcpy(trailer.keyB, keyB.data(), std::min(keyB.size(), sizeof(trailer.keyB)));
+
+	// Transport configuration by default
+	static const uint8_t transport[4] = {0, 0, 0, 1};
+	v8::Local<v8::Value> access = Nan::Get(entry, Nan::New("access").ToLocalChecked()).ToLocalChecked();
+	for (uint32_t j = 0; j < 4; j++) {
+		trailer.access[j] = access->IsArray() ? Nan::Get(access.As<v8::Array>(), j).ToLocalChecked()->Uint32Value() & 0x07 : transport[j];
+	}
+	trailer.gpb = numberField(entry, "gpb", 0x69);
+	return trailer;
+}
+NAN_METHOD(Device::PreparePersonalization) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	v8::Local<v8::Object> item = info[0]->ToObject();
+	PersonalizationJob job;
+	job.type = info[1]->Int32Value();
+	job.start = numberField(item, "start", 0);
+	job.image = bufferField(item, "image");
+
+	std::string key = bufferField(item, "key");
+	memset(job.key, 0, sizeof(job.key));
+	memcpy(job.key, key.data(), std::min(key.size(), sizeof(job.key)));
+	v8::Local<v8::Value> keyType = Nan::Get(item, Nan::New("keyType").ToLocalChecked()).ToLocalChecked();
+	job.keyType = (keyType->IsString() && std::string(*v8::String::Utf8Value(keyType->ToString())) == "B") ? MFC_KEY_B : MFC_KEY_A;
+
+	v8::Local<v8::Value> trailers = Nan::Get(item, Nan::New("trailers").ToLocalChecked()).ToLocalChecked();
+	if(trailers->IsArray()) {
+		v8::Local<v8::Array> list = trailers.As<v8::Array>();
+		for (uint32_t i = 0; i < list->Length(); i++) {
+			job.trailers.push_back(trailerField(Nan::Get(list, i).ToLocalChecked()->ToObject()));
+		}
+	}
+
+	v8::Local<v8::Value> files = Nan::Get(item, Nan::New("files").ToLocalChecked()).ToLocalChecked();
+	if(files->IsArray()) {
+		v8::Local<v8::Array> list = files.As<v8::Array>();
+		for (uint32_t i = 0; i < list->Length(); i++) {
+			v8::Local<v8::Object> entry = Nan::Get(list, i).ToLocalChecked()->ToObject();
+			PersonalizationFile file;
+			std::string aid = bufferField(entry, "aid");
+			file.aid = (aid.size() >= 3) ? (uint8_t) aid[2] | ((uint8_t) aid[1]<<8) | ((uint8_t) aid[0]<<16) : 0;
+			file.file = numberField(entry, "file", 0);
+			file.keyNo = numberField(entry, "keyNo", 0);
+			file.key = bufferField(entry, "key");
+			file.offset = numberField(entry, "offset", 0);
+			file.data = bufferField(entry, "data");
+			job.files.push_back(file);
+		}
+	}
+
+	Callback *callback = new Callback(info[2].As<v8::Function>());
+	PreparePersonalizationWorker *worker = new PreparePersonalizationWorker(callback, &obj->plans, new PersonalizationPlan(job));
+	worker->SaveToPersistent("device", obj->handle());
+	AsyncQueueWorker(worker);
+}
+
+/**
+* Wait for a new card and write the next prepared job on it
+*/
+class PersonalizeWorker : public DeviceWorker {
+public:
+	PersonalizeWorker(Callback *callback, nfc_device **device, Scheduler *scheduler, TagFilter filter, Discovery discovery, std::deque<PersonalizationPlan*> *plans,
+	  PersonalizationPlan *plan, std::string *personalized, std::shared_ptr<std::atomic<bool>> aborted, uint32_t timeout, uint32_t interval)
+	: DeviceWorker(callback), device(device), scheduler(scheduler), filter(filter), discovery(discovery), plans(plans), plan(plan), personalized(personalized),
+	  aborted(aborted), timeout(timeout), interval(interval), started(0), detected(0), written(0), step(0), error(0) {}
+	~PersonalizeWorker() {
+		// Rejected without running (queue full, device reset), the job is written on the next card
+		if(plan) {
+			plans->push_front(plan);
+		}
+	}
+
+	void Execute () {
+		if(!started) {
+			started = Scheduler::Now();
+		}
+
+		while(true) {
+			MifareTag *tags = listTags(*device, filter, discovery);
+			if(!tags) {
+				error = LIBNFC_ERROR_TO_NFF(nfc_device_get_last_error(*device));
+				return;
+			}
+
+			// The card written last may still be in the field
+			for(size_t i = 0; tags[i] && uid.empty(); i++) {
+				char *tagUid = freefare_get_tag_uid(tags[i]);
+				if(tagUid && *personalized != tagUid && plan->Matches(tags[i]) && TagClaims::Claim(tagUid, scheduler)) {
+					uid = tagUid;
+					detected = Scheduler::Now();
+					error = plan->Write(tags[i], &step);
+					written = Scheduler::Now();
+				}
+				free(tagUid);
+			}
+			freefare_free_tags(tags);
+
+			if(!uid.empty()) {
+				if(!error) {
+					*personalized = uid;
+				}
+				return;
+			}
+			if(timeout && Scheduler::Now() - started >= timeout) {
+				error = NFF_ERROR_PERSONALIZATION_TIMEOUT;
+				return;
+			}
+			if(*aborted) {
+				error = NFF_ERROR_LIBNFC_EOPABORTED;
+				return;
+			}
+
+			// Let more urgent operations of the device run while waiting
+			if(ShouldYield()) {
+				Yield();
+				return;
+			}
+			usleep(interval * 1000);
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		// A failed job is written on the next card
+		if(error) {
+			plans->push_front(plan);
+		}
+		else {
+			delete plan;
+		}
+		plan = NULL;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::String>(uid).ToLocalChecked(),
+			New<v8::Number>(step),
+			New<v8::Number>(detected ? detected - started : 0),
+			New<v8::Number>(written - detected)
+		};
+
+		callback->Call(5, argv);
+	}
+
+private:
+
+	// LibNFC device
+	nfc_device** device;
+
+	// Claim owner of the device
+	Scheduler *scheduler;
+
+	// Tags to consider
+	TagFilter filter;
+	Discovery discovery;
+
+	// Prepared plans of the device, and the one written
+	std::deque<PersonalizationPlan*> *plans;
+	PersonalizationPlan *plan;
+
+	// UID of the last personalized card of the device
+	std::string *personalized;
+
+	// Set by abort()
+	std::shared_ptr<std::atomic<bool>> aborted;
+
+	// Longest wait for a card (ms, 0 for none) and polling interval (ms)
+	uint32_t timeout;
+	uint32_t interval;
+
+	// Start of the wait, card detection and end of the write (ms)
+	uint64_t started;
+	uint64_t detected;
+	uint64_t written;
+
+	// Written card
+	std::string uid;
+
+	// Failed write
+	size_t step;
+
+	// Error ID or 0
+	int error;
+};
+NAN_METHOD(Device::PersonalizeNext) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	Callback *callback = new Callback(info[2].As<v8::Function>());
+	if(obj->plans.empty()) {
+		v8::Local<v8::Value> argv[] = {
+			Nan::New<v8::Number>(NFF_ERROR_PERSONALIZATION_EMPTY)
+		};
+		callback->Call(1, argv);
+		delete callback;
+		return;
+	}
+
+	PersonalizationPlan *plan = obj->plans.front();
+	obj->plans.pop_front();
+	obj->Queue(new PersonalizeWorker(callback, &(obj->device), &(obj->scheduler), obj->filter, obj->discovery, &obj->plans, plan, &obj->personalized,
+		obj->AbortToken(), info[0]->Uint32Value(), std::max<uint32_t>(info[1]->Uint32Value(), 1)));
+}
+
+/**
+* Drop the prepared personalization jobs
+*/
+NAN_METHOD(Device::ClearPersonalization) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	for(size_t i = 0; i < obj->plans.size(); i++) {
+		delete obj->plans[i];
+	}
+	obj->plans.clear();
+}
+
+
+/**
+* Open the progress table of a key rotation campaign and build its keys, on a pool thread
+*/
+class SetKeyRotationWorker : public AsyncWorker {
+public:
+	SetKeyRotationWorker(Callback *callback, std::shared_ptr<KeyRotation> *current, std::shared_ptr<RotationTable> *currentTable,
+	  KeyRotation *rotation, std::string path, uint32_t capacity)
+	: AsyncWorker(callback), current(current), currentTable(currentTable), rotation(rotation), path(path), capacity(capacity), error(0), errorNo(0) {}
+	~SetKeyRotationWorker() {
+		delete rotation;
+	}
+
+	void Execute () {
+		if(!rotation->Prepare()) {
+			error = NFF_ERROR_ROTATION;
+			return;
+		}
+		table = RotationTable::Open(path, capacity, &errorNo);
+		if(!table) {
+			error = NFF_ERROR_ROTATION;
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		if(!error) {
+			current->reset(rotation);
+			rotation = NULL;
+			*currentTable = table;
+		}
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::Number>(errorNo)
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+
+	// Campaign of the device, replaced on success
+	std::shared_ptr<KeyRotation> *current;
+
+	// Progress table of the device, replaced on success by the one opened
+	std::shared_ptr<RotationTable> *currentTable;
+	std::shared_ptr<RotationTable> table;
+
+	// Campaign being prepared, owned until it is set
+	KeyRotation *rotation;
+
+	std::string path;
+	uint32_t capacity;
+
+	// Error ID or 0, and errno of the table
+	int error;
+	int errorNo;
+};
+NAN_METHOD(Device::SetKeyRotation) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	v8::Local<v8::Object> options = info[0]->ToObject();
+	RotationSpec spec;
+
+	v8::Local<v8::Value> classic = Nan::Get(options, Nan::New("classic").ToLocalChecked()).ToLocalChecked();
+	memset(spec.key, 0, sizeof(spec.key));
+	spec.keyType = MFC_KEY_A;
+	if(classic->IsObject()) {
+		v8::Local<v8::Object> item = classic->ToObject();
+		std::string key = bufferField(item, "key");
+		memcpy(spec.key, key.data(), std::min(key.size(), sizeof(spec.key)));
+		v8::Local<v8::Value> keyType = Nan::Get(item, Nan::New("keyType").ToLocalChecked()).ToLocalChecked();
+		spec.keyType = (keyType->IsString() && std::string(*v8::String::Utf8Value(keyType->ToString())) == "B") ? MFC_KEY_B : MFC_KEY_A;
+
+		v8::Local<v8::Value> trailers = Nan::Get(item, Nan::New("trailers").ToLocalChecked()).ToLocalChecked();
+		if(trailers->IsArray()) {
+			v8::Local<v8::Array> list = trailers.As<v8::Array>();
+			for (uint32_t i = 0; i < list->Length(); i++) {
+				spec.trailers.push_back(trailerField(Nan::Get(list, i).ToLocalChecked()->ToObject()));
+			}
+		}
+	}
+
+	v8::Local<v8::Value> desfire = Nan::Get(options, Nan::New("desfire").ToLocalChecked()).ToLocalChecked();
+	if(desfire->IsArray()) {
+		v8::Local<v8::Array> list = desfire.As<v8::Array>();
+		for (uint32_t i = 0; i < list->Length(); i++) {
+			v8::Local<v8::Object> entry = Nan::Get(list, i).ToLocalChecked()->ToObject();
+			RotationKey key;
+			std::string aid = bufferField(entry, "aid");
+			key.aid = (aid.size() >= 3) ? (uint8_t) aid[2] | ((uint8_t) aid[1]<<8) | ((uint8_t) aid[0]<<16) : 0;
+			key.keyNo = numberField(entry, "keyNo", 0);
+			key.oldKey = bufferField(entry, "oldKey");
+			key.newKey = bufferField(entry, "newKey");
+			spec.keys.push_back(key);
+		}
+	}
+
+	Callback *callback = new Callback(info[3].As<v8::Function>());
+	SetKeyRotationWorker *worker = new SetKeyRotationWorker(callback, &obj->rotation, &obj->rotationTable, new KeyRotation(spec),
+		std::string(*v8::String::Utf8Value(info[1]->ToString())), info[2]->Uint32Value());
+	worker->SaveToPersistent("device", obj->handle());
+	AsyncQueueWorker(worker);
+}
+
+
+/**
+* Wait for a card of the campaign and rotate its keys unless the progress table
+* already has it, in the session of its detection
+*/
+class RotateWorker : public DeviceWorker {
+public:
+	RotateWorker(Callback *callback, nfc_device **device, Scheduler *scheduler, TagFilter filter, Discovery discovery,
+	  std::shared_ptr<KeyRotation> rotation, std::shared_ptr<RotationTable> table, std::string *rotated, std::shared_ptr<std::atomic<bool>> aborted,
+	  uint32_t timeout, uint32_t interval)
+	: DeviceWorker(callback), device(device), scheduler(scheduler), filter(filter), discovery(discovery), rotation(rotation), table(table),
+	  rotated(rotated), aborted(aborted), timeout(timeout), interval(interval), started(0), outcome(NFF_ROTATION_ROTATED), step(0), error(0) {}
+	~RotateWorker() {}
+
+	void Execute () {
+		if(!started) {
+			started = Scheduler::Now();
+		}
+
+		while(true) {
+			MifareTag *tags = listTags(*device, filter, discovery);
+			if(!tags) {
+				error = LIBNFC_ERROR_TO_NFF(nfc_device_get_last_error(*device));
+				return;
+			}
+
+			// The card handled last counts as a new tap once it left the field
+			bool present = false;
+			for(size_t i = 0; tags[i] && uid.empty(); i++) {
+				char *tagUid = freefare_get_tag_uid(tags[i]);
+				if(tagUid && *rotated == tagUid) {
+					present = true;
+				}
+				else if(tagUid && rotation->Matches(tags[i]) && TagClaims::Claim(tagUid, scheduler)) {
+					uid = tagUid;
+					Handle(tags[i]);
+				}
+				free(tagUid);
+			}
+			freefare_free_tags(tags);
+
+			if(!uid.empty()) {
+				*rotated = uid;
+				return;
+			}
+			if(!present) {
+				rotated->clear();
+			}
+			if(timeout && Scheduler::Now() - started >= timeout) {
+				error = NFF_ERROR_ROTATION_TIMEOUT;
+				return;
+			}
+			if(*aborted) {
+				error = NFF_ERROR_LIBNFC_EOPABORTED;
+				return;
+			}
+
+			// Let more urgent operations of the device run while waiting
+			if(ShouldYield()) {
+				Yield();
+				return;
+			}
+			usleep(interval * 1000);
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::String>(uid).ToLocalChecked(),
+			New<v8::Number>(outcome),
+			New<v8::Number>(step)
+		};
+
+		callback->Call(4, argv);
+	}
+
+private:
+	// Rotate the keys of a detected card and record it
+	void Handle(MifareTag tag) {
+		if(table->State(uid) == NFF_ROTATION_DONE) {
+			outcome = NFF_ROTATION_SKIPPED;
+			return;
+		}
+		error = rotation->Rotate(tag, &step);
+		outcome = error ? NFF_ROTATION_ERROR : NFF_ROTATION_ROTATED;
+		if(!table->Record(uid, error ? NFF_ROTATION_FAILED : NFF_ROTATION_DONE) && !error) {
+			error = NFF_ERROR_ROTATION_FULL;
+		}
+	}
+
+	// LibNFC device
+	nfc_device** device;
+
+	// Claim owner of the device
+	Scheduler *scheduler;
+
+	// Tags to consider
+	TagFilter filter;
+	Discovery discovery;
+
+	// Campaign and its progress, kept alive if they are replaced meanwhile
+	std::shared_ptr<KeyRotation> rotation;
+	std::shared_ptr<RotationTable> table;
+
+	// UID of the card handled last by the device
+	std::string *rotated;
+
+	// Set by abort()
+	std::shared_ptr<std::atomic<bool>> aborted;
+
+	// Longest wait for a card (ms, 0 for none) and polling interval (ms)
+	uint32_t timeout;
+	uint32_t interval;
+
+	// Start of the wait (ms)
+	uint64_t started;
+
+	// Handled card, NFF_ROTATION_* outcome and failed sector or key
+	std::string uid;
+	int outcome;
+	size_t step;
+
+	// Error ID or 0
+	int error;
+};
+NAN_METHOD(Device::RotateNext) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	Callback *callback = new Callback(info[2].As<v8::Function>());
+	if(!obj->rotation || !obj->rotationTable) {
+		v8::Local<v8::Value> argv[] = {
+			Nan::New<v8::Number>(NFF_ERROR_ROTATION)
+		};
+		callback->Call(1, argv);
+		delete callback;
+		return;
+	}
+
+	obj->Queue(new RotateWorker(callback, &(obj->device), &(obj->scheduler), obj->filter, obj->discovery, obj->rotation, obj->rotationTable,
+		&obj->rotated, obj->AbortToken(), info[0]->Uint32Value(), std::max<uint32_t>(info[1]->Uint32Value(), 1)));
+}
+
+NAN_METHOD(Device::GetKeyRotationStats) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	uint32_t capacity = 0, entries = 0, rotated = 0;
+	if(obj->rotationTable) {
+		obj->rotationTable->Stats(&capacity, &entries, &rotated);
+	}
+	v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+	Nan::Set(stats, Nan::New("capacity").ToLocalChecked(), Nan::New<v8::Number>(capacity));
+	Nan::Set(stats, Nan::New("cards").ToLocalChecked(), Nan::New<v8::Number>(entries));
+	Nan::Set(stats, Nan::New("rotated").ToLocalChecked(), Nan::New<v8::Number>(rotated));
+	info.GetReturnValue().Set(stats);
+}
+
+/**
+* Drop the campaign, its progress table is flushed and closed with its last device
+*/
+NAN_METHOD(Device::ClearKeyRotation) {
+	Device* obj = ObjectWrap::Unwrap<Device>(info.This());
+
+	obj->rotation.reset();
+	obj->rotationTable.reset();
+	obj->rotated.clear();
+}
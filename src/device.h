@@ -3,6 +3,10 @@
 
 #include <nan.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
 
 extern "C" {
 	#include <nfc/nfc.h>
@@ -10,9 +14,22 @@ extern "C" {
 }
 
 #include "common.h"
+#include "scheduler.h"
+#include "device_profile.h"
 #include "tag.h"
+#include "tag_prefetch.h"
+#include "tag_filter.h"
+#include "discovery.h"
+#include "personalize.h"
+#include "key_rotation.h"
 
 
+// Device property set by the user, replayed when the device is reopened
+struct DeviceProperty {
+	nfc_property property;
+	bool isInt;
+	int value;
+};
 
 
 class Device: public Nan::ObjectWrap {
@@ -21,6 +38,15 @@ public:
 	static NAN_MODULE_INIT(Init);
 	static v8::Handle<v8::Value> Instantiate(std::string connstring);
 
+	// Queue shared by the device and its tags
+	Scheduler* GetScheduler();
+
+	// Timings used by batch reads of its tags
+	DeviceProfile* GetProfile();
+
+	// Outcome of an attempt to reopen the lost device, retried later or reported
+	void Reconnected(bool opened);
+
 private:
 	explicit Device(std::string connstring);
 	~Device();
@@ -33,11 +59,87 @@ private:
 	static NAN_METHOD(GetConnstring);
 	static NAN_METHOD(ListTags);
 	static NAN_METHOD(Abort);
+	static NAN_METHOD(SetPriority);
+	static NAN_METHOD(SetQueueLimit);
+	static NAN_METHOD(GetQueueDepth);
+	static NAN_METHOD(SetProperty);
+	static NAN_METHOD(SetHealthMonitor);
+	static NAN_METHOD(SetPrefetch);
+	static NAN_METHOD(GetProfile);
+	static NAN_METHOD(SetProfile);
+	static NAN_METHOD(SetTagFilter);
+	static NAN_METHOD(SetDiscovery);
+	static NAN_METHOD(SetIoThread);
+	static NAN_METHOD(PreparePersonalization);
+	static NAN_METHOD(PersonalizeNext);
+	static NAN_METHOD(ClearPersonalization);
+	static NAN_METHOD(SetKeyRotation);
+	static NAN_METHOD(RotateNext);
+	static NAN_METHOD(GetKeyRotationStats);
+	static NAN_METHOD(ClearKeyRotation);
+
+	// Queue a worker on the device scheduler
+	void Queue(DeviceWorker *worker);
 
+	// Abort flag of a new worker waiting for a card, set by the next abort()
+	std::shared_ptr<std::atomic<bool>> AbortToken();
+
+	// Called on the main thread when a worker left the device in error
+	void DeviceError(int error);
+
+	// Queue an attempt to reopen the lost device
+	void Reconnect();
+	static void OnReconnectTimer(uv_timer_t *timer);
 
 private:
 	nfc_device* device;
 	std::string connstring;
+
+	// Workers of the device and its tags
+	Scheduler scheduler;
+
+	// Priority class and relative deadline (ms, 0 for none) of device operations
+	int priority;
+	uint32_t deadline;
+
+	// Properties to replay on reconnection
+	std::vector<DeviceProperty> properties;
+
+	// Regions read from each listed tag before handing it to JS
+	std::vector<PrefetchEntry> prefetch;
+
+	// Tags kept by listTags()
+	TagFilter filter;
+
+	// Modulations polled and expected tag types
+	Discovery discovery;
+
+	// Reader timings, measured by calibration
+	DeviceProfile profile;
+
+	// Abort flags of the workers waiting for a card, all set by abort()
+	std::vector<std::weak_ptr<std::atomic<bool>>> abortTokens;
+
+	// Prepared personalization jobs, in order, and UID of the last personalized card
+	std::deque<PersonalizationPlan*> plans;
+	std::string personalized;
+
+	// Key rotation campaign, its progress table and UID of the card handled last while it stays in the field
+	std::shared_ptr<KeyRotation> rotation;
+	std::shared_ptr<RotationTable> rotationTable;
+	std::string rotated;
+
+	// Health monitor: reconnection attempts, first retry interval (ms) and state callback
+	bool monitor;
+	uint32_t attempts;
+	uint32_t interval;
+	Nan::Callback *healthCallback;
+	bool reconnecting;
+
+	// Attempts made to reopen the lost device, wait before the next one (ms) and its timer
+	uint32_t reconnectAttempt;
+	uint32_t reconnectWait;
+	uv_timer_t *reconnectTimer;
 };
 
 
@@ -0,0 +1,40 @@
+#include "device_profile.h"
+
+#include <algorithm>
+
+DeviceProfile::DeviceProfile() : maxPages(0), chunkSize(0), commandLatency(0), byteLatency(0), timeout(0) {}
+
+void DeviceProfile::Derive() {
+	if(!commandLatency) {
+		return;
+	}
+	uint64_t perByte = byteLatency ? byteLatency : NFF_PROFILE_BYTE_LATENCY;
+
+	// As much data as the reader transfers in the chunk time, in whole frames
+	uint64_t available = (commandLatency < NFF_PROFILE_CHUNK_TIME) ? NFF_PROFILE_CHUNK_TIME - commandLatency : 0;
+	uint64_t frames = available * 1000 / perByte / NFF_PROFILE_DESFIRE_FRAME;
+	chunkSize = std::max<uint64_t>(frames, 1) * NFF_PROFILE_DESFIRE_FRAME;
+
+	// Longest single frame command
+	uint64_t frameBytes = maxPages ? maxPages * 4 : NFF_PROFILE_DESFIRE_FRAME;
+	uint64_t longest = commandLatency + frameBytes * perByte / 1000;
+	timeout = std::min<uint64_t>(std::max<uint64_t>(NFF_PROFILE_TIMEOUT_FACTOR * longest / 1000, NFF_PROFILE_MIN_TIMEOUT), NFF_PROFILE_MAX_TIMEOUT);
+}
+
+v8::Local<v8::Object> DeviceProfile::ToObject() const {
+	v8::Local<v8::Object> object = Nan::New<v8::Object>();
+	Nan::Set(object, Nan::New("maxPages").ToLocalChecked(), Nan::New<v8::Number>(maxPages));
+	Nan::Set(object, Nan::New("chunkSize").ToLocalChecked(), Nan::New<v8::Number>(chunkSize));
+	Nan::Set(object, Nan::New("commandLatency").ToLocalChecked(), Nan::New<v8::Number>(commandLatency));
+	Nan::Set(object, Nan::New("byteLatency").ToLocalChecked(), Nan::New<v8::Number>(byteLatency));
+	Nan::Set(object, Nan::New("timeout").ToLocalChecked(), Nan::New<v8::Number>(timeout));
+	return object;
+}
+
+void DeviceProfile::FromObject(v8::Local<v8::Object> object) {
+	maxPages = Nan::Get(object, Nan::New("maxPages").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+	chunkSize = Nan::Get(object, Nan::New("chunkSize").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+	commandLatency = Nan::Get(object, Nan::New("commandLatency").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+	byteLatency = Nan::Get(object, Nan::New("byteLatency").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+	timeout = Nan::Get(object, Nan::New("timeout").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+}
@@ -0,0 +1,55 @@
+#ifndef NFF_DEVICE_PROFILE_H
+#define NFF_DEVICE_PROFILE_H
+
+#include <nan.h>
+
+// Pages tried at most when measuring the FAST_READ frame limit
+#define NFF_PROFILE_MAX_PAGES 64
+
+// Short commands timed to measure the latency, the fastest one is kept
+#define NFF_PROFILE_SAMPLES 5
+
+// Transfer time of a byte at 106 kbit/s (ns), when it can not be measured
+#define NFF_PROFILE_BYTE_LATENCY 85000
+
+// Time a DESFire read command should take (us), and size of a DESFire frame
+#define NFF_PROFILE_CHUNK_TIME 50000
+#define NFF_PROFILE_DESFIRE_FRAME 59
+
+// Card answer timeout: a multiple of the longest expected command, bounded (ms)
+#define NFF_PROFILE_TIMEOUT_FACTOR 4
+#define NFF_PROFILE_MIN_TIMEOUT 20
+#define NFF_PROFILE_MAX_TIMEOUT 1000
+
+
+
+/**
+* Timings of a reader, measured by calibrating it with a tag. Batch reads
+* split their transfers in chunks the reader handles in one frame, or in a
+* bounded time, 0 meaning no limit (the device was not calibrated).
+*/
+struct DeviceProfile {
+	DeviceProfile();
+
+	// Compute the chunk size and timeout from the measures
+	void Derive();
+
+	v8::Local<v8::Object> ToObject() const;
+	void FromObject(v8::Local<v8::Object> object);
+
+	// Largest FAST_READ answered in one frame (pages)
+	uint32_t maxPages;
+
+	// DESFire bytes read per command
+	uint32_t chunkSize;
+
+	// Round trip of a short command (us) and transfer time of a byte (ns)
+	uint32_t commandLatency;
+	uint32_t byteLatency;
+
+	// Card answer timeout (ms)
+	uint32_t timeout;
+};
+
+
+#endif /* NFF_DEVICE_PROFILE_H */
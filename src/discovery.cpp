@@ -0,0 +1,128 @@
+#include "discovery.h"
+
+static std::vector<nfc_modulation> defaultModulations() {
+	std::vector<nfc_modulation> modulations;
+	nfc_modulation modulation;
+	modulation.nmt = NMT_ISO14443A;
+	modulation.nbr = NBR_106;
+	modulations.push_back(modulation);
+#ifdef FELICA_SC_RW
+	modulation.nmt = NMT_FELICA;
+	modulation.nbr = NBR_212;
+	modulations.push_back(modulation);
+#endif
+	return modulations;
+}
+
+Discovery::Discovery() : modulations(defaultModulations()), custom(false) {}
+
+void Discovery::SetModulations(const std::vector<nfc_modulation> &modulations) {
+	custom = !modulations.empty();
+	this->modulations = custom ? modulations : defaultModulations();
+}
+
+void Discovery::SetTypes(const std::vector<mifare_tag_type> &types) {
+	this->types = types;
+}
+
+bool Discovery::Empty() const {
+	return !custom && types.empty();
+}
+
+int Discovery::ListTargets(nfc_device *device, nfc_target *targets, size_t count) const {
+	int error = nfc_initiator_init(device);
+	if(error < 0) {
+		return error;
+	}
+	nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false);
+
+	size_t found = 0;
+	for(size_t i = 0; i < modulations.size() && found < count; i++) {
+		int listed = nfc_initiator_list_passive_targets(device, modulations[i], targets + found, count - found);
+		if(listed < 0) {
+			return listed;
+		}
+		found += listed;
+	}
+	return found;
+}
+
+bool Discovery::MayBe(mifare_tag_type type, const nfc_target &target) {
+#ifdef FELICA_SC_RW
+	if(type == FELICA) {
+		return target.nm.nmt == NMT_FELICA;
+	}
+#endif
+	if(target.nm.nmt != NMT_ISO14443A) {
+		return false;
+	}
+	const nfc_iso14443a_info &info = target.nti.nai;
+	uint16_t atqa = (info.abtAtqa[0] << 8) | info.abtAtqa[1];
+	switch(type) {
+		case CLASSIC_1K:
+			return (info.btSak & 0x18) == 0x08;
+		case CLASSIC_4K:
+			return (info.btSak & 0x18) == 0x18;
+		case DESFIRE:
+			return info.btSak == 0x20;
+		case ULTRALIGHT:
+		case ULTRALIGHT_C:
+		case NTAG_21x:
+			return info.btSak == 0x00 && atqa == 0x0044;
+		default:
+			return true;
+	}
+}
+
+MifareTag Discovery::NewTag(nfc_device *device, const nfc_target &target) const {
+	if(types.empty()) {
+		return freefare_tag_new(device, target);
+	}
+
+	// Expected types the target can be
+	std::vector<mifare_tag_type> candidates;
+	for(size_t i = 0; i < types.size(); i++) {
+		if(MayBe(types[i], target)) {
+			candidates.push_back(types[i]);
+		}
+	}
+	if(candidates.empty()) {
+		return NULL;
+	}
+
+#ifdef FELICA_SC_RW
+	// A single candidate is created without detection probes
+	if(candidates.size() == 1) {
+		switch(candidates[0]) {
+			case FELICA: return felica_tag_new(device, target);
+			case CLASSIC_1K: return mifare_classic_1k_tag_new(device, target);
+			case CLASSIC_4K: return mifare_classic_4k_tag_new(device, target);
+			case DESFIRE: return mifare_desfire_tag_new(device, target);
+			case ULTRALIGHT: return mifare_ultralight_tag_new(device, target);
+			case ULTRALIGHT_C: return mifare_ultralightc_tag_new(device, target);
+			case NTAG_21x: return ntag21x_tag_new(device, target);
+			default: break;
+		}
+	}
+#endif
+
+	// Older libfreefare versions only have the detecting constructor
+	MifareTag tag = freefare_tag_new(device, target);
+	if(tag && !Expects(tag)) {
+		freefare_free_tag(tag);
+		return NULL;
+	}
+	return tag;
+}
+
+bool Discovery::Expects(MifareTag tag) const {
+	if(types.empty()) {
+		return true;
+	}
+	for(size_t i = 0; i < types.size(); i++) {
+		if(types[i] == freefare_get_tag_type(tag)) {
+			return true;
+		}
+	}
+	return false;
+}
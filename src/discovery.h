@@ -0,0 +1,54 @@
+#ifndef NFF_DISCOVERY_H
+#define NFF_DISCOVERY_H
+
+#include <vector>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+
+
+
+/**
+* How a device looks for tags. By default, as freefare_get_tags(), ISO14443A
+* targets are listed (then FeliCa ones when libfreefare supports them) and
+* the type of each one is detected by libfreefare, which sends probe commands
+* to tell Ultralight, Ultralight C and NTAG apart. Restricting the modulations
+* skips the polls of the others, and declaring the expected tag types skips
+* the targets whose anticollision data does not match them. When a single
+* type matches a target, its tag is created without any probe.
+*/
+class Discovery {
+
+public:
+	Discovery();
+
+	void SetModulations(const std::vector<nfc_modulation> &modulations);
+	void SetTypes(const std::vector<mifare_tag_type> &types);
+
+	// True if it lists tags as freefare_get_tags()
+	bool Empty() const;
+
+	// Poll the targets of all modulations, number of targets or libnfc error
+	int ListTargets(nfc_device *device, nfc_target *targets, size_t count) const;
+
+	// Tag of a target, NULL if it is not of an expected type
+	MifareTag NewTag(nfc_device *device, const nfc_target &target) const;
+
+	// True if the tag is of an expected type
+	bool Expects(MifareTag tag) const;
+
+private:
+	// Anticollision data can be the one of a tag of this type
+	static bool MayBe(mifare_tag_type type, const nfc_target &target);
+
+	std::vector<nfc_modulation> modulations;
+	std::vector<mifare_tag_type> types;
+	bool custom;
+};
+
+
+#endif /* NFF_DISCOVERY_H */
@@ -14,6 +14,9 @@ NAN_MODULE_INIT(Freefare::Init) {
 
 	Nan::SetPrototypeMethod(tpl, "init", Freefare::InitLibNFC);
 	Nan::SetPrototypeMethod(tpl, "listDevices", Freefare::ListDevices);
+	Nan::SetPrototypeMethod(tpl, "setDedupeWindow", Freefare::SetDedupeWindow);
+	Nan::SetPrototypeMethod(tpl, "getMemoryStats", Freefare::GetMemoryStats);
+	Nan::SetPrototypeMethod(tpl, "setArenaBlockSize", Freefare::SetArenaBlockSize);
 
 	constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
 	Nan::Set(target, Nan::New("Freefare").ToLocalChecked(),
@@ -51,6 +54,40 @@ NAN_METHOD(Freefare::InitLibNFC) {
 	info.GetReturnValue().Set(Null());
 }
 
+/**
+* Deduplicate tags seen by several devices within the window (ms, 0 to disable)
+*/
+NAN_METHOD(Freefare::SetDedupeWindow) {
+	TagClaims::SetWindow(info[0]->Uint32Value());
+}
+
+/**
+* Size of the first block of batch arenas, 0 for the default
+*/
+NAN_METHOD(Freefare::SetArenaBlockSize) {
+	Arena::SetBlockSize(info[0]->Uint32Value());
+}
+
+/**
+* Native memory held by the binding, in bytes
+*/
+NAN_METHOD(Freefare::GetMemoryStats) {
+	NativeMemory::Report();
+
+	v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+	Nan::Set(stats, Nan::New("tags").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Get(NFF_MEMORY_TAGS)));
+	Nan::Set(stats, Nan::New("workers").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Get(NFF_MEMORY_WORKERS)));
+	Nan::Set(stats, Nan::New("buffers").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Get(NFF_MEMORY_BUFFERS)));
+	Nan::Set(stats, Nan::New("caches").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Get(NFF_MEMORY_CACHES)));
+	Nan::Set(stats, Nan::New("shared").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Get(NFF_MEMORY_SHARED)));
+	Nan::Set(stats, Nan::New("total").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Total()));
+	Nan::Set(stats, Nan::New("reported").ToLocalChecked(), Nan::New<v8::Number>(NativeMemory::Reported()));
+	Nan::Set(stats, Nan::New("arenaBlockSize").ToLocalChecked(), Nan::New<v8::Number>(Arena::BlockSize()));
+	Nan::Set(stats, Nan::New("arenaHighWater").ToLocalChecked(), Nan::New<v8::Number>(Arena::HighWater()));
+	Nan::Set(stats, Nan::New("arenaOverflows").ToLocalChecked(), Nan::New<v8::Number>(Arena::Overflows()));
+	info.GetReturnValue().Set(stats);
+}
+
 /**
 * List devices
 */
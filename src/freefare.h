@@ -27,6 +27,9 @@ private:
 	static NAN_METHOD(New);
 	static NAN_METHOD(InitLibNFC);
 	static NAN_METHOD(ListDevices);
+	static NAN_METHOD(SetDedupeWindow);
+	static NAN_METHOD(GetMemoryStats);
+	static NAN_METHOD(SetArenaBlockSize);
 };
 
 
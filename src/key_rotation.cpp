@@ -0,0 +1,355 @@
+#include "key_rotation.h"
+#include "endian.h"
+
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/* Header fields */
+#define NFF_ROTATION_HEADER_MAGIC 0
+#define NFF_ROTATION_HEADER_VERSION 1
+#define NFF_ROTATION_HEADER_CAPACITY 2
+#define NFF_ROTATION_HEADER_ENTRIES 3
+#define NFF_ROTATION_HEADER_ROTATED 4
+
+// Highest sector of a MIFARE Classic 4K and 1K
+#define NFF_ROTATION_MAX_SECTOR 39
+#define NFF_ROTATION_1K_MAX_SECTOR 15
+
+/* Entry fields */
+#define NFF_ROTATION_ENTRY_STATE 11
+#define NFF_ROTATION_ENTRY_ATTEMPTS 12
+
+// UID bytes of the hexadecimal string of libfreefare, false if it does not fit an entry
+static bool uidBytes(const std::string &uid, uint8_t *bytes, size_t *length) {
+	if(uid.empty() || uid.size() % 2 || uid.size() / 2 > NFF_ROTATION_MAX_UID) {
+		return false;
+	}
+	*length = uid.size() / 2;
+	for(size_t i = 0; i < *length; i++) {
+		char digits[3] = { uid[i * 2], uid[i * 2 + 1], 0 };
+		bytes[i] = strtoul(digits, NULL, 16);
+	}
+	return true;
+}
+
+std::mutex RotationTable::tablesLock;
+std::vector<std::weak_ptr<RotationTable> > RotationTable::tables;
+
+RotationTable::RotationTable(int fd, uint8_t *data, size_t size, uint32_t capacity, dev_t device, ino_t inode)
+: fd(fd), data(data), size(size), capacity(capacity), device(device), inode(inode) {}
+RotationTable::~RotationTable() {
+	msync(data, size, MS_SYNC);
+	munmap(data, size);
+	close(fd);
+}
+
+std::shared_ptr<RotationTable> RotationTable::Open(const std::string &path, uint32_t capacity, int *error) {
+	std::lock_guard<std::mutex> guard(tablesLock);
+
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	struct stat info;
+	if(fd < 0 || fstat(fd, &info)) {
+		*error = errno;
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	// Already opened by another device
+	for(size_t i = 0; i < tables.size(); i++) {
+		std::shared_ptr<RotationTable> table = tables[i].lock();
+		if(table && table->device == info.st_dev && table->inode == info.st_ino) {
+			close(fd);
+			return table;
+		}
+	}
+
+	// Two processes would take the same free slots
+	if(flock(fd, LOCK_EX | LOCK_NB)) {
+		*error = errno;
+		close(fd);
+		return NULL;
+	}
+
+	// A new file is sized for the capacity, an existing one keeps its own and must be complete
+	*error = 0;
+	uint32_t header[3];
+	if(info.st_size) {
+		if(pread(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header) || le32toh(header[NFF_ROTATION_HEADER_MAGIC]) != NFF_ROTATION_MAGIC ||
+		  le32toh(header[NFF_ROTATION_HEADER_VERSION]) != NFF_ROTATION_VERSION || !le32toh(header[NFF_ROTATION_HEADER_CAPACITY])) {
+			*error = EINVAL;
+		}
+		capacity = le32toh(header[NFF_ROTATION_HEADER_CAPACITY]);
+	}
+	else if(!capacity) {
+		*error = EINVAL;
+	}
+	size_t size = NFF_ROTATION_HEADER_SIZE + (size_t) capacity * NFF_ROTATION_ENTRY_SIZE;
+	if(!*error && info.st_size && (size_t) info.st_size < size) {
+		*error = EINVAL;
+	}
+	if(!*error && !info.st_size && ftruncate(fd, size)) {
+		*error = errno;
+	}
+	void *mapped = *error ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mapped == MAP_FAILED) {
+		if(!*error) {
+			*error = errno;
+		}
+		close(fd);
+		return NULL;
+	}
+
+	std::shared_ptr<RotationTable> table(new RotationTable(fd, (uint8_t*) mapped, size, capacity, info.st_dev, info.st_ino));
+	if(!info.st_size) {
+		table->SetHeader(NFF_ROTATION_HEADER_VERSION, NFF_ROTATION_VERSION);
+		table->SetHeader(NFF_ROTATION_HEADER_CAPACITY, capacity);
+		table->SetHeader(NFF_ROTATION_HEADER_MAGIC, NFF_ROTATION_MAGIC);
+		msync(table->data, NFF_ROTATION_HEADER_SIZE, MS_ASYNC);
+	}
+
+	// Forget the closed tables
+	tables.erase(std::remove_if(tables.begin(), tables.end(), [](const std::weak_ptr<RotationTable> &entry) {
+		return entry.expired();
+	}), tables.end());
+	tables.push_back(table);
+	return table;
+}
+
+uint8_t RotationTable::State(const std::string &uid) {
+	std::lock_guard<std::mutex> guard(lock);
+	uint8_t bytes[NFF_ROTATION_MAX_UID];
+	size_t length;
+	if(!uidBytes(uid, bytes, &length)) {
+		return NFF_ROTATION_UNKNOWN;
+	}
+	uint8_t *entry = Slot(bytes, length);
+	return (entry && entry[0]) ? entry[NFF_ROTATION_ENTRY_STATE] : NFF_ROTATION_UNKNOWN;
+}
+
+bool RotationTable::Record(const std::string &uid, uint8_t state) {
+	std::lock_guard<std::mutex> guard(lock);
+	uint8_t bytes[NFF_ROTATION_MAX_UID];
+	size_t length;
+	if(!uidBytes(uid, bytes, &length)) {
+		return false;
+	}
+	uint8_t *entry = Slot(bytes, length);
+	if(!entry) {
+		return false;
+	}
+
+	// The length marks the slot used, it is written last
+	if(!entry[0]) {
+		memcpy(entry + 1, bytes, length);
+		entry[NFF_ROTATION_ENTRY_STATE] = state;
+		entry[0] = length;
+		SetHeader(NFF_ROTATION_HEADER_ENTRIES, Header(NFF_ROTATION_HEADER_ENTRIES) + 1);
+	}
+	else if(entry[NFF_ROTATION_ENTRY_STATE] != NFF_ROTATION_DONE) {
+		entry[NFF_ROTATION_ENTRY_STATE] = state;
+	}
+	else {
+		return true;
+	}
+	if(state == NFF_ROTATION_DONE) {
+		SetHeader(NFF_ROTATION_HEADER_ROTATED, Header(NFF_ROTATION_HEADER_ROTATED) + 1);
+	}
+	else if(entry[NFF_ROTATION_ENTRY_ATTEMPTS] < 0xff) {
+		entry[NFF_ROTATION_ENTRY_ATTEMPTS]++;
+	}
+
+	// Pages of the header and of the entry
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = ((entry - data) / page) * page;
+	msync(data, NFF_ROTATION_HEADER_SIZE, MS_ASYNC);
+	msync(data + start, (entry - data) - start + NFF_ROTATION_ENTRY_SIZE, MS_ASYNC);
+	return true;
+}
+
+void RotationTable::Stats(uint32_t *capacity, uint32_t *entries, uint32_t *rotated) {
+	std::lock_guard<std::mutex> guard(lock);
+	*capacity = this->capacity;
+	*entries = Header(NFF_ROTATION_HEADER_ENTRIES);
+	*rotated = Header(NFF_ROTATION_HEADER_ROTATED);
+}
+
+uint8_t *RotationTable::Slot(const uint8_t *uid, size_t length) {
+	// FNV-1a, then linear probing
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < length; i++) {
+		hash = (hash ^ uid[i]) * 16777619u;
+	}
+	for(uint32_t probe = 0; probe < capacity; probe++) {
+		uint8_t *entry = data + NFF_ROTATION_HEADER_SIZE + (size_t) ((hash + probe) % capacity) * NFF_ROTATION_ENTRY_SIZE;
+		if(!entry[0] || (entry[0] == length && !memcmp(entry + 1, uid, length))) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+uint32_t RotationTable::Header(size_t field) {
+	uint32_t value;
+	memcpy(&value, data + field * 4, 4);
+	return le32toh(value);
+}
+
+void RotationTable::SetHeader(size_t field, uint32_t value) {
+	value = htole32(value);
+	memcpy(data + field * 4, &value, 4);
+}
+
+
+KeyRotation::KeyRotation(const RotationSpec &spec) : spec(spec) {}
+KeyRotation::~KeyRotation() {
+	for(size_t i = 0; i < oldKeys.size(); i++) {
+		mifare_desfire_key_free(oldKeys[i]);
+		mifare_desfire_key_free(newKeys[i]);
+	}
+}
+
+// DES or 3DES key, NULL for another size
+static MifareDESFireKey desfireKey(const std::string &key) {
+	if(key.size() == 8) {
+		return mifare_desfire_des_key_new(reinterpret_cast<const uint8_t*>(key.data()));
+	}
+	if(key.size() == 16) {
+		return mifare_desfire_3des_key_new(reinterpret_cast<const uint8_t*>(key.data()));
+	}
+	return NULL;
+}
+
+bool KeyRotation::Prepare() {
+	for(size_t i = 0; i < spec.trailers.size(); i++) {
+		const PersonalizationTrailer &trailer = spec.trailers[i];
+		if(trailer.sector > NFF_ROTATION_MAX_SECTOR) {
+			return false;
+		}
+		MifareClassicBlock data;
+		mifare_classic_trailer_block(&data, trailer.keyA, trailer.access[0], trailer.access[1], trailer.access[2], trailer.access[3],
+			trailer.gpb, trailer.keyB);
+		std::array<uint8_t, 16> block;
+		memcpy(block.data(), data, sizeof(data));
+		trailers.push_back(block);
+	}
+
+	for(size_t i = 0; i < spec.keys.size(); i++) {
+		MifareDESFireKey oldKey = desfireKey(spec.keys[i].oldKey);
+		MifareDESFireKey newKey = desfireKey(spec.keys[i].newKey);
+		if(!oldKey || !newKey) {
+			if(oldKey) {
+				mifare_desfire_key_free(oldKey);
+			}
+			if(newKey) {
+				mifare_desfire_key_free(newKey);
+			}
+			return false;
+		}
+		oldKeys.push_back(oldKey);
+		newKeys.push_back(newKey);
+	}
+	return true;
+}
+
+bool KeyRotation::Matches(MifareTag tag) const {
+	switch(freefare_get_tag_type(tag)) {
+		case CLASSIC_1K:
+		case CLASSIC_4K:
+			return !trailers.empty();
+		case DESFIRE:
+			return !oldKeys.empty();
+		default:
+			return false;
+	}
+}
+
+int KeyRotation::Rotate(MifareTag tag, size_t *step) const {
+	*step = 0;
+	switch(freefare_get_tag_type(tag)) {
+		case CLASSIC_1K:
+		case CLASSIC_4K:
+			return RotateClassic(tag, step);
+		case DESFIRE:
+			return RotateDesfire(tag, step);
+		default:
+			return NFF_ERROR_ROTATION;
+	}
+}
+
+int KeyRotation::RotateClassic(MifareTag tag, size_t *step) const {
+	// All the sectors must exist before any trailer is written
+	MifareClassicSectorNumber last = (freefare_get_tag_type(tag) == CLASSIC_1K) ? NFF_ROTATION_1K_MAX_SECTOR : NFF_ROTATION_MAX_SECTOR;
+	for(; *step < spec.trailers.size(); (*step)++) {
+		if(spec.trailers[*step].sector > last) {
+			return NFF_ERROR_ROTATION;
+		}
+	}
+	*step = 0;
+
+	int error = mifare_classic_connect(tag);
+	if(error < 0) {
+		return error;
+	}
+
+	for(; *step < trailers.size(); (*step)++) {
+		const PersonalizationTrailer &trailer = spec.trailers[*step];
+		MifareClassicBlockNumber block = mifare_classic_sector_last_block(trailer.sector);
+		if(mifare_classic_authenticate(tag, block, spec.key, spec.keyType) < 0) {
+			// A failed authentication halts the tag, the sector may have been rotated by a torn attempt
+			mifare_classic_disconnect(tag);
+			if((error = mifare_classic_connect(tag)) < 0) {
+				return error;
+			}
+			MifareClassicKey key;
+			memcpy(key, spec.keyType == MFC_KEY_A ? trailer.keyA : trailer.keyB, sizeof(key));
+			if((error = mifare_classic_authenticate(tag, block, key, spec.keyType)) < 0) {
+				break;
+			}
+			continue;
+		}
+		MifareClassicBlock data;
+		memcpy(data, trailers[*step].data(), sizeof(data));
+		if((error = mifare_classic_write(tag, block, data)) < 0) {
+			break;
+		}
+	}
+	mifare_classic_disconnect(tag);
+	return error < 0 ? error : 0;
+}
+
+int KeyRotation::RotateDesfire(MifareTag tag, size_t *step) const {
+	int error = mifare_desfire_connect(tag);
+	if(error < 0) {
+		return error;
+	}
+
+	for(; *step < spec.keys.size(); (*step)++) {
+		const RotationKey &key = spec.keys[*step];
+		MifareDESFireAID aid = mifare_desfire_aid_new(key.aid);
+		error = mifare_desfire_select_application(tag, aid);
+		free(aid);
+		if(error < 0) {
+			break;
+		}
+		if(mifare_desfire_authenticate(tag, key.keyNo, oldKeys[*step]) < 0) {
+			// Already rotated by a torn attempt
+			if((error = mifare_desfire_authenticate(tag, key.keyNo, newKeys[*step])) < 0) {
+				break;
+			}
+			continue;
+		}
+		if((error = mifare_desfire_change_key(tag, key.keyNo, newKeys[*step], oldKeys[*step])) < 0) {
+			break;
+		}
+	}
+	mifare_desfire_disconnect(tag);
+	return error < 0 ? error : 0;
+}
@@ -0,0 +1,154 @@
+#ifndef NFF_KEY_ROTATION_H
+#define NFF_KEY_ROTATION_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <memory>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include <sys/types.h>
+
+#include "common.h"
+#include "personalize.h"
+
+/* States of a card in the progress table */
+#define NFF_ROTATION_UNKNOWN 0
+#define NFF_ROTATION_FAILED 1
+#define NFF_ROTATION_DONE 2
+
+/* Outcome of a tap, reported to JS */
+#define NFF_ROTATION_ROTATED 0
+#define NFF_ROTATION_SKIPPED 1
+#define NFF_ROTATION_ERROR 2
+
+/*
+* Progress table file, all integers are little endian.
+* Header: uint32 magic, uint32 version, uint32 capacity, uint32 entries,
+* uint32 rotated cards, 12 reserved bytes
+* Entry: uint8 UID length (0 for a free slot), 10 UID bytes, uint8 state,
+* uint8 failed attempts, 3 reserved bytes
+*/
+#define NFF_ROTATION_MAGIC 0x5246464e
+#define NFF_ROTATION_VERSION 1
+#define NFF_ROTATION_HEADER_SIZE 32
+#define NFF_ROTATION_ENTRY_SIZE 16
+#define NFF_ROTATION_MAX_UID 10
+
+// Default number of entries, 1 MiB
+#define NFF_ROTATION_CAPACITY 65536
+
+/**
+* DESFire key changed by a rotation, in the application aid (0 for the PICC
+* master key): authenticated with the old DES (8 bytes) or 3DES (16 bytes)
+* key, then changed to the new one
+*/
+struct RotationKey {
+	uint32_t aid;
+	uint8_t keyNo;
+	std::string oldKey;
+	std::string newKey;
+};
+
+/**
+* Old and new keys of a campaign, as given by JS. Classic sectors are
+* authenticated with key and keyType, then their trailer is rewritten.
+*/
+struct RotationSpec {
+	MifareClassicKey key;
+	MifareClassicKeyType keyType;
+	std::vector<PersonalizationTrailer> trailers;
+	std::vector<RotationKey> keys;
+};
+
+
+
+/**
+* UID-indexed progress of a campaign, in a memory mapped file: an open
+* addressing hash table, so looking up a tapped card touches a single page
+* and progress survives restarts without any load or save step.
+* Devices of the process opening the same file share one table, and the file
+* is locked against other processes. Lookups and updates run on workers.
+*/
+class RotationTable {
+
+public:
+	~RotationTable();
+
+	// Table of a file, shared with the devices which already opened it, NULL and errno on error.
+	// An existing file keeps its capacity.
+	static std::shared_ptr<RotationTable> Open(const std::string &path, uint32_t capacity, int *error);
+
+	// NFF_ROTATION_* state of a card, by the hexadecimal UID of libfreefare
+	uint8_t State(const std::string &uid);
+
+	// Flushed asynchronously, false if the table is full
+	bool Record(const std::string &uid, uint8_t state);
+
+	void Stats(uint32_t *capacity, uint32_t *entries, uint32_t *rotated);
+
+private:
+	RotationTable(int fd, uint8_t *data, size_t size, uint32_t capacity, dev_t device, ino_t inode);
+
+	// Slot of a UID, or of the free slot where it would be inserted, NULL if the table is full
+	uint8_t *Slot(const uint8_t *uid, size_t length);
+
+	uint32_t Header(size_t field);
+	void SetHeader(size_t field, uint32_t value);
+
+	std::mutex lock;
+	int fd;
+	uint8_t *data;
+	size_t size;
+	uint32_t capacity;
+
+	// File of the table
+	dev_t device;
+	ino_t inode;
+
+	// Tables of the process, by file
+	static std::mutex tablesLock;
+	static std::vector<std::weak_ptr<RotationTable> > tables;
+};
+
+/**
+* A campaign turned into the commands of one card: trailers and DESFire keys
+* are built once, and Rotate() skips the sectors and keys already moved to
+* the new keys by an interrupted previous attempt.
+*/
+class KeyRotation {
+
+public:
+	explicit KeyRotation(const RotationSpec &spec);
+	~KeyRotation();
+
+	// False if the keys are not valid
+	bool Prepare();
+
+	// True if the campaign has keys for the tag
+	bool Matches(MifareTag tag) const;
+
+	// Connect and rotate the keys of the tag, the index of the failed sector or key is set on error
+	int Rotate(MifareTag tag, size_t *step) const;
+
+private:
+	int RotateClassic(MifareTag tag, size_t *step) const;
+	int RotateDesfire(MifareTag tag, size_t *step) const;
+
+	RotationSpec spec;
+
+	// Trailer blocks written, in the order of spec.trailers
+	std::vector<std::array<uint8_t, 16> > trailers;
+
+	// Old and new DESFire keys
+	std::vector<MifareDESFireKey> oldKeys;
+	std::vector<MifareDESFireKey> newKeys;
+};
+
+
+#endif /* NFF_KEY_ROTATION_H */
@@ -0,0 +1,36 @@
+#include "memory.h"
+
+std::atomic<int64_t> NativeMemory::counters[NFF_MEMORY_CATEGORIES];
+int64_t NativeMemory::reported = 0;
+
+void NativeMemory::Allocated(int category, size_t bytes) {
+	counters[category] += bytes;
+}
+
+void NativeMemory::Released(int category, size_t bytes) {
+	counters[category] -= bytes;
+}
+
+void NativeMemory::Report() {
+	int64_t total = Total();
+	if(total != reported) {
+		Nan::AdjustExternalMemory(total - reported);
+		reported = total;
+	}
+}
+
+int64_t NativeMemory::Get(int category) {
+	return counters[category];
+}
+
+int64_t NativeMemory::Total() {
+	int64_t total = 0;
+	for(int i = 0; i < NFF_MEMORY_CATEGORIES; i++) {
+		total += counters[i];
+	}
+	return total;
+}
+
+int64_t NativeMemory::Reported() {
+	return reported;
+}
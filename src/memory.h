@@ -0,0 +1,44 @@
+#ifndef NFF_MEMORY_H
+#define NFF_MEMORY_H
+
+#include <nan.h>
+#include <atomic>
+
+/* Native memory categories */
+#define NFF_MEMORY_TAGS 0
+#define NFF_MEMORY_WORKERS 1
+#define NFF_MEMORY_BUFFERS 2
+#define NFF_MEMORY_CACHES 3
+#define NFF_MEMORY_SHARED 4
+#define NFF_MEMORY_CATEGORIES 5
+
+// Estimated size of a libfreefare tag and its target info
+#define NFF_MEMORY_TAG_SIZE 512
+
+
+
+/**
+* Native memory held by the binding, reported to V8 so its GC heuristics
+* account for it. Counters are thread safe, Report() has to be called from
+* the main thread and only tells V8 the difference since the last report.
+*/
+class NativeMemory {
+
+public:
+	static void Allocated(int category, size_t bytes);
+	static void Released(int category, size_t bytes);
+
+	// Tell V8 about the change since the last report
+	static void Report();
+
+	static int64_t Get(int category);
+	static int64_t Total();
+	static int64_t Reported();
+
+private:
+	static std::atomic<int64_t> counters[NFF_MEMORY_CATEGORIES];
+	static int64_t reported;
+};
+
+
+#endif /* NFF_MEMORY_H */
@@ -0,0 +1,341 @@
+#include "nfc_emulator.h"
+#include "nfc_trace.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// Pages of the emulated cards
+#define NFF_EMULATOR_ULTRALIGHT_PAGES 16
+#define NFF_EMULATOR_NTAG213_PAGES 45
+
+// Ultralight and NTAG commands
+#define NFF_EMULATOR_GET_VERSION 0x60
+#define NFF_EMULATOR_READ 0x30
+#define NFF_EMULATOR_FAST_READ 0x3a
+#define NFF_EMULATOR_WRITE 0xa2
+
+static uint64_t now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void putUint32(uint8_t *data, uint32_t value) {
+	for(int i = 0; i < 4; i++) {
+		data[i] = value >> (8 * i);
+	}
+}
+
+
+
+bool NfcEmulator::Parse(const char *spec, Config *config) {
+	config->readers = 4;
+	config->rate = 1;
+	config->dwell = 800;
+	config->early = 0.1;
+	config->earlyDwell = 150;
+	config->latency = 3000;
+	config->byteLatency = 100;
+	config->card = NFF_EMULATOR_ULTRALIGHT;
+	config->seed = 1;
+
+	std::string list(spec);
+	size_t start = 0;
+	while(start < list.size()) {
+		size_t end = list.find(',', start);
+		if(end == std::string::npos) {
+			end = list.size();
+		}
+		std::string item = list.substr(start, end - start);
+		start = end + 1;
+
+		size_t equal = item.find('=');
+		if(equal == std::string::npos) {
+			return false;
+		}
+		std::string name = item.substr(0, equal);
+		std::string value = item.substr(equal + 1);
+		if(name == "readers") config->readers = strtoul(value.c_str(), NULL, 10);
+		else if(name == "rate") config->rate = atof(value.c_str());
+		else if(name == "dwell") config->dwell = strtoul(value.c_str(), NULL, 10);
+		else if(name == "early") config->early = atof(value.c_str());
+		else if(name == "earlyDwell") config->earlyDwell = strtoul(value.c_str(), NULL, 10);
+		else if(name == "latency") config->latency = strtoul(value.c_str(), NULL, 10);
+		else if(name == "byteLatency") config->byteLatency = strtoul(value.c_str(), NULL, 10);
+		else if(name == "seed") config->seed = strtoull(value.c_str(), NULL, 10);
+		else if(name == "stats") config->stats = value;
+		else if(name == "card" && value == "ultralight") config->card = NFF_EMULATOR_ULTRALIGHT;
+		else if(name == "card" && value == "ntag213") config->card = NFF_EMULATOR_NTAG213;
+		else return false;
+	}
+	return config->rate > 0;
+}
+
+NfcEmulator::NfcEmulator(const Config &config) : config(config) {}
+NfcEmulator::~NfcEmulator() {}
+
+size_t NfcEmulator::ListDevices(nfc_connstring connstrings[], size_t length) {
+	size_t count = std::min<size_t>(length, config.readers);
+	for(size_t i = 0; i < count; i++) {
+		snprintf(connstrings[i], sizeof(nfc_connstring), "%s%u", NFF_EMULATOR_CONNSTRING, (unsigned int) i);
+	}
+	return count;
+}
+
+nfc_device* NfcEmulator::Open(const char *connstring) {
+	size_t prefix = strlen(NFF_EMULATOR_CONNSTRING);
+	if(!connstring || strncmp(connstring, NFF_EMULATOR_CONNSTRING, prefix)) {
+		return NULL;
+	}
+	uint32_t index = strtoul(connstring + prefix, NULL, 10);
+	if(index >= config.readers) {
+		return NULL;
+	}
+
+	// Each reader draws its own sequence, whatever the order they are used in
+	Reader *reader = new Reader();
+	reader->index = index;
+	reader->connstring = connstring;
+	reader->random.seed(config.seed * 1000003 + index);
+	reader->lastError = 0;
+	reader->present = false;
+	reader->selected = false;
+	reader->arrivals = 0;
+	reader->earlyRemovals = 0;
+	reader->commands = 0;
+	reader->nextArrival = now() + std::exponential_distribution<double>(config.rate)(reader->random) * 1e9;
+	Wait(0);
+	return reinterpret_cast<nfc_device*>(reader);
+}
+
+void NfcEmulator::Close(nfc_device *device) {
+	Reader *reader = reinterpret_cast<Reader*>(device);
+	{
+		std::lock_guard<std::mutex> lock(reader->mutex);
+		Advance(reader, now());
+	}
+	if(!config.stats.empty()) {
+		FILE *file = fopen(config.stats.c_str(), "a");
+		if(file) {
+			fprintf(file, "{\"reader\":%u,\"arrivals\":%u,\"earlyRemovals\":%u,\"commands\":%u}\n",
+				reader->index, reader->arrivals, reader->earlyRemovals, reader->commands);
+			fclose(file);
+		}
+	}
+	delete reader;
+}
+
+void NfcEmulator::Advance(Reader *reader, uint64_t time) {
+	while(true) {
+		if(reader->present) {
+			if(time < reader->card.departure) {
+				return;
+			}
+			reader->present = false;
+			reader->selected = false;
+			reader->nextArrival = reader->card.departure + std::exponential_distribution<double>(config.rate)(reader->random) * 1e9;
+		}
+		if(time < reader->nextArrival) {
+			return;
+		}
+		Arrive(reader, reader->nextArrival);
+	}
+}
+
+void NfcEmulator::Arrive(Reader *reader, uint64_t time) {
+	Card &card = reader->card;
+	reader->arrivals++;
+	reader->present = true;
+	reader->selected = false;
+
+	// NXP manufacturer byte, reader and arrival number
+	card.uid[0] = 0x04;
+	card.uid[1] = reader->index >> 8;
+	card.uid[2] = reader->index;
+	card.uid[3] = reader->arrivals >> 24;
+	card.uid[4] = reader->arrivals >> 16;
+	card.uid[5] = reader->arrivals >> 8;
+	card.uid[6] = reader->arrivals;
+
+	// Early removals leave before a tap could complete, others stay 0.5 to 1.5 times the mean dwell
+	card.early = std::uniform_real_distribution<double>(0, 1)(reader->random) < config.early;
+	double dwell = card.early ?
+		std::uniform_real_distribution<double>(0, config.earlyDwell)(reader->random) :
+		std::uniform_real_distribution<double>(config.dwell * 0.5, config.dwell * 1.5)(reader->random);
+	if(card.early) {
+		reader->earlyRemovals++;
+	}
+	card.arrival = time;
+	card.departure = time + (uint64_t) (dwell * 1e6);
+
+	card.memory.assign(4 * (config.card == NFF_EMULATOR_NTAG213 ? NFF_EMULATOR_NTAG213_PAGES : NFF_EMULATOR_ULTRALIGHT_PAGES), 0);
+	memcpy(card.memory.data(), card.uid, 3);
+	memcpy(card.memory.data() + 4, card.uid + 3, 4);
+	uint64_t arrival = time / 1000;
+	putUint32(&card.memory[NFF_EMULATOR_ARRIVAL_PAGE * 4], arrival);
+	putUint32(&card.memory[NFF_EMULATOR_ARRIVAL_PAGE * 4 + 4], arrival >> 32);
+	putUint32(&card.memory[NFF_EMULATOR_SEQUENCE_PAGE * 4], reader->arrivals);
+	putUint32(&card.memory[NFF_EMULATOR_READER_PAGE * 4], reader->index);
+}
+
+void NfcEmulator::Target(const Reader *reader, nfc_target *target) const {
+	memset(target, 0, sizeof(*target));
+	target->nm.nmt = NMT_ISO14443A;
+	target->nm.nbr = NBR_106;
+	target->nti.nai.abtAtqa[0] = 0x00;
+	target->nti.nai.abtAtqa[1] = 0x44;
+	target->nti.nai.btSak = 0x00;
+	target->nti.nai.szUidLen = sizeof(reader->card.uid);
+	memcpy(target->nti.nai.abtUid, reader->card.uid, sizeof(reader->card.uid));
+}
+
+void NfcEmulator::Wait(size_t bytes) const {
+	uint64_t duration = config.latency * 1000ULL + bytes * config.byteLatency;
+	if(duration) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(duration));
+	}
+}
+
+int NfcEmulator::Call(nfc_device *device, uint8_t call, const void *in, size_t inLength, void *out, size_t outCapacity) {
+	Reader *reader = reinterpret_cast<Reader*>(device);
+	std::lock_guard<std::mutex> lock(reader->mutex);
+	reader->commands++;
+	reader->lastError = 0;
+
+	const uint8_t *input = static_cast<const uint8_t*>(in);
+	int result = NFC_SUCCESS;
+	switch(call) {
+		case NFF_TRACE_LIST_PASSIVE_TARGETS:
+			// Emulated cards only answer ISO14443A polls
+			if(inLength < sizeof(nfc_modulation) || reinterpret_cast<const nfc_modulation*>(in)->nmt != NMT_ISO14443A) {
+				Wait(0);
+				result = 0;
+				break;
+			}
+			result = ListTargets(reader, static_cast<nfc_target*>(out), outCapacity / sizeof(nfc_target));
+			break;
+		case NFF_TRACE_SELECT_PASSIVE_TARGET:
+			result = Select(reader, inLength > sizeof(nfc_modulation) ? input + sizeof(nfc_modulation) : NULL,
+				inLength - std::min(inLength, sizeof(nfc_modulation)), static_cast<nfc_target*>(out));
+			break;
+		case NFF_TRACE_DESELECT_TARGET:
+			Wait(0);
+			reader->selected = false;
+			break;
+		case NFF_TRACE_TARGET_IS_PRESENT:
+			Wait(0);
+			Advance(reader, now());
+			result = (reader->present && reader->selected) ? NFC_SUCCESS : NFC_ETGRELEASED;
+			break;
+		case NFF_TRACE_TRANSCEIVE_BYTES:
+			result = Transceive(reader, input, inLength, static_cast<uint8_t*>(out), outCapacity);
+			break;
+	}
+	if(result < 0) {
+		reader->lastError = result;
+	}
+	return result;
+}
+
+int NfcEmulator::ListTargets(Reader *reader, nfc_target *targets, size_t count) {
+	Wait(0);
+	Advance(reader, now());
+	if(!reader->present || !count) {
+		return 0;
+	}
+	Target(reader, &targets[0]);
+	return 1;
+}
+
+int NfcEmulator::Select(Reader *reader, const uint8_t *uid, size_t length, nfc_target *target) {
+	Wait(length);
+	Advance(reader, now());
+	if(!reader->present || (uid && (length != sizeof(reader->card.uid) || memcmp(uid, reader->card.uid, length)))) {
+		return 0;
+	}
+	reader->selected = true;
+	if(target) {
+		Target(reader, target);
+	}
+	return 1;
+}
+
+int NfcEmulator::Transceive(Reader *reader, const uint8_t *tx, size_t txLength, uint8_t *rx, size_t rxCapacity) {
+	Advance(reader, now());
+	if(!reader->present || !reader->selected || !txLength) {
+		Wait(txLength);
+		return NFC_ERFTRANS;
+	}
+
+	Card &card = reader->card;
+	size_t pages = card.memory.size() / 4;
+	std::string response;
+	switch(tx[0]) {
+		case NFF_EMULATOR_GET_VERSION:
+			// Ultralight cards do not answer it
+			if(config.card == NFF_EMULATOR_NTAG213) {
+				static const uint8_t version[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0f, 0x03};
+				response.assign(reinterpret_cast<const char*>(version), sizeof(version));
+				break;
+			}
+			reader->selected = false;
+			Wait(txLength);
+			return NFC_ERFTRANS;
+
+		case NFF_EMULATOR_READ:
+			// Reads roll over the end of the memory
+			if(txLength < 2 || tx[1] >= pages) {
+				Wait(txLength);
+				return NFC_ERFTRANS;
+			}
+			for(size_t i = 0; i < 16; i++) {
+				response.push_back(card.memory[(tx[1] * 4 + i) % card.memory.size()]);
+			}
+			break;
+
+		case NFF_EMULATOR_FAST_READ:
+			if(config.card != NFF_EMULATOR_NTAG213 || txLength < 3 || tx[1] > tx[2] || tx[2] >= pages) {
+				Wait(txLength);
+				return NFC_ERFTRANS;
+			}
+			response.assign(reinterpret_cast<const char*>(&card.memory[tx[1] * 4]), (tx[2] - tx[1] + 1) * 4);
+			break;
+
+		case NFF_EMULATOR_WRITE:
+			if(txLength < 6 || tx[1] < 4 || tx[1] >= pages) {
+				Wait(txLength);
+				return NFC_ERFTRANS;
+			}
+			memcpy(&card.memory[tx[1] * 4], tx + 2, 4);
+			break;
+
+		default:
+			// Other commands, as the Ultralight C authentication, are not supported
+			reader->selected = false;
+			Wait(txLength);
+			return NFC_ERFTRANS;
+	}
+
+	Wait(txLength + response.size());
+
+	// The card may have left during the command
+	Advance(reader, now());
+	if(!reader->present) {
+		return NFC_ERFTRANS;
+	}
+	size_t length = std::min(response.size(), rxCapacity);
+	if(rx) {
+		memcpy(rx, response.data(), length);
+	}
+	return length;
+}
+
+int NfcEmulator::LastError(const nfc_device *device) const {
+	return reinterpret_cast<const Reader*>(device)->lastError;
+}
+
+const char* NfcEmulator::Connstring(nfc_device *device) const {
+	return reinterpret_cast<Reader*>(device)->connstring.c_str();
+}
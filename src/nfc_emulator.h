@@ -0,0 +1,120 @@
+#ifndef NFF_NFC_EMULATOR_H
+#define NFF_NFC_EMULATOR_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+
+extern "C" {
+	#include <nfc/nfc.h>
+}
+
+// Connection string of the emulated readers, followed by their index
+#define NFF_EMULATOR_CONNSTRING "emulated:"
+
+/* Emulated cards */
+#define NFF_EMULATOR_ULTRALIGHT 0
+#define NFF_EMULATOR_NTAG213 1
+
+/*
+* Card memory: pages 4-5 hold the arrival time of the card (µs on the
+* monotonic clock, as process.hrtime()), page 6 its arrival number on the
+* reader and page 7 the reader index, all little endian
+*/
+#define NFF_EMULATOR_ARRIVAL_PAGE 4
+#define NFF_EMULATOR_SEQUENCE_PAGE 6
+#define NFF_EMULATOR_READER_PAGE 7
+
+
+
+/**
+* Readers with cards coming and going, behind the libnfc interface of the
+* trace library. Cards arrive on each reader with Poisson inter-arrival times
+* once the previous card left, stay in the field for a random dwell time and
+* some are removed early. Commands sent to a card which left fail as on a real
+* reader, every command takes the configured latency.
+* It is configured by NFF_EMULATE, a comma separated list of name=value:
+* readers (4), rate of arrivals per reader and second (1), dwell mean in ms
+* (800), early removal probability (0.1) and longest early dwell in ms (150),
+* latency of a command in µs (3000) and transfer time of a byte in ns (100),
+* card (ultralight or ntag213), seed of the generator and stats, a file where
+* each reader appends its counters when it is closed.
+*/
+class NfcEmulator {
+
+public:
+	struct Config {
+		uint32_t readers;
+		double rate;
+		uint32_t dwell;
+		double early;
+		uint32_t earlyDwell;
+		uint32_t latency;
+		uint32_t byteLatency;
+		int card;
+		uint64_t seed;
+		std::string stats;
+	};
+
+	// Config from a NFF_EMULATE value, false if it can not be parsed
+	static bool Parse(const char *spec, Config *config);
+
+	explicit NfcEmulator(const Config &config);
+	~NfcEmulator();
+
+	size_t ListDevices(nfc_connstring connstrings[], size_t length);
+	nfc_device* Open(const char *connstring);
+	void Close(nfc_device *device);
+
+	// Calls traced by the trace library (NFF_TRACE_*), with the same input and output
+	int Call(nfc_device *device, uint8_t call, const void *in, size_t inLength, void *out, size_t outCapacity);
+
+	int LastError(const nfc_device *device) const;
+	const char* Connstring(nfc_device *device) const;
+
+private:
+	struct Card {
+		uint8_t uid[7];
+		uint64_t arrival;
+		uint64_t departure;
+		bool early;
+		std::vector<uint8_t> memory;
+	};
+
+	struct Reader {
+		uint32_t index;
+		std::string connstring;
+		std::mt19937_64 random;
+		std::mutex mutex;
+		int lastError;
+
+		// Card in the field and time the next one comes (ns)
+		bool present;
+		bool selected;
+		Card card;
+		uint64_t nextArrival;
+
+		// Counters written to the stats file
+		uint32_t arrivals;
+		uint32_t earlyRemovals;
+		uint32_t commands;
+	};
+
+	// Bring the field of a reader to the given time
+	void Advance(Reader *reader, uint64_t time);
+	void Arrive(Reader *reader, uint64_t time);
+
+	int ListTargets(Reader *reader, nfc_target *targets, size_t count);
+	int Select(Reader *reader, const uint8_t *uid, size_t length, nfc_target *target);
+	int Transceive(Reader *reader, const uint8_t *tx, size_t txLength, uint8_t *rx, size_t rxCapacity);
+	void Target(const Reader *reader, nfc_target *target) const;
+
+	// Time taken by a command exchanging the given bytes
+	void Wait(size_t bytes) const;
+
+	Config config;
+};
+
+
+#endif /* NFF_NFC_EMULATOR_H */
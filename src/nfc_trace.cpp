@@ -0,0 +1,525 @@
+#include "nfc_trace.h"
+
+#include <dlfcn.h>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include "endian.h"
+
+/*
+* Device handed out in replay, in place of a libnfc one
+*/
+struct ReplayDevice {
+	uint32_t index;
+	int lastError;
+	std::string connstring;
+};
+
+// Device last used by the thread, random bytes are recorded on it
+static thread_local uint32_t currentDevice = 0;
+
+static uint64_t now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Function of the library the trace is preloaded in front of
+template<typename F> static F real(const char *name) {
+	return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+static void appendUint32(std::string *data, uint32_t value) {
+	value = htole32(value);
+	data->append(reinterpret_cast<const char*>(&value), 4);
+}
+
+static void appendUint64(std::string *data, uint64_t value) {
+	value = htole64(value);
+	data->append(reinterpret_cast<const char*>(&value), 8);
+}
+
+static uint32_t readUint32(const char *data) {
+	uint32_t value;
+	memcpy(&value, data, 4);
+	return le32toh(value);
+}
+
+static uint64_t readUint64(const char *data) {
+	uint64_t value;
+	memcpy(&value, data, 8);
+	return le64toh(value);
+}
+
+
+
+NfcTrace::NfcTrace() : mode(NFF_TRACE_OFF), scale(1), file(NULL), nextDevice(1), emulator(NULL) {
+	const char *scaleEnv = getenv("NFF_TRACE_SCALE");
+	if(scaleEnv) {
+		scale = std::max(0.0, atof(scaleEnv));
+	}
+
+	const char *emulate = getenv("NFF_EMULATE");
+	const char *replay = getenv("NFF_TRACE_REPLAY");
+	const char *capture = getenv("NFF_TRACE_CAPTURE");
+	NfcEmulator::Config config;
+	if(emulate) {
+		if(NfcEmulator::Parse(emulate, &config)) {
+			emulator = new NfcEmulator(config);
+			mode = NFF_TRACE_EMULATE;
+		}
+		else {
+			fprintf(stderr, "nfc_trace: can not parse NFF_EMULATE=%s\n", emulate);
+		}
+	}
+	else if(replay && *replay) {
+		if(Load(replay)) {
+			mode = NFF_TRACE_REPLAY;
+		}
+		else {
+			fprintf(stderr, "nfc_trace: can not load %s\n", replay);
+		}
+	}
+	else if(capture && *capture) {
+		file = fopen(capture, "wb");
+		if(file) {
+			std::string header(NFF_TRACE_MAGIC);
+			appendUint32(&header, NFF_TRACE_VERSION);
+			fwrite(header.data(), 1, header.size(), file);
+			mode = NFF_TRACE_CAPTURE;
+		}
+		else {
+			fprintf(stderr, "nfc_trace: can not create %s\n", capture);
+		}
+	}
+}
+NfcTrace::~NfcTrace() {
+	if(file) {
+		fclose(file);
+	}
+	delete emulator;
+}
+
+NfcTrace& NfcTrace::Get() {
+	static NfcTrace trace;
+	return trace;
+}
+
+int NfcTrace::Mode() const {
+	return mode;
+}
+
+NfcEmulator* NfcTrace::Emulator() const {
+	return emulator;
+}
+
+bool NfcTrace::Load(const char *path) {
+	FILE *input = fopen(path, "rb");
+	if(!input) {
+		return false;
+	}
+	std::string data;
+	char chunk[65536];
+	size_t read;
+	while((read = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+		data.append(chunk, read);
+	}
+	fclose(input);
+
+	size_t position = strlen(NFF_TRACE_MAGIC) + 4;
+	if(data.size() < position || data.compare(0, strlen(NFF_TRACE_MAGIC), NFF_TRACE_MAGIC)
+	|| readUint32(data.data() + strlen(NFF_TRACE_MAGIC)) != NFF_TRACE_VERSION) {
+		return false;
+	}
+
+	// A record cut by a crash ends the recording
+	while(data.size() - position >= NFF_TRACE_RECORD_HEADER_SIZE) {
+		const char *header = data.data() + position;
+		Record record;
+		record.call = header[0];
+		record.device = readUint32(header + 1);
+		record.duration = readUint64(header + 5);
+		record.result = readUint32(header + 13);
+		record.lastError = readUint32(header + 17);
+		size_t inputLength = readUint32(header + 21);
+		size_t outputLength = readUint32(header + 25);
+		position += NFF_TRACE_RECORD_HEADER_SIZE;
+		if(data.size() - position < inputLength + outputLength) {
+			break;
+		}
+		record.input = data.substr(position, inputLength);
+		record.output = data.substr(position + inputLength, outputLength);
+		position += inputLength + outputLength;
+		records[record.device].push_back(record);
+	}
+	return true;
+}
+
+uint32_t NfcTrace::Open(const nfc_device *device) {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = nextDevice++;
+	devices[device] = index;
+	return index;
+}
+
+uint32_t NfcTrace::Device(const nfc_device *device) {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<const nfc_device*, uint32_t>::const_iterator it = devices.find(device);
+	return it != devices.end() ? it->second : 0;
+}
+
+void NfcTrace::Close(const nfc_device *device) {
+	std::lock_guard<std::mutex> lock(mutex);
+	devices.erase(device);
+	fflush(file);
+}
+
+void NfcTrace::Write(const Record &record) {
+	std::string data;
+	data.push_back(record.call);
+	appendUint32(&data, record.device);
+	appendUint64(&data, record.duration);
+	appendUint32(&data, record.result);
+	appendUint32(&data, record.lastError);
+	appendUint32(&data, record.input.size());
+	appendUint32(&data, record.output.size());
+	data.append(record.input);
+	data.append(record.output);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	fwrite(data.data(), 1, data.size(), file);
+}
+
+bool NfcTrace::Next(uint32_t device, uint8_t call, const std::string &input, Record *record) {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::deque<Record> &queue = records[device];
+
+	// The application diverged from the recording, the record is left for the expected call
+	if(queue.empty()) {
+		fprintf(stderr, "nfc_trace: device %u diverged, call %u after the end of the recording\n", device, call);
+		return false;
+	}
+	if(queue.front().call != call) {
+		fprintf(stderr, "nfc_trace: device %u diverged, call %u instead of %u\n", device, call, queue.front().call);
+		return false;
+	}
+	if(queue.front().input != input) {
+		fprintf(stderr, "nfc_trace: device %u diverged, call %u sent %zu bytes differing from the %zu recorded\n",
+			device, call, input.size(), queue.front().input.size());
+		return false;
+	}
+	*record = queue.front();
+	queue.pop_front();
+	return true;
+}
+
+void NfcTrace::Wait(uint64_t duration) const {
+	if(scale > 0 && duration > 0) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds((uint64_t) (duration * scale)));
+	}
+}
+
+
+
+/**
+* Record or replay a call on a device. The output of the call is outCapacity
+* bytes, or result * unit bytes when unit is set.
+*/
+static int traced(nfc_device *pnd, uint8_t call, const void *in, size_t inLength, void *out, size_t outCapacity, size_t unit, const std::function<int()> &call_real) {
+	NfcTrace &trace = NfcTrace::Get();
+	if(trace.Mode() == NFF_TRACE_EMULATE) {
+		return trace.Emulator()->Call(pnd, call, in, inLength, out, outCapacity);
+	}
+	if(trace.Mode() == NFF_TRACE_REPLAY) {
+		ReplayDevice *device = reinterpret_cast<ReplayDevice*>(pnd);
+		currentDevice = device->index;
+		NfcTrace::Record record;
+		std::string input;
+		if(in) {
+			input.assign(static_cast<const char*>(in), inLength);
+		}
+		if(!trace.Next(device->index, call, input, &record)) {
+			device->lastError = NFC_EIO;
+			return NFC_EIO;
+		}
+		if(out) {
+			memcpy(out, record.output.data(), std::min(record.output.size(), outCapacity));
+		}
+		device->lastError = record.lastError;
+		trace.Wait(record.duration);
+		return record.result;
+	}
+	if(trace.Mode() == NFF_TRACE_OFF) {
+		return call_real();
+	}
+
+	NfcTrace::Record record;
+	record.call = call;
+	record.device = trace.Device(pnd);
+	currentDevice = record.device;
+	uint64_t start = now();
+	record.result = call_real();
+	record.duration = now() - start;
+	record.lastError = real<int (*)(const nfc_device*)>("nfc_device_get_last_error")(pnd);
+	if(in) {
+		record.input.assign(static_cast<const char*>(in), inLength);
+	}
+	if(out && record.result >= 0) {
+		size_t length = unit ? std::min<size_t>(record.result * unit, outCapacity) : outCapacity;
+		record.output.assign(static_cast<const char*>(out), length);
+	}
+	trace.Write(record);
+	return record.result;
+}
+
+
+
+extern "C" {
+
+size_t nfc_list_devices(nfc_context *context, nfc_connstring connstrings[], size_t connstrings_len) {
+	static size_t (*list)(nfc_context*, nfc_connstring[], size_t) = real<size_t (*)(nfc_context*, nfc_connstring[], size_t)>("nfc_list_devices");
+	NfcTrace &trace = NfcTrace::Get();
+	NfcTrace::Record record;
+	switch(trace.Mode()) {
+		case NFF_TRACE_EMULATE:
+			return trace.Emulator()->ListDevices(connstrings, connstrings_len);
+		case NFF_TRACE_REPLAY: {
+			if(!trace.Next(0, NFF_TRACE_LIST_DEVICES, std::string(), &record)) {
+				return 0;
+			}
+			size_t count = std::min(connstrings_len, record.output.size() / sizeof(nfc_connstring));
+			memcpy(connstrings, record.output.data(), count * sizeof(nfc_connstring));
+			return count;
+		}
+		case NFF_TRACE_CAPTURE: {
+			uint64_t start = now();
+			size_t count = list(context, connstrings, connstrings_len);
+			record.call = NFF_TRACE_LIST_DEVICES;
+			record.device = 0;
+			record.duration = now() - start;
+			record.result = count;
+			record.lastError = 0;
+			record.output.assign(reinterpret_cast<const char*>(connstrings), count * sizeof(nfc_connstring));
+			trace.Write(record);
+			return count;
+		}
+	}
+	return list(context, connstrings, connstrings_len);
+}
+
+nfc_device *nfc_open(nfc_context *context, const nfc_connstring connstring) {
+	static nfc_device* (*open)(nfc_context*, const nfc_connstring) = real<nfc_device* (*)(nfc_context*, const nfc_connstring)>("nfc_open");
+	NfcTrace &trace = NfcTrace::Get();
+	NfcTrace::Record record;
+	switch(trace.Mode()) {
+		case NFF_TRACE_EMULATE:
+			return trace.Emulator()->Open(connstring);
+		case NFF_TRACE_REPLAY: {
+			// Opening order numbers the devices, a failed opening is recorded as device 0
+			if(!trace.Next(0, NFF_TRACE_OPEN, connstring ? connstring : "", &record) || record.output.size() != 4 || !readUint32(record.output.data())) {
+				return NULL;
+			}
+			trace.Wait(record.duration);
+			ReplayDevice *device = new ReplayDevice();
+			device->index = readUint32(record.output.data());
+			device->lastError = 0;
+			device->connstring = record.input;
+			return reinterpret_cast<nfc_device*>(device);
+		}
+		case NFF_TRACE_CAPTURE: {
+			uint64_t start = now();
+			nfc_device *device = open(context, connstring);
+			record.call = NFF_TRACE_OPEN;
+			record.device = 0;
+			record.duration = now() - start;
+			record.result = device ? 0 : NFC_EIO;
+			record.lastError = 0;
+			if(connstring) {
+				record.input = connstring;
+			}
+			appendUint32(&record.output, device ? trace.Open(device) : 0);
+			trace.Write(record);
+			return device;
+		}
+	}
+	return open(context, connstring);
+}
+
+void nfc_close(nfc_device *pnd) {
+	static void (*close)(nfc_device*) = real<void (*)(nfc_device*)>("nfc_close");
+	NfcTrace &trace = NfcTrace::Get();
+	if(trace.Mode() == NFF_TRACE_EMULATE) {
+		trace.Emulator()->Close(pnd);
+		return;
+	}
+	if(trace.Mode() == NFF_TRACE_REPLAY) {
+		delete reinterpret_cast<ReplayDevice*>(pnd);
+		return;
+	}
+	if(trace.Mode() == NFF_TRACE_CAPTURE) {
+		trace.Close(pnd);
+	}
+	close(pnd);
+}
+
+int nfc_abort_command(nfc_device *pnd) {
+	// Called from another thread than the device calls, it is not recorded
+	if(NfcTrace::Get().Mode() == NFF_TRACE_REPLAY || NfcTrace::Get().Mode() == NFF_TRACE_EMULATE) {
+		return NFC_SUCCESS;
+	}
+	return real<int (*)(nfc_device*)>("nfc_abort_command")(pnd);
+}
+
+int nfc_idle(nfc_device *pnd) {
+	static int (*idle)(nfc_device*) = real<int (*)(nfc_device*)>("nfc_idle");
+	return traced(pnd, NFF_TRACE_IDLE, NULL, 0, NULL, 0, 0, [&]() {
+		return idle(pnd);
+	});
+}
+
+int nfc_initiator_init(nfc_device *pnd) {
+	static int (*init)(nfc_device*) = real<int (*)(nfc_device*)>("nfc_initiator_init");
+	return traced(pnd, NFF_TRACE_INITIATOR_INIT, NULL, 0, NULL, 0, 0, [&]() {
+		return init(pnd);
+	});
+}
+
+int nfc_initiator_list_passive_targets(nfc_device *pnd, const nfc_modulation nm, nfc_target ant[], const size_t szTargets) {
+	static int (*list)(nfc_device*, const nfc_modulation, nfc_target[], const size_t) = real<int (*)(nfc_device*, const nfc_modulation, nfc_target[], const size_t)>("nfc_initiator_list_passive_targets");
+	return traced(pnd, NFF_TRACE_LIST_PASSIVE_TARGETS, &nm, sizeof(nm), ant, szTargets * sizeof(nfc_target), sizeof(nfc_target), [&]() {
+		return list(pnd, nm, ant, szTargets);
+	});
+}
+
+int nfc_initiator_select_passive_target(nfc_device *pnd, const nfc_modulation nm, const uint8_t *pbtInitData, const size_t szInitData, nfc_target *pnt) {
+	static int (*select)(nfc_device*, const nfc_modulation, const uint8_t*, const size_t, nfc_target*) = real<int (*)(nfc_device*, const nfc_modulation, const uint8_t*, const size_t, nfc_target*)>("nfc_initiator_select_passive_target");
+	std::string in(reinterpret_cast<const char*>(&nm), sizeof(nm));
+	if(pbtInitData) {
+		in.append(reinterpret_cast<const char*>(pbtInitData), szInitData);
+	}
+	return traced(pnd, NFF_TRACE_SELECT_PASSIVE_TARGET, in.data(), in.size(), pnt, pnt ? sizeof(nfc_target) : 0, 0, [&]() {
+		return select(pnd, nm, pbtInitData, szInitData, pnt);
+	});
+}
+
+int nfc_initiator_deselect_target(nfc_device *pnd) {
+	static int (*deselect)(nfc_device*) = real<int (*)(nfc_device*)>("nfc_initiator_deselect_target");
+	return traced(pnd, NFF_TRACE_DESELECT_TARGET, NULL, 0, NULL, 0, 0, [&]() {
+		return deselect(pnd);
+	});
+}
+
+int nfc_initiator_target_is_present(nfc_device *pnd, const nfc_target *pnt) {
+	static int (*present)(nfc_device*, const nfc_target*) = real<int (*)(nfc_device*, const nfc_target*)>("nfc_initiator_target_is_present");
+	return traced(pnd, NFF_TRACE_TARGET_IS_PRESENT, NULL, 0, NULL, 0, 0, [&]() {
+		return present(pnd, pnt);
+	});
+}
+
+int nfc_initiator_transceive_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout) {
+	static int (*transceive)(nfc_device*, const uint8_t*, const size_t, uint8_t*, const size_t, int) = real<int (*)(nfc_device*, const uint8_t*, const size_t, uint8_t*, const size_t, int)>("nfc_initiator_transceive_bytes");
+	return traced(pnd, NFF_TRACE_TRANSCEIVE_BYTES, pbtTx, szTx, pbtRx, szRx, 1, [&]() {
+		return transceive(pnd, pbtTx, szTx, pbtRx, szRx, timeout);
+	});
+}
+
+int nfc_device_set_property_bool(nfc_device *pnd, const nfc_property property, const bool bEnable) {
+	static int (*set)(nfc_device*, const nfc_property, const bool) = real<int (*)(nfc_device*, const nfc_property, const bool)>("nfc_device_set_property_bool");
+	std::string in;
+	appendUint32(&in, property);
+	in.push_back(bEnable);
+	return traced(pnd, NFF_TRACE_SET_PROPERTY_BOOL, in.data(), in.size(), NULL, 0, 0, [&]() {
+		return set(pnd, property, bEnable);
+	});
+}
+
+int nfc_device_set_property_int(nfc_device *pnd, const nfc_property property, const int value) {
+	static int (*set)(nfc_device*, const nfc_property, const int) = real<int (*)(nfc_device*, const nfc_property, const int)>("nfc_device_set_property_int");
+	std::string in;
+	appendUint32(&in, property);
+	appendUint32(&in, value);
+	return traced(pnd, NFF_TRACE_SET_PROPERTY_INT, in.data(), in.size(), NULL, 0, 0, [&]() {
+		return set(pnd, property, value);
+	});
+}
+
+int nfc_device_get_last_error(const nfc_device *pnd) {
+	if(NfcTrace::Get().Mode() == NFF_TRACE_EMULATE) {
+		return NfcTrace::Get().Emulator()->LastError(pnd);
+	}
+	if(NfcTrace::Get().Mode() == NFF_TRACE_REPLAY) {
+		return reinterpret_cast<const ReplayDevice*>(pnd)->lastError;
+	}
+	return real<int (*)(const nfc_device*)>("nfc_device_get_last_error")(pnd);
+}
+
+const char *nfc_strerror(const nfc_device *pnd) {
+	if(NfcTrace::Get().Mode() == NFF_TRACE_REPLAY) {
+		return "Replayed device error";
+	}
+	if(NfcTrace::Get().Mode() == NFF_TRACE_EMULATE) {
+		return "Emulated device error";
+	}
+	return real<const char* (*)(const nfc_device*)>("nfc_strerror")(pnd);
+}
+
+const char *nfc_device_get_name(nfc_device *pnd) {
+	if(NfcTrace::Get().Mode() == NFF_TRACE_EMULATE) {
+		return NfcTrace::Get().Emulator()->Connstring(pnd);
+	}
+	if(NfcTrace::Get().Mode() == NFF_TRACE_REPLAY) {
+		return reinterpret_cast<ReplayDevice*>(pnd)->connstring.c_str();
+	}
+	return real<const char* (*)(nfc_device*)>("nfc_device_get_name")(pnd);
+}
+
+const char *nfc_device_get_connstring(nfc_device *pnd) {
+	if(NfcTrace::Get().Mode() == NFF_TRACE_EMULATE) {
+		return NfcTrace::Get().Emulator()->Connstring(pnd);
+	}
+	if(NfcTrace::Get().Mode() == NFF_TRACE_REPLAY) {
+		return reinterpret_cast<ReplayDevice*>(pnd)->connstring.c_str();
+	}
+	return real<const char* (*)(nfc_device*)>("nfc_device_get_connstring")(pnd);
+}
+
+/*
+* Random bytes drawn by libfreefare for authentications, recorded on the
+* device last used by the thread
+*/
+int RAND_bytes(unsigned char *buf, int num) {
+	static int (*random)(unsigned char*, int) = real<int (*)(unsigned char*, int)>("RAND_bytes");
+	NfcTrace &trace = NfcTrace::Get();
+	NfcTrace::Record record;
+	if(currentDevice && trace.Mode() == NFF_TRACE_REPLAY) {
+		// A diverged replay fails the authentication instead of drawing other bytes
+		if(!trace.Next(currentDevice, NFF_TRACE_RANDOM, std::string(), &record)) {
+			return 0;
+		}
+		if(record.output.size() != (size_t) num) {
+			fprintf(stderr, "nfc_trace: device %u diverged, %d random bytes drawn instead of the %zu recorded\n",
+				currentDevice, num, record.output.size());
+			return 0;
+		}
+		memcpy(buf, record.output.data(), num);
+		return 1;
+	}
+	int result = random ? random(buf, num) : 0;
+	if(currentDevice && trace.Mode() == NFF_TRACE_CAPTURE && result == 1) {
+		record.call = NFF_TRACE_RANDOM;
+		record.device = currentDevice;
+		record.duration = 0;
+		record.result = result;
+		record.lastError = 0;
+		record.output.assign(reinterpret_cast<const char*>(buf), num);
+		trace.Write(record);
+	}
+	return result;
+}
+
+void nfc_trace_end_sequence() {
+	currentDevice = 0;
+}
+
+}
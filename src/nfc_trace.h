@@ -0,0 +1,118 @@
+#ifndef NFF_NFC_TRACE_H
+#define NFF_NFC_TRACE_H
+
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <cstdio>
+
+extern "C" {
+	#include <nfc/nfc.h>
+}
+
+#include "nfc_emulator.h"
+
+/*
+* Recording file: magic, uint32 version, then records, all integers little endian.
+* Record: uint8 call, uint32 device, uint64 duration (ns), int32 result,
+* int32 device error after the call, uint32 input length, uint32 output length,
+* input (command sent), output (data returned by the call).
+* Device 0 holds the calls made without a device, devices are numbered in
+* opening order.
+*/
+#define NFF_TRACE_MAGIC "NFFT"
+#define NFF_TRACE_VERSION 1
+#define NFF_TRACE_RECORD_HEADER_SIZE 29
+
+/* Traced calls */
+#define NFF_TRACE_LIST_DEVICES 0
+#define NFF_TRACE_OPEN 1
+#define NFF_TRACE_INITIATOR_INIT 2
+#define NFF_TRACE_LIST_PASSIVE_TARGETS 3
+#define NFF_TRACE_SELECT_PASSIVE_TARGET 4
+#define NFF_TRACE_DESELECT_TARGET 5
+#define NFF_TRACE_TRANSCEIVE_BYTES 6
+#define NFF_TRACE_TARGET_IS_PRESENT 7
+#define NFF_TRACE_SET_PROPERTY_BOOL 8
+#define NFF_TRACE_SET_PROPERTY_INT 9
+#define NFF_TRACE_IDLE 10
+#define NFF_TRACE_RANDOM 11
+
+/* Modes, chosen from the environment */
+#define NFF_TRACE_OFF 0
+#define NFF_TRACE_CAPTURE 1
+#define NFF_TRACE_REPLAY 2
+#define NFF_TRACE_EMULATE 3
+
+
+
+/**
+* Capture and replay of the reader traffic. The trace library is preloaded
+* (LD_PRELOAD) and interposes the libnfc functions used by libfreefare and the
+* addon, plus RAND_bytes so DESFire authentications replay identically.
+* NFF_TRACE_CAPTURE=file records the calls made on the real readers,
+* NFF_TRACE_REPLAY=file serves them again without hardware, each call taking
+* its recorded duration times NFF_TRACE_SCALE (1 by default, 0 for no wait).
+* NFF_EMULATE=config replaces the readers by emulated ones (see NfcEmulator).
+*/
+class NfcTrace {
+
+public:
+	struct Record {
+		uint8_t call;
+		uint32_t device;
+		uint64_t duration;
+		int32_t result;
+		int32_t lastError;
+		std::string input;
+		std::string output;
+	};
+
+	static NfcTrace& Get();
+
+	int Mode() const;
+
+	// Emulated readers, in emulation mode
+	NfcEmulator* Emulator() const;
+
+	// Capture: number of a device, assigned when it is opened
+	uint32_t Open(const nfc_device *device);
+	uint32_t Device(const nfc_device *device);
+	void Close(const nfc_device *device);
+	void Write(const Record &record);
+
+	// Replay: next record of a device, false (and logged) if it is not the expected call or input
+	bool Next(uint32_t device, uint8_t call, const std::string &input, Record *record);
+	void Wait(uint64_t duration) const;
+
+private:
+	NfcTrace();
+	~NfcTrace();
+
+	bool Load(const char *path);
+
+	int mode;
+	double scale;
+	std::mutex mutex;
+
+	// Capture
+	FILE *file;
+	std::map<const nfc_device*, uint32_t> devices;
+	uint32_t nextDevice;
+
+	// Replay
+	std::map<uint32_t, std::deque<Record>> records;
+
+	// Emulation
+	NfcEmulator *emulator;
+};
+
+/*
+* End of the calls of a worker, looked up by the addon when the trace library
+* is preloaded: random bytes drawn later by the thread belong to no device
+*/
+extern "C" void nfc_trace_end_sequence();
+
+
+#endif /* NFF_NFC_TRACE_H */
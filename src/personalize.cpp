@@ -0,0 +1,235 @@
+#include "personalize.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Highest page of the Ultralight and NTAG address space
+#define NFF_PERSO_MAX_PAGE 0xff
+
+// Highest block of a MIFARE Classic 4K
+#define NFF_PERSO_MAX_BLOCK 0xff
+
+// Highest sector of a MIFARE Classic 4K
+#define NFF_PERSO_MAX_SECTOR 39
+
+// Highest block of a MIFARE Classic 1K
+#define NFF_PERSO_1K_MAX_BLOCK 63
+
+PersonalizationPlan::PersonalizationPlan(const PersonalizationJob &job) : job(job), size(job.image.size()) {
+	for(size_t i = 0; i < job.files.size(); i++) {
+		size += job.files[i].data.size();
+	}
+	NativeMemory::Allocated(NFF_MEMORY_BUFFERS, size);
+}
+PersonalizationPlan::~PersonalizationPlan() {
+	for(size_t i = 0; i < keys.size(); i++) {
+		if(keys[i]) {
+			mifare_desfire_key_free(keys[i]);
+		}
+	}
+	NativeMemory::Released(NFF_MEMORY_BUFFERS, size);
+}
+
+bool PersonalizationPlan::Prepare() {
+	Step step;
+	switch(job.type) {
+		case NFF_PERSO_ULTRALIGHT:
+		case NFF_PERSO_NTAG21X:
+			for(size_t offset = 0; offset < job.image.size(); offset += 4) {
+				step.address = job.start + offset / 4;
+				if(step.address > NFF_PERSO_MAX_PAGE) {
+					return false;
+				}
+				memset(step.data, 0, sizeof(step.data));
+				memcpy(step.data, job.image.data() + offset, std::min<size_t>(4, job.image.size() - offset));
+				steps.push_back(step);
+			}
+			break;
+
+		case NFF_PERSO_CLASSIC: {
+			uint32_t block = job.start;
+			for(size_t offset = 0; offset < job.image.size(); offset += 16) {
+				// Data blocks only
+				while(block <= NFF_PERSO_MAX_BLOCK && (!block || block == mifare_classic_sector_last_block(mifare_classic_block_sector(block)))) {
+					block++;
+				}
+				if(block > NFF_PERSO_MAX_BLOCK) {
+					return false;
+				}
+				step.address = block++;
+				memset(step.data, 0, sizeof(step.data));
+				memcpy(step.data, job.image.data() + offset, std::min<size_t>(16, job.image.size() - offset));
+				steps.push_back(step);
+			}
+			for(size_t i = 0; i < job.trailers.size(); i++) {
+				const PersonalizationTrailer &trailer = job.trailers[i];
+				if(trailer.sector > NFF_PERSO_MAX_SECTOR) {
+					return false;
+				}
+				MifareClassicBlock data;
+				mifare_classic_trailer_block(&data, trailer.keyA, trailer.access[0], trailer.access[1], trailer.access[2], trailer.access[3],
+					trailer.gpb, trailer.keyB);
+				step.address = mifare_classic_sector_last_block(trailer.sector);
+				memcpy(step.data, data, sizeof(data));
+				steps.push_back(step);
+			}
+
+			// One authentication per sector, its trailer written last
+			std::stable_sort(steps.begin(), steps.end(), [](const Step &a, const Step &b) {
+				return a.address < b.address;
+			});
+			break;
+		}
+
+		case NFF_PERSO_DESFIRE:
+			for(size_t i = 0; i < job.files.size(); i++) {
+				const PersonalizationFile &file = job.files[i];
+				if(!file.key.empty() && file.key.size() != 8 && file.key.size() != 16) {
+					return false;
+				}
+				MifareDESFireKey key = NULL;
+				if(file.key.size() == 8) {
+					key = mifare_desfire_des_key_new(reinterpret_cast<const uint8_t*>(file.key.data()));
+				}
+				else if(file.key.size() == 16) {
+					key = mifare_desfire_3des_key_new(reinterpret_cast<const uint8_t*>(file.key.data()));
+				}
+				keys.push_back(key);
+				step.address = i;
+				steps.push_back(step);
+			}
+			break;
+
+		default:
+			return false;
+	}
+
+	NativeMemory::Allocated(NFF_MEMORY_BUFFERS, steps.size() * sizeof(Step));
+	size += steps.size() * sizeof(Step);
+	return true;
+}
+
+bool PersonalizationPlan::Matches(MifareTag tag) const {
+	switch(freefare_get_tag_type(tag)) {
+		case ULTRALIGHT:
+		case ULTRALIGHT_C:
+			return job.type == NFF_PERSO_ULTRALIGHT;
+		case CLASSIC_1K:
+			return job.type == NFF_PERSO_CLASSIC && (steps.empty() || steps.back().address <= NFF_PERSO_1K_MAX_BLOCK);
+		case CLASSIC_4K:
+			return job.type == NFF_PERSO_CLASSIC;
+		case DESFIRE:
+			return job.type == NFF_PERSO_DESFIRE;
+		case NTAG_21x:
+			return job.type == NFF_PERSO_NTAG21X;
+		default:
+			return false;
+	}
+}
+
+size_t PersonalizationPlan::Steps() const {
+	return steps.size();
+}
+
+int PersonalizationPlan::Write(MifareTag tag, size_t *step) const {
+	*step = 0;
+	int error = 0;
+	switch(job.type) {
+		case NFF_PERSO_ULTRALIGHT:
+			if((error = mifare_ultralight_connect(tag)) < 0) {
+				return error;
+			}
+			for(; *step < steps.size() && error >= 0; (*step)++) {
+				error = mifare_ultralight_write(tag, steps[*step].address, steps[*step].data);
+			}
+			mifare_ultralight_disconnect(tag);
+			break;
+
+		case NFF_PERSO_NTAG21X:
+			if((error = ntag21x_connect(tag)) < 0) {
+				return error;
+			}
+			for(; *step < steps.size() && error >= 0; (*step)++) {
+				uint8_t data[4];
+				memcpy(data, steps[*step].data, sizeof(data));
+				error = ntag21x_write(tag, steps[*step].address, data);
+			}
+			ntag21x_disconnect(tag);
+			break;
+
+		case NFF_PERSO_CLASSIC:
+			return WriteClassic(tag, step);
+
+		case NFF_PERSO_DESFIRE:
+			return WriteDesfire(tag, step);
+	}
+
+	// Index of the failed write
+	if(error < 0) {
+		(*step)--;
+		return error;
+	}
+	return 0;
+}
+
+int PersonalizationPlan::WriteClassic(MifareTag tag, size_t *step) const {
+	int error = mifare_classic_connect(tag);
+	if(error < 0) {
+		return error;
+	}
+
+	// Authenticate again on each sector
+	int sector = -1;
+	for(; *step < steps.size(); (*step)++) {
+		const Step &write = steps[*step];
+		if(mifare_classic_block_sector(write.address) != sector) {
+			sector = mifare_classic_block_sector(write.address);
+			if((error = mifare_classic_authenticate(tag, write.address, job.key, job.keyType)) < 0) {
+				break;
+			}
+		}
+		MifareClassicBlock data;
+		memcpy(data, write.data, sizeof(data));
+		if((error = mifare_classic_write(tag, write.address, data)) < 0) {
+			break;
+		}
+	}
+	mifare_classic_disconnect(tag);
+	return error < 0 ? error : 0;
+}
+
+int PersonalizationPlan::WriteDesfire(MifareTag tag, size_t *step) const {
+	int error = mifare_desfire_connect(tag);
+	if(error < 0) {
+		return error;
+	}
+
+	// Select each application once for its consecutive files
+	bool selected = false;
+	uint32_t current = 0;
+	for(; *step < steps.size(); (*step)++) {
+		const PersonalizationFile &file = job.files[steps[*step].address];
+		if(!selected || file.aid != current) {
+			MifareDESFireAID aid = mifare_desfire_aid_new(file.aid);
+			error = mifare_desfire_select_application(tag, aid);
+			free(aid);
+			if(error < 0) {
+				break;
+			}
+			selected = true;
+			current = file.aid;
+		}
+		MifareDESFireKey key = keys[steps[*step].address];
+		if(key && (error = mifare_desfire_authenticate(tag, file.keyNo, key)) < 0) {
+			break;
+		}
+		ssize_t written = mifare_desfire_write_data(tag, file.file, file.offset, file.data.size(), file.data.data());
+		if(written < 0) {
+			error = written;
+			break;
+		}
+	}
+	mifare_desfire_disconnect(tag);
+	return error < 0 ? error : 0;
+}
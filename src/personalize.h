@@ -0,0 +1,110 @@
+#ifndef NFF_PERSONALIZE_H
+#define NFF_PERSONALIZE_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+
+/* Kind of tag a personalization job writes */
+#define NFF_PERSO_ULTRALIGHT 0
+#define NFF_PERSO_CLASSIC 1
+#define NFF_PERSO_DESFIRE 2
+#define NFF_PERSO_NTAG21X 3
+
+/**
+* Sector trailer written by a Classic job: keys, access conditions of the
+* blocks 0, 1, 2 and of the trailer (C1C2C3 as 3 bits values) and general
+* purpose byte, as mifare_classic_trailer_block()
+*/
+struct PersonalizationTrailer {
+	uint8_t sector;
+	MifareClassicKey keyA;
+	MifareClassicKey keyB;
+	uint8_t access[4];
+	uint8_t gpb;
+};
+
+/**
+* File written by a DESFire job, authenticated with keyNo and a DES (8 bytes)
+* or 3DES (16 bytes) key if one is given
+*/
+struct PersonalizationFile {
+	uint32_t aid;
+	uint8_t file;
+	uint8_t keyNo;
+	std::string key;
+	uint32_t offset;
+	std::string data;
+};
+
+/**
+* What to write on one card, as given by JS.
+* Ultralight and NTAG: image written from page start, the last page padded with 0
+* Classic: image written in the data blocks from block start, skipping the
+* manufacturer block and the sector trailers, then the trailers. Sectors are
+* authenticated with key and keyType.
+* DESFire: files
+*/
+struct PersonalizationJob {
+	int type;
+	uint32_t start;
+	std::string image;
+	MifareClassicKey key;
+	MifareClassicKeyType keyType;
+	std::vector<PersonalizationTrailer> trailers;
+	std::vector<PersonalizationFile> files;
+};
+
+
+
+/**
+* A job turned into the list of writes of one card. Prepare() runs on a pool
+* thread while the previous card is written: it lays out the image, builds
+* the sector trailers and the DESFire keys, so writing the card only sends
+* commands.
+*/
+class PersonalizationPlan {
+
+public:
+	explicit PersonalizationPlan(const PersonalizationJob &job);
+	~PersonalizationPlan();
+
+	// False if the job does not fit the tag type
+	bool Prepare();
+
+	// True if the plan can be written on the tag
+	bool Matches(MifareTag tag) const;
+
+	// Connect and write the tag, the index of the failed write is set on error
+	int Write(MifareTag tag, size_t *step) const;
+
+	size_t Steps() const;
+
+private:
+	int WriteClassic(MifareTag tag, size_t *step) const;
+	int WriteDesfire(MifareTag tag, size_t *step) const;
+
+	// Page or block and its data, or file index for DESFire
+	struct Step {
+		uint32_t address;
+		uint8_t data[16];
+	};
+
+	PersonalizationJob job;
+	std::vector<Step> steps;
+
+	// Keys of the DESFire files, NULL for no authentication
+	std::vector<MifareDESFireKey> keys;
+
+	// Bytes held, for the native memory accounting
+	size_t size;
+};
+
+
+#endif /* NFF_PERSONALIZE_H */
@@ -0,0 +1,52 @@
+#include "result_table.h"
+#include "endian.h"
+
+ResultTable::ResultTable(size_t count, size_t stride) : size(NFF_RESULT_TABLE_HEADER_SIZE + count * stride), stride(stride) {
+	data = (uint8_t*) calloc(size, 1);
+	if(data) {
+		NativeMemory::Allocated(NFF_MEMORY_BUFFERS, size);
+		uint32_t header[2] = { htole32((uint32_t) count), htole32((uint32_t) stride) };
+		memcpy(data, header, sizeof(header));
+	}
+}
+ResultTable::~ResultTable() {
+	if(data) {
+		free(data);
+		NativeMemory::Released(NFF_MEMORY_BUFFERS, size);
+	}
+}
+
+bool ResultTable::Valid() const {
+	return data != NULL;
+}
+
+uint8_t *ResultTable::Field(size_t record, size_t offset) {
+	return data + NFF_RESULT_TABLE_HEADER_SIZE + record * stride + offset;
+}
+
+void ResultTable::SetUint8(size_t record, size_t offset, uint8_t value) {
+	*Field(record, offset) = value;
+}
+
+void ResultTable::SetInt32(size_t record, size_t offset, int32_t value) {
+	SetUint32(record, offset, (uint32_t) value);
+}
+
+void ResultTable::SetUint32(size_t record, size_t offset, uint32_t value) {
+	value = htole32(value);
+	memcpy(Field(record, offset), &value, 4);
+}
+
+void ResultTable::SetBytes(size_t record, size_t offset, const uint8_t *bytes, size_t length) {
+	memcpy(Field(record, offset), bytes, length);
+}
+
+v8::Local<v8::Object> ResultTable::Release() {
+	if(!data) {
+		return Nan::NewBuffer(0).ToLocalChecked();
+	}
+	v8::Local<v8::Object> buffer = Nan::NewBuffer(reinterpret_cast<char*>(data), size).ToLocalChecked();
+	NativeMemory::Released(NFF_MEMORY_BUFFERS, size);
+	data = NULL;
+	return buffer;
+}
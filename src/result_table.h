@@ -0,0 +1,42 @@
+#ifndef NFF_RESULT_TABLE_H
+#define NFF_RESULT_TABLE_H
+
+#include <nan.h>
+
+#include "memory.h"
+
+// uint32 record count, uint32 record size
+#define NFF_RESULT_TABLE_HEADER_SIZE 8
+
+
+
+/**
+* Results of a batch operation as fixed size records in one buffer, little
+* endian, handed to JS as a single Buffer decoded lazily by a ResultView.
+*/
+class ResultTable {
+
+public:
+	ResultTable(size_t count, size_t stride);
+	~ResultTable();
+
+	bool Valid() const;
+
+	void SetUint8(size_t record, size_t offset, uint8_t value);
+	void SetInt32(size_t record, size_t offset, int32_t value);
+	void SetUint32(size_t record, size_t offset, uint32_t value);
+	void SetBytes(size_t record, size_t offset, const uint8_t *bytes, size_t length);
+
+	// Node takes ownership of the memory
+	v8::Local<v8::Object> Release();
+
+private:
+	uint8_t *Field(size_t record, size_t offset);
+
+	uint8_t *data;
+	size_t size;
+	size_t stride;
+};
+
+
+#endif /* NFF_RESULT_TABLE_H */
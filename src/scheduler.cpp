@@ -0,0 +1,641 @@
+#include "scheduler.h"
+#include "tag_session.h"
+#include "memory.h"
+
+#include <climits>
+#include <dlfcn.h>
+#include <algorithm>
+
+
+DeviceWorker::DeviceWorker(Nan::Callback *callback)
+: AsyncWorker(callback), callbackStart(0), callbackEnd(0), scheduler(NULL), owner(NULL), tagSession(NULL), generation(0), deviceError(0), rejectError(0), priority(NFF_PRIORITY_NORMAL), deadline(0), sequence(0), yielded(false) {
+	NativeMemory::Allocated(NFF_MEMORY_WORKERS, sizeof(DeviceWorker));
+}
+DeviceWorker::~DeviceWorker() {
+	NativeMemory::Released(NFF_MEMORY_WORKERS, sizeof(DeviceWorker));
+	for (size_t i = 0; i < waiters.size(); i++) {
+		delete waiters[i].callback;
+	}
+}
+
+void DeviceWorker::WorkComplete() {
+	AsyncWorker::WorkComplete();
+
+	// AsyncWorker::WorkComplete() releases the callback once called
+	for (size_t i = 0; i < waiters.size(); i++) {
+		callback = waiters[i].callback;
+		callbackStart = waiters[i].start;
+		callbackEnd = waiters[i].end;
+		AsyncWorker::WorkComplete();
+	}
+	waiters.clear();
+}
+
+void DeviceWorker::Reject(int error) {
+	Nan::HandleScope scope;
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(error)
+	};
+
+	if(callback) {
+		callback->Call(1, argv);
+	}
+	for (size_t i = 0; i < waiters.size(); i++) {
+		waiters[i].callback->Call(1, argv);
+	}
+}
+
+std::string DeviceWorker::Key() const {
+	return std::string();
+}
+
+bool DeviceWorker::Range(std::string *, uint32_t *, uint32_t *) const {
+	return false;
+}
+
+bool DeviceWorker::Extend(uint32_t, uint32_t) {
+	return false;
+}
+
+bool DeviceWorker::NeedsSession() const {
+	return true;
+}
+
+bool DeviceWorker::NeedsDevice() const {
+	return true;
+}
+
+bool DeviceWorker::KeepsCredential() const {
+	return false;
+}
+
+bool DeviceWorker::SelectsTarget() const {
+	return true;
+}
+
+void DeviceWorker::SetSession(TagSession *session) {
+	tagSession = session;
+}
+
+void DeviceWorker::SetUid(const std::string &uid) {
+	this->uid = uid;
+}
+
+void DeviceWorker::Attach(DeviceWorker *duplicate) {
+	if(duplicate->callback) {
+		Waiter waiter = {duplicate->callback, duplicate->callbackStart, duplicate->callbackEnd};
+		waiters.push_back(waiter);
+		duplicate->callback = NULL;
+	}
+	waiters.insert(waiters.end(), duplicate->waiters.begin(), duplicate->waiters.end());
+	duplicate->waiters.clear();
+}
+
+bool DeviceWorker::ShouldYield() {
+	return scheduler && scheduler->HasWaiting(priority);
+}
+
+void DeviceWorker::Yield() {
+	yielded = true;
+}
+
+
+
+Scheduler::Scheduler()
+: running(NULL), sequence(0), urgent(INT_MAX), limit(0), policy(NFF_QUEUE_REJECT_NEW), depthCallback(NULL), congested(false),
+  device(NULL), generation(1), activeSession(NULL), releasedTag(NULL), rejectTimer(NULL) {}
+Scheduler::~Scheduler() {
+	delete depthCallback;
+	FreeReleased(false);
+	for (size_t i = 0; i < rejected.size(); i++) {
+		rejected[i]->Destroy();
+	}
+	if(rejectTimer) {
+		uv_close(reinterpret_cast<uv_handle_t*>(rejectTimer), [](uv_handle_t *handle) {
+			delete reinterpret_cast<uv_timer_t*>(handle);
+		});
+	}
+}
+
+uint64_t Scheduler::Now() {
+	return uv_hrtime() / 1000000;
+}
+
+void Scheduler::Queue(DeviceWorker *worker, const void *owner, uint32_t generation, int priority, uint64_t deadline) {
+	worker->scheduler = this;
+	worker->owner = owner;
+	worker->generation = generation;
+	worker->priority = priority;
+	worker->deadline = deadline;
+	worker->sequence = sequence++;
+
+	if(Merge(worker)) {
+		worker->Destroy();
+		return;
+	}
+
+	if(policy == NFF_QUEUE_COALESCE) {
+		DeviceWorker *duplicate = FindDuplicate(worker);
+		if(duplicate) {
+			Elevate(duplicate, worker);
+			duplicate->Attach(worker);
+			worker->Destroy();
+			return;
+		}
+	}
+
+	// System workers like a reconnection are never shed
+	if(limit && priority > NFF_PRIORITY_SYSTEM && waiting.size() >= limit) {
+		DeviceWorker *oldest = (policy == NFF_QUEUE_DROP_OLDEST) ? FindOldest(priority) : NULL;
+		if(!oldest) {
+			RejectLater(worker, NFF_ERROR_QUEUE_FULL);
+			return;
+		}
+		Remove(oldest);
+		RejectLater(oldest, NFF_ERROR_QUEUE_DROPPED);
+	}
+
+	Push(worker);
+	Next();
+	Signal();
+}
+
+void Scheduler::SetLimit(size_t limit, int policy) {
+	this->limit = limit;
+	this->policy = policy;
+	Signal();
+}
+
+void Scheduler::SetDepthCallback(Nan::Callback *callback) {
+	delete depthCallback;
+	depthCallback = callback;
+}
+
+void Scheduler::SetDevice(nfc_device **device, std::function<void(int)> onError) {
+	this->device = device;
+	this->onError = onError;
+}
+
+uint32_t Scheduler::Generation() {
+	return generation;
+}
+
+void Scheduler::NextGeneration() {
+	generation++;
+
+	// The device was reopened, its targets are gone
+	std::lock_guard<std::mutex> lock(targetLock);
+	if(activeSession) {
+		activeSession->Forget();
+		activeSession = NULL;
+	}
+	FreeReleased(false);
+}
+
+bool Scheduler::Release(TagSession *session, MifareTag tag) {
+	std::lock_guard<std::mutex> lock(targetLock);
+	if(session != activeSession) {
+		return false;
+	}
+	activeSession = NULL;
+	if(!session->IsConnected()) {
+		return false;
+	}
+	releasedTag = tag;
+	return true;
+}
+
+/**
+* Selecting another tag, listing tags or reopening the device deselects the
+* current target: its session is disconnected first, or forgotten if the
+* device is closed
+*/
+void Scheduler::Select(DeviceWorker *worker) {
+	if(!worker->tagSession && !worker->SelectsTarget()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(targetLock);
+	if(worker->tagSession && worker->tagSession == activeSession) {
+		return;
+	}
+
+	bool open = !device || *device;
+	FreeReleased(open);
+	if(activeSession) {
+		if(open) {
+			activeSession->Lost();
+		}
+		else {
+			activeSession->Forget();
+		}
+	}
+	activeSession = worker->tagSession;
+}
+
+void Scheduler::FreeReleased(bool disconnect) {
+	if(!releasedTag) {
+		return;
+	}
+	if(disconnect) {
+		TagSession::DisconnectTag(releasedTag);
+	}
+	freefare_free_tag(releasedTag);
+	NativeMemory::Released(NFF_MEMORY_TAGS, NFF_MEMORY_TAG_SIZE);
+	releasedTag = NULL;
+}
+
+size_t Scheduler::Depth() {
+	return waiting.size() + (running ? 1 : 0);
+}
+
+bool Scheduler::IsIdle(const void *owner) {
+	if(running && running->owner == owner) {
+		return false;
+	}
+	for (size_t i = 0; i < waiting.size(); i++) {
+		if(waiting[i]->owner == owner) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Scheduler::HasWaiting(int priority) {
+	return urgent.load() < priority;
+}
+
+bool Scheduler::RunsAfter(const DeviceWorker *a, const DeviceWorker *b) {
+	if(a->priority != b->priority) {
+		return a->priority > b->priority;
+	}
+	if(a->deadline != b->deadline) {
+		// No deadline runs after any deadline
+		if(!a->deadline) return true;
+		if(!b->deadline) return false;
+		return a->deadline > b->deadline;
+	}
+	return a->sequence > b->sequence;
+}
+
+void Scheduler::Push(DeviceWorker *worker) {
+	waiting.push_back(worker);
+	Inherit(worker->owner);
+	std::make_heap(waiting.begin(), waiting.end(), Scheduler::RunsAfter);
+	urgent = waiting.front()->priority;
+}
+
+/**
+* Priorities only order the workers of different owners: a waiting worker
+* takes the priority class and deadline of a more urgent worker of its owner
+* queued after it, so the workers of an owner still run in submission order
+*/
+void Scheduler::Inherit(const void *owner) {
+	std::vector<DeviceWorker*> owned;
+	for (size_t i = 0; i < waiting.size(); i++) {
+		if(waiting[i]->owner == owner) {
+			owned.push_back(waiting[i]);
+		}
+	}
+	std::sort(owned.begin(), owned.end(), [](const DeviceWorker *a, const DeviceWorker *b) {
+		return a->sequence > b->sequence;
+	});
+
+	for (size_t i = 1; i < owned.size(); i++) {
+		if(RunsAfter(owned[i], owned[i - 1])) {
+			owned[i]->priority = owned[i - 1]->priority;
+			owned[i]->deadline = owned[i - 1]->deadline;
+		}
+	}
+}
+
+void Scheduler::DropClaimed(const std::string &uid) {
+	if(uid.empty()) {
+		return;
+	}
+
+	std::vector<DeviceWorker*> dropped;
+	for (size_t i = 0; i < waiting.size(); i++) {
+		if(waiting[i]->uid == uid) {
+			dropped.push_back(waiting[i]);
+		}
+	}
+	for (size_t i = 0; i < dropped.size(); i++) {
+		Remove(dropped[i]);
+		RejectLater(dropped[i], NFF_ERROR_TAG_CLAIMED);
+	}
+	if(!dropped.empty()) {
+		Signal();
+	}
+}
+
+/**
+* Reject a worker on the next loop iteration, so a JS call queueing it never
+* sees its callback called before it returned
+*/
+void Scheduler::RejectLater(DeviceWorker *worker, int error) {
+	if(!rejectTimer) {
+		rejectTimer = new uv_timer_t;
+		uv_timer_init(uv_default_loop(), rejectTimer);
+		rejectTimer->data = this;
+	}
+
+	worker->rejectError = error;
+	rejected.push_back(worker);
+	uv_timer_start(rejectTimer, Scheduler::OnRejectTimer, 0, 0);
+}
+
+void Scheduler::OnRejectTimer(uv_timer_t *timer) {
+	Scheduler *scheduler = static_cast<Scheduler*>(timer->data);
+
+	// Callbacks may queue and reject other workers
+	std::vector<DeviceWorker*> rejected;
+	rejected.swap(scheduler->rejected);
+	for (size_t i = 0; i < rejected.size(); i++) {
+		rejected[i]->Reject(rejected[i]->rejectError);
+		rejected[i]->Destroy();
+	}
+}
+
+void Scheduler::Remove(DeviceWorker *worker) {
+	waiting.erase(std::find(waiting.begin(), waiting.end(), worker));
+	std::make_heap(waiting.begin(), waiting.end(), Scheduler::RunsAfter);
+	urgent = waiting.empty() ? INT_MAX : waiting.front()->priority;
+}
+
+static bool isRead(const DeviceWorker *worker) {
+	std::string space;
+	uint32_t start, end;
+	return !worker->Key().empty() || worker->Range(&space, &start, &end);
+}
+
+/**
+* Merge a range read into the latest waiting read of the same owner and
+* address space, or into the running one, if no worker of that owner which
+* may change the tag state is waiting before it
+*/
+bool Scheduler::Merge(DeviceWorker *worker) {
+	std::string space;
+	if(!worker->Range(&space, &worker->callbackStart, &worker->callbackEnd)) {
+		return false;
+	}
+	uint32_t start = worker->callbackStart;
+	uint32_t end = worker->callbackEnd;
+
+	DeviceWorker *target = NULL;
+	uint64_t barrier = 0;
+	bool hasBarrier = false;
+	for (size_t i = 0; i < waiting.size(); i++) {
+		DeviceWorker *candidate = waiting[i];
+		if(candidate->owner != worker->owner) {
+			continue;
+		}
+
+		std::string candidateSpace;
+		uint32_t candidateStart, candidateEnd;
+		if(!isRead(candidate)) {
+			if(!hasBarrier || barrier < candidate->sequence) {
+				barrier = candidate->sequence;
+				hasBarrier = true;
+			}
+		}
+		else if(candidate->Range(&candidateSpace, &candidateStart, &candidateEnd) && candidateSpace == space
+		&& candidateStart <= end && start <= candidateEnd && (!target || target->sequence < candidate->sequence)) {
+			target = candidate;
+		}
+	}
+	if(target && hasBarrier && barrier > target->sequence) {
+		target = NULL;
+	}
+
+	if(target) {
+		uint32_t targetStart, targetEnd;
+		target->Range(&space, &targetStart, &targetEnd);
+		if((start < targetStart || end > targetEnd)
+		&& !target->Extend(std::min(start, targetStart), std::max(end, targetEnd))) {
+			return false;
+		}
+
+		// The merged read runs as early as the most urgent of its requests
+		Elevate(target, worker);
+		target->Attach(worker);
+		return true;
+	}
+
+	// The running read can only serve ranges it already covers
+	std::string runningSpace;
+	uint32_t runningStart, runningEnd;
+	if(!hasBarrier && running && running->owner == worker->owner
+	&& running->Range(&runningSpace, &runningStart, &runningEnd) && runningSpace == space
+	&& runningStart <= start && end <= runningEnd) {
+		running->Attach(worker);
+		return true;
+	}
+
+	return false;
+}
+
+void Scheduler::Elevate(DeviceWorker *target, const DeviceWorker *worker) {
+	if(worker->priority < target->priority
+	|| (worker->priority == target->priority && worker->deadline && (!target->deadline || worker->deadline < target->deadline))) {
+		target->priority = worker->priority;
+		target->deadline = worker->deadline;
+		Inherit(target->owner);
+		std::make_heap(waiting.begin(), waiting.end(), Scheduler::RunsAfter);
+		urgent = waiting.front()->priority;
+	}
+}
+
+/**
+* Latest waiting worker of the same owner with the same key, if no worker of
+* that owner which may change the tag state was queued after it
+*/
+DeviceWorker* Scheduler::FindDuplicate(DeviceWorker *worker) {
+	std::string key = worker->Key();
+	if(key.empty()) {
+		return NULL;
+	}
+
+	DeviceWorker *duplicate = NULL;
+	uint64_t barrier = 0;
+	bool hasBarrier = false;
+	for (size_t i = 0; i < waiting.size(); i++) {
+		DeviceWorker *candidate = waiting[i];
+		if(candidate->owner != worker->owner) {
+			continue;
+		}
+
+		std::string candidateKey = candidate->Key();
+		if(!isRead(candidate)) {
+			if(!hasBarrier || barrier < candidate->sequence) {
+				barrier = candidate->sequence;
+				hasBarrier = true;
+			}
+		}
+		else if(candidateKey == key && (!duplicate || duplicate->sequence < candidate->sequence)) {
+			duplicate = candidate;
+		}
+	}
+
+	if(duplicate && hasBarrier && barrier > duplicate->sequence) {
+		return NULL;
+	}
+	return duplicate;
+}
+
+/**
+* Oldest waiting worker that is not more urgent than the given priority class,
+* taken from the least urgent class
+*/
+DeviceWorker* Scheduler::FindOldest(int priority) {
+	DeviceWorker *oldest = NULL;
+	for (size_t i = 0; i < waiting.size(); i++) {
+		DeviceWorker *candidate = waiting[i];
+		if(candidate->priority < priority) {
+			continue;
+		}
+		if(!oldest || candidate->priority > oldest->priority
+		|| (candidate->priority == oldest->priority && candidate->sequence < oldest->sequence)) {
+			oldest = candidate;
+		}
+	}
+	return oldest;
+}
+
+/**
+* Tell JS when the queue becomes full, then when it drains to half its limit
+*/
+void Scheduler::Signal() {
+	if(!depthCallback) {
+		return;
+	}
+
+	bool state = congested;
+	if(!limit) {
+		state = false;
+	}
+	else if(waiting.size() >= limit) {
+		state = true;
+	}
+	else if(waiting.size() <= limit / 2) {
+		state = false;
+	}
+	if(state == congested) {
+		return;
+	}
+	congested = state;
+
+	Nan::HandleScope scope;
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(Depth()),
+		Nan::New<v8::Boolean>(congested)
+	};
+	depthCallback->Call(2, argv);
+}
+
+void Scheduler::Next() {
+	while(!running && !waiting.empty()) {
+		std::pop_heap(waiting.begin(), waiting.end(), Scheduler::RunsAfter);
+		DeviceWorker *worker = waiting.back();
+		waiting.pop_back();
+		urgent = waiting.empty() ? INT_MAX : waiting.front()->priority;
+
+		// Tags found before the device was reopened are gone
+		if(worker->generation && worker->generation != generation) {
+			RejectLater(worker, NFF_ERROR_DEVICE_RESET);
+			continue;
+		}
+		running = worker;
+	}
+	if(!running) {
+		return;
+	}
+
+	uv_queue_work(uv_default_loop(), &running->request, Scheduler::Execute, Scheduler::Complete);
+}
+
+ThreadPolicy* Scheduler::GetThreadPolicy() {
+	return &threadPolicy;
+}
+
+void Scheduler::Execute(uv_work_t* req) {
+	DeviceWorker *worker = static_cast<DeviceWorker*>(static_cast<Nan::AsyncWorker*>(req->data));
+	Scheduler *scheduler = worker->scheduler;
+
+	// The pool thread takes the device policy for the time of the worker, a
+	// copy is applied as the worker may change the policy of the device
+	ThreadPolicy policy = scheduler->threadPolicy;
+	bool applied = policy.enabled && !policy.Apply();
+
+	scheduler->Select(worker);
+
+	// The device is not open, or was lost and not reopened
+	worker->rejectError = 0;
+	if(scheduler->device && !*scheduler->device && worker->NeedsDevice()) {
+		worker->rejectError = NFF_ERROR_OPEN_DEVICE;
+	}
+	else if(worker->tagSession && worker->NeedsSession()) {
+		int error = worker->tagSession->Connect();
+		worker->rejectError = (error < 0) ? error : 0;
+	}
+
+	// Workers may authenticate otherwise, or leave the tag halted
+	if(worker->tagSession && !worker->KeepsCredential()) {
+		worker->tagSession->SetCredential(std::string());
+	}
+
+	if(!worker->rejectError) {
+		worker->Execute();
+	}
+
+	if(applied) {
+		policy.Restore();
+	}
+
+	if(scheduler->device && *scheduler->device) {
+		worker->deviceError = nfc_device_get_last_error(*scheduler->device);
+	}
+
+	// The tag left the field
+	if(worker->tagSession && (worker->deviceError == NFC_ETGRELEASED || worker->deviceError == NFC_ERFTRANS)) {
+		worker->tagSession->Lost();
+	}
+
+	// Random bytes drawn by this thread are only traced on the device of a running worker
+	static void (*endTrace)() = reinterpret_cast<void (*)()>(dlsym(RTLD_DEFAULT, "nfc_trace_end_sequence"));
+	if(endTrace) {
+		endTrace();
+	}
+}
+
+void Scheduler::Complete(uv_work_t* req, int status) {
+	DeviceWorker *worker = static_cast<DeviceWorker*>(static_cast<Nan::AsyncWorker*>(req->data));
+	Scheduler *scheduler = worker->scheduler;
+	scheduler->running = NULL;
+	int deviceError = worker->deviceError;
+
+	if(worker->yielded) {
+		// Requeue with its original sequence, ahead of later workers of its class
+		worker->yielded = false;
+		scheduler->Push(worker);
+	}
+	else if(worker->rejectError) {
+		worker->Reject(worker->rejectError);
+		worker->Destroy();
+	}
+	else {
+		worker->WorkComplete();
+		worker->Destroy();
+	}
+
+	if(deviceError && scheduler->onError) {
+		scheduler->onError(deviceError);
+	}
+
+	// Buffers allocated or released by the worker thread
+	NativeMemory::Report();
+
+	scheduler->Next();
+	scheduler->Signal();
+}
@@ -0,0 +1,252 @@
+#ifndef NFF_SCHEDULER_H
+#define NFF_SCHEDULER_H
+
+#include <nan.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+#include "thread_policy.h"
+
+/* Priority classes, lower runs first */
+#define NFF_PRIORITY_SYSTEM -1
+#define NFF_PRIORITY_INTERACTIVE 0
+#define NFF_PRIORITY_NORMAL 1
+#define NFF_PRIORITY_BULK 2
+
+/* What to do with a new worker when the queue is full */
+#define NFF_QUEUE_REJECT_NEW 0
+#define NFF_QUEUE_DROP_OLDEST 1
+#define NFF_QUEUE_COALESCE 2
+
+class Scheduler;
+class TagSession;
+
+
+
+/**
+* Base class of the workers executed by a device scheduler.
+* Batch workers can check ShouldYield() between two steps and call Yield()
+* before returning from Execute() to be requeued behind more urgent workers.
+* Workers without side effects can return a Key() so duplicates are merged:
+* their HandleOKCallback() is then called once per waiting callback.
+* Reads of an address range return a Range() instead, reads covered by a
+* waiting or running read of the same tag are merged into it, and overlapping
+* waiting reads are merged if the worker can Extend() its range. Their
+* HandleOKCallback() gives each callback its callbackStart/callbackEnd slice.
+*/
+class DeviceWorker : public Nan::AsyncWorker {
+
+public:
+	explicit DeviceWorker(Nan::Callback *callback);
+	virtual ~DeviceWorker();
+
+	void WorkComplete();
+
+	// Complete without executing, with the given error
+	void Reject(int error);
+
+	// Identify the request for coalescing, empty if it can not be coalesced
+	virtual std::string Key() const;
+
+	// Range [start, end) of the address space read by the worker, false if none
+	virtual bool Range(std::string *space, uint32_t *start, uint32_t *end) const;
+
+	// Grow the range of a waiting worker, false if it can not
+	virtual bool Extend(uint32_t start, uint32_t end);
+
+	// Connect the tag session lazily before Execute(), false for workers managing it
+	virtual bool NeedsSession() const;
+
+	// Rejected while the device is closed, false for workers opening or closing it
+	virtual bool NeedsDevice() const;
+
+	// Plain reads keep the authentication of the tag, any other worker drops its credential
+	virtual bool KeepsCredential() const;
+
+	// Workers without a tag session may select other targets, false for workers not talking to tags
+	virtual bool SelectsTarget() const;
+	void SetSession(TagSession *session);
+	void SetUid(const std::string &uid);
+
+protected:
+	// True when a worker of a more urgent priority class is waiting
+	bool ShouldYield();
+
+	// Stop after the current step, Execute() will be called again later
+	void Yield();
+
+	// Range requested by the callback being called
+	uint32_t callbackStart;
+	uint32_t callbackEnd;
+
+private:
+	friend class Scheduler;
+
+	// Take over the callbacks of a duplicate worker
+	void Attach(DeviceWorker *duplicate);
+
+	Scheduler *scheduler;
+
+	// Tag or device the worker was queued for
+	const void *owner;
+
+	// Connection state of the tag the worker was queued for, or NULL
+	TagSession *tagSession;
+
+	// UID of the tag the worker was queued for, empty for device workers
+	std::string uid;
+
+	// Device generation the worker is bound to (0 for any)
+	uint32_t generation;
+
+	// LibNFC error left on the device by Execute()
+	int deviceError;
+
+	// Closed device, error of the lazy tag connection or queue rejection, the worker is rejected with it instead of executed
+	int rejectError;
+
+	// Callbacks of coalesced duplicates, with the range they requested
+	struct Waiter {
+		Nan::Callback *callback;
+		uint32_t start;
+		uint32_t end;
+	};
+	std::vector<Waiter> waiters;
+
+	// Scheduling keys
+	int priority;
+	uint64_t deadline;
+	uint64_t sequence;
+
+	bool yielded;
+};
+
+
+
+/**
+* Per-device queue of workers. Only one worker of a device runs at a time,
+* the next one is chosen by priority class, then earliest deadline, then
+* submission order. Workers of the same tag or device run in submission
+* order, a worker running as early as the most urgent one queued after it. The number of waiting workers can be bounded, extra
+* workers being rejected or shed according to the queue policy.
+*/
+class Scheduler {
+
+public:
+	Scheduler();
+	~Scheduler();
+
+	// Queue a worker, deadline is an absolute time in ms (0 for none)
+	void Queue(DeviceWorker *worker, const void *owner, uint32_t generation, int priority, uint64_t deadline);
+
+	// Device checked after each worker, onError is called on the main thread
+	// when a worker leaves it in error
+	void SetDevice(nfc_device **device, std::function<void(int)> onError);
+
+	// Generation of the device, workers bound to a previous one are rejected
+	uint32_t Generation();
+	void NextGeneration();
+
+	// Bound the number of waiting workers (0 for no limit)
+	void SetLimit(size_t limit, int policy);
+
+	// Called with (depth, congested) when the queue becomes full or drains to half its limit
+	void SetDepthCallback(Nan::Callback *callback);
+
+	// Number of waiting and running workers
+	size_t Depth();
+
+	// True if no worker of the owner is waiting or running
+	bool IsIdle(const void *owner);
+
+	// Thread safe: true if a worker more urgent than the given priority is waiting
+	bool HasWaiting(int priority);
+
+	// A tag object is destroyed: true if the scheduler took over its connected tag,
+	// which is disconnected and freed before the device selects another target
+	bool Release(TagSession *session, MifareTag tag);
+
+	// Another device claimed the tag: its waiting workers fail with NFF_ERROR_TAG_CLAIMED
+	void DropClaimed(const std::string &uid);
+
+	// Complete a worker with the given error on the next loop iteration, instead of executing it
+	void RejectLater(DeviceWorker *worker, int error);
+
+	// Current time in ms, on the deadline clock
+	static uint64_t Now();
+
+	// Policy of the threads running the workers, only used from Execute() of workers
+	ThreadPolicy* GetThreadPolicy();
+
+private:
+	static void Execute(uv_work_t* req);
+	static void Complete(uv_work_t* req, int status);
+	static bool RunsAfter(const DeviceWorker *a, const DeviceWorker *b);
+	static void OnRejectTimer(uv_timer_t *timer);
+
+	void Push(DeviceWorker *worker);
+	void Inherit(const void *owner);
+	void Remove(DeviceWorker *worker);
+	void Next();
+	void Signal();
+
+	// Make the session of the worker the selected target of the device
+	void Select(DeviceWorker *worker);
+	void FreeReleased(bool disconnect);
+
+	bool Merge(DeviceWorker *worker);
+	DeviceWorker* FindDuplicate(DeviceWorker *worker);
+
+	// Run a waiting worker as early as a request merged into it
+	void Elevate(DeviceWorker *target, const DeviceWorker *worker);
+	DeviceWorker* FindOldest(int priority);
+
+	// Waiting workers, as a heap
+	std::vector<DeviceWorker*> waiting;
+
+	// Worker being executed or NULL
+	DeviceWorker *running;
+
+	uint64_t sequence;
+
+	// Most urgent waiting priority, read from worker threads
+	std::atomic<int> urgent;
+
+	// Queue bound and policy
+	size_t limit;
+	int policy;
+
+	// Backpressure signal
+	Nan::Callback *depthCallback;
+	bool congested;
+
+	// Device health
+	nfc_device **device;
+	std::function<void(int)> onError;
+	uint32_t generation;
+
+	// LibNFC has one target per device: the tag session it has selected, and a
+	// connected tag whose object was destroyed. Locked as tags are released from JS.
+	std::mutex targetLock;
+	TagSession *activeSession;
+	MifareTag releasedTag;
+
+	// Workers rejected from a JS call, completed by the timer
+	std::vector<DeviceWorker*> rejected;
+	uv_timer_t *rejectTimer;
+
+	// CPU set and scheduling class of the worker threads
+	ThreadPolicy threadPolicy;
+};
+
+
+#endif /* NFF_SCHEDULER_H */
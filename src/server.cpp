@@ -0,0 +1,556 @@
+#include "server.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+#include "endian.h"
+#include "memory.h"
+
+using namespace Nan;
+
+
+
+/**
+* Connection of a client to a ReaderServer
+*/
+struct ReaderConnection {
+	uv_pipe_t pipe;
+	ReaderServer *server;
+	uint32_t id;
+
+	// Incomplete frame
+	std::string input;
+
+	// Shared ring, data starts after the header
+	std::string shmName;
+	uint8_t *ring;
+	size_t ringSize;
+
+	// Next write position in the ring and bytes written since the start (wraps)
+	size_t position;
+	uint32_t written;
+};
+
+struct FrameWrite {
+	uv_write_t request;
+	char *data;
+};
+
+static void allocBuffer(uv_handle_t *handle, size_t suggested, uv_buf_t *buf) {
+	buf->base = (char*) malloc(suggested);
+	buf->len = buf->base ? suggested : 0;
+}
+
+static void afterWrite(uv_write_t *request, int status) {
+	FrameWrite *write = reinterpret_cast<FrameWrite*>(request);
+	free(write->data);
+	delete write;
+}
+
+static void writeFrame(uv_stream_t *stream, uint32_t id, uint8_t kind, const char *head, size_t headLength, const char *body, size_t length) {
+	FrameWrite *write = new FrameWrite;
+	size_t size = NFF_FRAME_HEADER_SIZE + headLength + length;
+	write->data = (char*) malloc(size);
+	if(!write->data) {
+		delete write;
+		return;
+	}
+
+	uint32_t value = htole32(headLength + length);
+	memcpy(write->data, &value, 4);
+	value = htole32(id);
+	memcpy(write->data + 4, &value, 4);
+	write->data[8] = kind;
+	if(headLength) {
+		memcpy(write->data + NFF_FRAME_HEADER_SIZE, head, headLength);
+	}
+	if(length) {
+		memcpy(write->data + NFF_FRAME_HEADER_SIZE + headLength, body, length);
+	}
+
+	uv_buf_t buf = uv_buf_init(write->data, size);
+	uv_write(&write->request, stream, &buf, 1, afterWrite);
+}
+
+// Release counter of a ring, updated by the client once a payload is copied
+static std::atomic<uint32_t>* ringReleased(uint8_t *ring) {
+	return reinterpret_cast<std::atomic<uint32_t>*>(ring);
+}
+
+static uint32_t readUint32(const char *data) {
+	uint32_t value;
+	memcpy(&value, data, 4);
+	return le32toh(value);
+}
+
+
+
+/**
+* Server
+*/
+ReaderServer::ReaderServer(size_t ringSize, size_t threshold) : listening(false), nextConnection(1), ringSize(ringSize), threshold(threshold),
+  requestCallback(NULL), disconnectCallback(NULL) {}
+ReaderServer::~ReaderServer() {
+	delete requestCallback;
+	delete disconnectCallback;
+}
+
+NAN_MODULE_INIT(ReaderServer::Init) {
+	v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(ReaderServer::New);
+	tpl->SetClassName(Nan::New("ReaderServer").ToLocalChecked());
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+	Nan::SetPrototypeMethod(tpl, "listen", ReaderServer::Listen);
+	Nan::SetPrototypeMethod(tpl, "reply", ReaderServer::Reply);
+	Nan::SetPrototypeMethod(tpl, "close", ReaderServer::Close);
+
+	constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+	Nan::Set(target, Nan::New("ReaderServer").ToLocalChecked(),
+	Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+Nan::Persistent<v8::Function> & ReaderServer::constructor() {
+	static Nan::Persistent<v8::Function> my_constructor;
+	return my_constructor;
+}
+
+NAN_METHOD(ReaderServer::New) {
+	if (info.IsConstructCall()) {
+		ReaderServer *obj = new ReaderServer(info[0]->Uint32Value(), info[1]->Uint32Value());
+		obj->Wrap(info.This());
+		info.GetReturnValue().Set(info.This());
+	} else {
+		const int argc = 2;
+		v8::Local<v8::Value> argv[argc] = {info[0], info[1]};
+		v8::Local<v8::Function> cons = Nan::New(constructor());
+		info.GetReturnValue().Set(Nan::NewInstance(cons, argc, argv).ToLocalChecked());
+	}
+}
+
+/**
+* Listen on a socket path, returns 0 or a libuv error
+*/
+NAN_METHOD(ReaderServer::Listen) {
+	ReaderServer* obj = ObjectWrap::Unwrap<ReaderServer>(info.This());
+
+	std::string path = std::string(*v8::String::Utf8Value(info[0]->ToString()));
+	if(obj->listening) {
+		info.GetReturnValue().Set(Nan::New<v8::Number>(UV_EINVAL));
+		return;
+	}
+
+	uv_pipe_init(uv_default_loop(), &obj->pipe, 0);
+	obj->pipe.data = obj;
+	int error = uv_pipe_bind(&obj->pipe, path.c_str());
+	if(!error) {
+		error = uv_listen(reinterpret_cast<uv_stream_t*>(&obj->pipe), 128, ReaderServer::OnConnection);
+	}
+	if(error) {
+		uv_close(reinterpret_cast<uv_handle_t*>(&obj->pipe), NULL);
+		info.GetReturnValue().Set(Nan::New<v8::Number>(error));
+		return;
+	}
+
+	delete obj->requestCallback;
+	delete obj->disconnectCallback;
+	obj->requestCallback = new Callback(info[1].As<v8::Function>());
+	obj->disconnectCallback = new Callback(info[2].As<v8::Function>());
+
+	// Stay alive as long as we listen
+	obj->listening = true;
+	obj->Ref();
+
+	info.GetReturnValue().Set(Nan::New<v8::Number>(0));
+}
+
+static void onConnectionRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void onConnectionClose(uv_handle_t *handle) {
+	ReaderConnection *connection = static_cast<ReaderConnection*>(handle->data);
+	if(connection->ring) {
+		munmap(connection->ring, NFF_SHM_HEADER_SIZE + connection->ringSize);
+		NativeMemory::Released(NFF_MEMORY_SHARED, NFF_SHM_HEADER_SIZE + connection->ringSize);
+		shm_unlink(connection->shmName.c_str());
+	}
+	connection->server->Disconnected(connection);
+	delete connection;
+}
+
+static void closeConnection(ReaderConnection *connection) {
+	if(!uv_is_closing(reinterpret_cast<uv_handle_t*>(&connection->pipe))) {
+		uv_close(reinterpret_cast<uv_handle_t*>(&connection->pipe), onConnectionClose);
+	}
+}
+
+void ReaderServer::OnConnection(uv_stream_t *stream, int status) {
+	ReaderServer *server = static_cast<ReaderServer*>(stream->data);
+	if(status < 0) {
+		return;
+	}
+
+	ReaderConnection *connection = new ReaderConnection();
+	connection->server = server;
+	connection->id = server->nextConnection++;
+	connection->ring = NULL;
+	connection->ringSize = 0;
+	connection->position = 0;
+	connection->written = 0;
+
+	uv_pipe_init(uv_default_loop(), &connection->pipe, 0);
+	connection->pipe.data = connection;
+	if(uv_accept(stream, reinterpret_cast<uv_stream_t*>(&connection->pipe))) {
+		// libuv uses the handle until it is closed
+		uv_close(reinterpret_cast<uv_handle_t*>(&connection->pipe), [](uv_handle_t *handle) {
+			delete static_cast<ReaderConnection*>(handle->data);
+		});
+		return;
+	}
+	server->connections[connection->id] = connection;
+
+	// Shared ring for large payloads, replies go through the socket without it
+	if(server->ringSize) {
+		connection->shmName = "/nff-" + std::to_string(getpid()) + "-" + std::to_string(connection->id);
+		int fd = shm_open(connection->shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if(fd >= 0) {
+			if(!ftruncate(fd, NFF_SHM_HEADER_SIZE + server->ringSize)) {
+				void *ring = mmap(NULL, NFF_SHM_HEADER_SIZE + server->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if(ring != MAP_FAILED) {
+					connection->ring = static_cast<uint8_t*>(ring);
+					connection->ringSize = server->ringSize;
+					new (connection->ring) std::atomic<uint32_t>(0);
+					NativeMemory::Allocated(NFF_MEMORY_SHARED, NFF_SHM_HEADER_SIZE + connection->ringSize);
+				}
+			}
+			close(fd);
+			if(!connection->ring) {
+				shm_unlink(connection->shmName.c_str());
+			}
+		}
+	}
+
+	uint32_t size = htole32(connection->ringSize);
+	std::string name = connection->ring ? connection->shmName : "";
+	writeFrame(reinterpret_cast<uv_stream_t*>(&connection->pipe), 0, NFF_FRAME_HELLO, reinterpret_cast<char*>(&size), 4, name.data(), name.size());
+
+	uv_read_start(reinterpret_cast<uv_stream_t*>(&connection->pipe), allocBuffer, onConnectionRead);
+}
+
+static void onConnectionRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+	ReaderConnection *connection = static_cast<ReaderConnection*>(stream->data);
+
+	if(nread < 0) {
+		free(buf->base);
+		closeConnection(connection);
+		return;
+	}
+	connection->input.append(buf->base, nread);
+	free(buf->base);
+
+	size_t start = 0;
+	while(connection->input.size() - start >= NFF_FRAME_HEADER_SIZE) {
+		const char *frame = connection->input.data() + start;
+		uint32_t length = readUint32(frame);
+		if(length > NFF_FRAME_MAX_SIZE || frame[8] != NFF_FRAME_REQUEST) {
+			closeConnection(connection);
+			return;
+		}
+		if(connection->input.size() - start < NFF_FRAME_HEADER_SIZE + length) {
+			break;
+		}
+		connection->server->Request(connection, readUint32(frame + 4), frame + NFF_FRAME_HEADER_SIZE, length);
+		start += NFF_FRAME_HEADER_SIZE + length;
+	}
+	connection->input.erase(0, start);
+}
+
+void ReaderServer::Request(ReaderConnection *connection, uint32_t id, const char *payload, size_t length) {
+	Nan::HandleScope scope;
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(connection->id),
+		Nan::New<v8::Number>(id),
+		Nan::CopyBuffer(payload, length).ToLocalChecked()
+	};
+
+	requestCallback->Call(3, argv);
+}
+
+void ReaderServer::Disconnected(ReaderConnection *connection) {
+	connections.erase(connection->id);
+	if(!listening) {
+		return;
+	}
+	Nan::HandleScope scope;
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(connection->id)
+	};
+
+	disconnectCallback->Call(1, argv);
+}
+
+/**
+* Reply to a request: connection, request id, status, optional payload
+*/
+NAN_METHOD(ReaderServer::Reply) {
+	ReaderServer* obj = ObjectWrap::Unwrap<ReaderServer>(info.This());
+
+	std::map<uint32_t, ReaderConnection*>::iterator it = obj->connections.find(info[0]->Uint32Value());
+	if(it == obj->connections.end()) {
+		return;
+	}
+	ReaderConnection *connection = it->second;
+	uv_stream_t *stream = reinterpret_cast<uv_stream_t*>(&connection->pipe);
+
+	uint32_t id = info[1]->Uint32Value();
+	int32_t status = htole32(info[2]->Int32Value());
+	const char *data = NULL;
+	size_t length = 0;
+	if(node::Buffer::HasInstance(info[3])) {
+		data = node::Buffer::Data(info[3]);
+		length = node::Buffer::Length(info[3]);
+	}
+
+	// Large payloads go through the ring when it has room
+	if(connection->ring && length >= obj->threshold && length <= connection->ringSize) {
+		uint32_t used = connection->written - ringReleased(connection->ring)->load(std::memory_order_acquire);
+		size_t offset = connection->position;
+		size_t padding = (offset + length > connection->ringSize) ? connection->ringSize - offset : 0;
+		if(used + padding + length <= connection->ringSize) {
+			if(padding) {
+				offset = 0;
+			}
+			memcpy(connection->ring + NFF_SHM_HEADER_SIZE + offset, data, length);
+			connection->position = (offset + length) % connection->ringSize;
+			connection->written += padding + length;
+
+			uint32_t head[4] = {
+				static_cast<uint32_t>(status),
+				htole32(offset),
+				htole32(length),
+				htole32(connection->written)
+			};
+			writeFrame(stream, id, NFF_FRAME_REPLY_SHM, reinterpret_cast<char*>(head), sizeof(head), NULL, 0);
+			return;
+		}
+	}
+
+	writeFrame(stream, id, NFF_FRAME_REPLY, reinterpret_cast<char*>(&status), 4, data, length);
+}
+
+void ReaderServer::OnClose(uv_handle_t *handle) {
+	ReaderServer *server = static_cast<ReaderServer*>(handle->data);
+	server->Unref();
+}
+
+NAN_METHOD(ReaderServer::Close) {
+	ReaderServer* obj = ObjectWrap::Unwrap<ReaderServer>(info.This());
+
+	if(!obj->listening) {
+		return;
+	}
+	obj->listening = false;
+
+	std::map<uint32_t, ReaderConnection*> connections = obj->connections;
+	for(std::map<uint32_t, ReaderConnection*>::iterator it = connections.begin(); it != connections.end(); it++) {
+		closeConnection(it->second);
+	}
+	uv_close(reinterpret_cast<uv_handle_t*>(&obj->pipe), ReaderServer::OnClose);
+}
+
+
+
+/**
+* Client
+*/
+ReaderClient::ReaderClient() : connected(false), ring(NULL), ringSize(0), connectCallback(NULL), replyCallback(NULL), closeCallback(NULL) {}
+ReaderClient::~ReaderClient() {
+	if(ring) {
+		munmap(ring, NFF_SHM_HEADER_SIZE + ringSize);
+		NativeMemory::Released(NFF_MEMORY_SHARED, NFF_SHM_HEADER_SIZE + ringSize);
+	}
+	delete connectCallback;
+	delete replyCallback;
+	delete closeCallback;
+}
+
+NAN_MODULE_INIT(ReaderClient::Init) {
+	v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(ReaderClient::New);
+	tpl->SetClassName(Nan::New("ReaderClient").ToLocalChecked());
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+	Nan::SetPrototypeMethod(tpl, "connect", ReaderClient::Connect);
+	Nan::SetPrototypeMethod(tpl, "request", ReaderClient::Request);
+	Nan::SetPrototypeMethod(tpl, "close", ReaderClient::Close);
+
+	constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+	Nan::Set(target, Nan::New("ReaderClient").ToLocalChecked(),
+	Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+Nan::Persistent<v8::Function> & ReaderClient::constructor() {
+	static Nan::Persistent<v8::Function> my_constructor;
+	return my_constructor;
+}
+
+NAN_METHOD(ReaderClient::New) {
+	if (info.IsConstructCall()) {
+		ReaderClient *obj = new ReaderClient();
+		obj->Wrap(info.This());
+		info.GetReturnValue().Set(info.This());
+	} else {
+		v8::Local<v8::Function> cons = Nan::New(constructor());
+		info.GetReturnValue().Set(Nan::NewInstance(cons, 0, NULL).ToLocalChecked());
+	}
+}
+
+/**
+* Connect to a socket path: path, connect(status), reply(id, status, payload), close()
+*/
+NAN_METHOD(ReaderClient::Connect) {
+	ReaderClient* obj = ObjectWrap::Unwrap<ReaderClient>(info.This());
+
+	std::string path = std::string(*v8::String::Utf8Value(info[0]->ToString()));
+	obj->connectCallback = new Callback(info[1].As<v8::Function>());
+	obj->replyCallback = new Callback(info[2].As<v8::Function>());
+	obj->closeCallback = new Callback(info[3].As<v8::Function>());
+
+	uv_pipe_init(uv_default_loop(), &obj->pipe, 0);
+	obj->pipe.data = obj;
+	obj->connectRequest.data = obj;
+
+	// Stay alive until the socket is closed
+	obj->Ref();
+	uv_pipe_connect(&obj->connectRequest, &obj->pipe, path.c_str(), ReaderClient::OnConnect);
+}
+
+void ReaderClient::OnConnect(uv_connect_t *request, int status) {
+	ReaderClient *client = static_cast<ReaderClient*>(request->data);
+	Nan::HandleScope scope;
+
+	if(!status) {
+		client->connected = true;
+		uv_read_start(reinterpret_cast<uv_stream_t*>(&client->pipe), allocBuffer, ReaderClient::OnRead);
+	}
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(status)
+	};
+	client->connectCallback->Call(1, argv);
+
+	if(status) {
+		uv_close(reinterpret_cast<uv_handle_t*>(&client->pipe), ReaderClient::OnClose);
+	}
+}
+
+void ReaderClient::OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+	ReaderClient *client = static_cast<ReaderClient*>(stream->data);
+
+	if(nread < 0) {
+		free(buf->base);
+		if(!uv_is_closing(reinterpret_cast<uv_handle_t*>(&client->pipe))) {
+			uv_close(reinterpret_cast<uv_handle_t*>(&client->pipe), ReaderClient::OnClose);
+		}
+		return;
+	}
+	client->input.append(buf->base, nread);
+	free(buf->base);
+
+	size_t start = 0;
+	while(client->input.size() - start >= NFF_FRAME_HEADER_SIZE) {
+		const char *frame = client->input.data() + start;
+		uint32_t length = readUint32(frame);
+		if(client->input.size() - start < NFF_FRAME_HEADER_SIZE + length) {
+			break;
+		}
+		client->Frame(readUint32(frame + 4), frame[8], frame + NFF_FRAME_HEADER_SIZE, length);
+		start += NFF_FRAME_HEADER_SIZE + length;
+	}
+	client->input.erase(0, start);
+}
+
+void ReaderClient::Frame(uint32_t id, uint8_t kind, const char *body, size_t length) {
+	if(kind == NFF_FRAME_HELLO && length >= 4) {
+		size_t size = readUint32(body);
+		std::string name(body + 4, length - 4);
+		if(!size || name.empty()) {
+			return;
+		}
+		int fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if(fd < 0) {
+			return;
+		}
+		void *mapped = mmap(NULL, NFF_SHM_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		// Both sides hold the mapping, the name is not needed anymore
+		shm_unlink(name.c_str());
+		if(mapped != MAP_FAILED) {
+			ring = static_cast<uint8_t*>(mapped);
+			ringSize = size;
+			NativeMemory::Allocated(NFF_MEMORY_SHARED, NFF_SHM_HEADER_SIZE + ringSize);
+		}
+		return;
+	}
+
+	if(length < 4 || (kind != NFF_FRAME_REPLY && kind != NFF_FRAME_REPLY_SHM)) {
+		return;
+	}
+	Nan::HandleScope scope;
+
+	int32_t status = static_cast<int32_t>(readUint32(body));
+	v8::Local<v8::Value> payload;
+	if(kind == NFF_FRAME_REPLY_SHM) {
+		if(!ring || length < 16) {
+			return;
+		}
+		uint32_t offset = readUint32(body + 4);
+		uint32_t size = readUint32(body + 8);
+		if(size > ringSize || offset > ringSize - size) {
+			return;
+		}
+		payload = Nan::CopyBuffer(reinterpret_cast<char*>(ring + NFF_SHM_HEADER_SIZE + offset), size).ToLocalChecked();
+		ringReleased(ring)->store(readUint32(body + 12), std::memory_order_release);
+	}
+	else {
+		payload = Nan::CopyBuffer(body + 4, length - 4).ToLocalChecked();
+	}
+
+	v8::Local<v8::Value> argv[] = {
+		Nan::New<v8::Number>(id),
+		Nan::New<v8::Number>(status),
+		payload
+	};
+	replyCallback->Call(3, argv);
+}
+
+NAN_METHOD(ReaderClient::Request) {
+	ReaderClient* obj = ObjectWrap::Unwrap<ReaderClient>(info.This());
+
+	if(!obj->connected) {
+		info.GetReturnValue().Set(Nan::False());
+		return;
+	}
+	writeFrame(reinterpret_cast<uv_stream_t*>(&obj->pipe), info[0]->Uint32Value(), NFF_FRAME_REQUEST, NULL, 0,
+	  node::Buffer::Data(info[1]), node::Buffer::Length(info[1]));
+	info.GetReturnValue().Set(Nan::True());
+}
+
+void ReaderClient::OnClose(uv_handle_t *handle) {
+	ReaderClient *client = static_cast<ReaderClient*>(handle->data);
+	Nan::HandleScope scope;
+
+	client->connected = false;
+	client->closeCallback->Call(0, NULL);
+	client->Unref();
+}
+
+NAN_METHOD(ReaderClient::Close) {
+	ReaderClient* obj = ObjectWrap::Unwrap<ReaderClient>(info.This());
+
+	if(obj->connected && !uv_is_closing(reinterpret_cast<uv_handle_t*>(&obj->pipe))) {
+		uv_close(reinterpret_cast<uv_handle_t*>(&obj->pipe), ReaderClient::OnClose);
+	}
+}
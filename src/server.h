@@ -0,0 +1,128 @@
+#ifndef NFF_SERVER_H
+#define NFF_SERVER_H
+
+#include <nan.h>
+#include <uv.h>
+#include <string>
+#include <map>
+#include <atomic>
+
+#include "common.h"
+
+/*
+* Frames exchanged on the reader socket, all integers are little endian.
+* Header: uint32 body length, uint32 request id, uint8 kind
+* HELLO (server to client): uint32 ring size, shared memory name
+* REQUEST (client to server): payload
+* REPLY (server to client): int32 status, payload
+* REPLY_SHM (server to client): int32 status, uint32 offset, uint32 length, uint32 end,
+* the payload is in the shared ring at offset and the client releases it up to end
+*/
+#define NFF_FRAME_HEADER_SIZE 9
+#define NFF_FRAME_HELLO 0
+#define NFF_FRAME_REQUEST 1
+#define NFF_FRAME_REPLY 2
+#define NFF_FRAME_REPLY_SHM 3
+
+// Largest frame body accepted from a peer
+#define NFF_FRAME_MAX_SIZE (16 * 1024 * 1024)
+
+// Shared ring of a connection: release counter, then payloads
+#define NFF_SHM_HEADER_SIZE 64
+
+struct ReaderConnection;
+
+
+
+/**
+* Serve requests of other local processes on a Unix domain socket.
+* Requests are handed to JS, which owns the devices, and replies larger than
+* the threshold are written to a shared memory ring of the connection instead
+* of the socket.
+*/
+class ReaderServer : public Nan::ObjectWrap {
+
+public:
+	static NAN_MODULE_INIT(Init);
+
+	void Request(ReaderConnection *connection, uint32_t id, const char *payload, size_t length);
+	void Disconnected(ReaderConnection *connection);
+
+private:
+	explicit ReaderServer(size_t ringSize, size_t threshold);
+	~ReaderServer();
+
+	static inline Nan::Persistent<v8::Function> & constructor();
+
+	static NAN_METHOD(New);
+	static NAN_METHOD(Listen);
+	static NAN_METHOD(Reply);
+	static NAN_METHOD(Close);
+
+	static void OnConnection(uv_stream_t *stream, int status);
+	static void OnClose(uv_handle_t *handle);
+
+	// Listening socket
+	uv_pipe_t pipe;
+	bool listening;
+
+	// Open connections by id
+	std::map<uint32_t, ReaderConnection*> connections;
+	uint32_t nextConnection;
+
+	// Shared ring size of each connection and smallest payload sent through it
+	size_t ringSize;
+	size_t threshold;
+
+	// JS handlers: request(connection, id, payload), disconnect(connection)
+	Nan::Callback *requestCallback;
+	Nan::Callback *disconnectCallback;
+};
+
+
+
+/**
+* Client of a ReaderServer
+*/
+class ReaderClient : public Nan::ObjectWrap {
+
+public:
+	static NAN_MODULE_INIT(Init);
+
+private:
+	explicit ReaderClient();
+	~ReaderClient();
+
+	static inline Nan::Persistent<v8::Function> & constructor();
+
+	static NAN_METHOD(New);
+	static NAN_METHOD(Connect);
+	static NAN_METHOD(Request);
+	static NAN_METHOD(Close);
+
+	static void OnConnect(uv_connect_t *request, int status);
+	static void OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+	static void OnClose(uv_handle_t *handle);
+
+	void Frame(uint32_t id, uint8_t kind, const char *body, size_t length);
+
+	// Socket to the server
+	uv_pipe_t pipe;
+	uv_connect_t connectRequest;
+	bool connected;
+
+	// Incomplete frame
+	std::string input;
+
+	// Shared ring mapped from the server
+	uint8_t *ring;
+	size_t ringSize;
+
+	// JS handlers: connect(status), reply(id, status, payload), close()
+	Nan::Callback *connectCallback;
+	Nan::Callback *replyCallback;
+	Nan::Callback *closeCallback;
+};
+
+
+#endif /* NFF_SERVER_H */
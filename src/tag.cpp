@@ -1,13 +1,38 @@
 #include "tag.h"
 
+#include <chrono>
+#include <functional>
+
 using namespace Nan;
 
-Tag::Tag(MifareTag tag) : tag(tag) {}
-Tag::~Tag() {}
+Tag::Tag(MifareTag tag) : tag(tag), session(tag, &desfireFiles), idleTimeout(0), idleTimer(NULL), lastUse(0), scheduler(NULL), profile(NULL), generation(0), priority(NFF_PRIORITY_NORMAL), deadline(0) {
+	if(tag) {
+		NativeMemory::Allocated(NFF_MEMORY_TAGS, NFF_MEMORY_TAG_SIZE);
+		char *uid = freefare_get_tag_uid(tag);
+		if(uid) {
+			this->uid = uid;
+			free(uid);
+		}
+	}
+}
+Tag::~Tag() {
+	// The tag is owned by this object only, pending workers keep it alive.
+	// A connected tag is handed to the scheduler, which disconnects it from a worker thread.
+	bool released = scheduler && scheduler->Release(&session, tag);
+	if(tag && !released) {
+		freefare_free_tag(tag);
+		NativeMemory::Released(NFF_MEMORY_TAGS, NFF_MEMORY_TAG_SIZE);
+	}
+	if(idleTimer) {
+		uv_close(reinterpret_cast<uv_handle_t*>(idleTimer), [](uv_handle_t *handle) {
+			delete reinterpret_cast<uv_timer_t*>(handle);
+		});
+	}
+	deviceHandle.Reset();
+}
 
 MifareTag Tag::constructorTag = NULL;
-
-// TODO free tag on delete
+PrefetchCache *Tag::constructorPrefetch = NULL;
 
 NAN_MODULE_INIT(Tag::Init) {
 	v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(Tag::New);
@@ -17,6 +42,9 @@ NAN_MODULE_INIT(Tag::Init) {
 	Nan::SetPrototypeMethod(tpl, "getTagType", Tag::GetTagType);
 	Nan::SetPrototypeMethod(tpl, "getTagFriendlyName", Tag::GetTagFriendlyName);
 	Nan::SetPrototypeMethod(tpl, "getTagUID", Tag::GetTagUID);
+	Nan::SetPrototypeMethod(tpl, "setPriority", Tag::SetPriority);
+	Nan::SetPrototypeMethod(tpl, "setIdleTimeout", Tag::SetIdleTimeout);
+	Nan::SetPrototypeMethod(tpl, "calibrate", Tag::Calibrate);
 
 
 	Nan::SetPrototypeMethod(tpl, "mifareUltralight_connect", Tag::mifareUltralight_connect);
@@ -31,6 +59,11 @@ NAN_MODULE_INIT(Tag::Init) {
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_read", Tag::mifareClassic_read);
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_initValue", Tag::mifareClassic_initValue);
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_readValue", Tag::mifareClassic_readValue);
+	Nan::SetPrototypeMethod(tpl, "mifareClassic_readValues", Tag::mifareClassic_readValues);
+	Nan::SetPrototypeMethod(tpl, "mifareClassic_readBlocks", Tag::mifareClassic_readBlocks);
+	Nan::SetPrototypeMethod(tpl, "mifareClassic_writeBlocks", Tag::mifareClassic_writeBlocks);
+	Nan::SetPrototypeMethod(tpl, "mifareClassic_writeJournaled", Tag::mifareClassic_writeJournaled);
+	Nan::SetPrototypeMethod(tpl, "mifareClassic_recoverJournal", Tag::mifareClassic_recoverJournal);
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_write", Tag::mifareClassic_write);
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_increment", Tag::mifareClassic_increment);
 	Nan::SetPrototypeMethod(tpl, "mifareClassic_decrement", Tag::mifareClassic_decrement);
@@ -46,6 +79,7 @@ NAN_MODULE_INIT(Tag::Init) {
 	Nan::SetPrototypeMethod(tpl, "mifareDesfire_getFileIds", Tag::mifareDesfire_getFileIds);
 	Nan::SetPrototypeMethod(tpl, "mifareDesfire_write", Tag::mifareDesfire_write);
 	Nan::SetPrototypeMethod(tpl, "mifareDesfire_read", Tag::mifareDesfire_read);
+	Nan::SetPrototypeMethod(tpl, "mifareDesfire_readFiles", Tag::mifareDesfire_readFiles);
 
 	Nan::SetPrototypeMethod(tpl, "ntag21x_connect", Tag::ntag21x_connect);
 	Nan::SetPrototypeMethod(tpl, "ntag21x_disconnect", Tag::ntag21x_disconnect);
@@ -54,6 +88,11 @@ NAN_MODULE_INIT(Tag::Init) {
     Nan::SetPrototypeMethod(tpl, "ntag21x_get_subtype", Tag::ntag21x_get_subtype);
 	Nan::SetPrototypeMethod(tpl, "ntag21x_fast_read", Tag::ntag21x_fast_read);
 
+#ifdef FELICA_SC_RW
+	Nan::SetPrototypeMethod(tpl, "felica_read", Tag::felica_read);
+	Nan::SetPrototypeMethod(tpl, "felica_write", Tag::felica_write);
+#endif
+
 	constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
 	Nan::Set(target, Nan::New("Tag").ToLocalChecked(),
 	Nan::GetFunction(tpl).ToLocalChecked());
@@ -68,6 +107,17 @@ NAN_METHOD(Tag::New) {
 	if (info.IsConstructCall()) {
 		Tag *obj = new Tag(Tag::constructorTag);
 		Tag::constructorTag = NULL;
+		if(Tag::constructorPrefetch) {
+			std::swap(obj->prefetched, *Tag::constructorPrefetch);
+			Tag::constructorPrefetch = NULL;
+		}
+		if(info[0]->IsObject()) {
+			Device *device = ObjectWrap::Unwrap<Device>(info[0]->ToObject());
+			obj->deviceHandle.Reset(info[0]->ToObject());
+			obj->scheduler = device->GetScheduler();
+			obj->profile = device->GetProfile();
+			obj->generation = obj->scheduler->Generation();
+		}
 		obj->Wrap(info.This());
 		info.GetReturnValue().Set(info.This());
 	} else {
@@ -78,14 +128,261 @@ NAN_METHOD(Tag::New) {
 	}
 }
 
-v8::Handle<v8::Value> Tag::Instantiate(MifareTag constructorTag) {
+v8::Handle<v8::Value> Tag::Instantiate(MifareTag constructorTag, v8::Local<v8::Value> device, PrefetchCache *prefetched) {
 	Nan::EscapableHandleScope scope;
 
 	Tag::constructorTag = constructorTag;
-	v8::Local<v8::Value> argv[0] = {};
+	Tag::constructorPrefetch = prefetched;
+	v8::Local<v8::Value> argv[1] = { device };
 
 	v8::Local<v8::Function> cons = Nan::New(constructor());
-	return scope.Escape(Nan::NewInstance(cons, 0, argv).ToLocalChecked());
+	return scope.Escape(Nan::NewInstance(cons, 1, argv).ToLocalChecked());
+}
+
+void Tag::Queue(DeviceWorker *worker) {
+	// Keep the tag alive until the worker completes
+	worker->SaveToPersistent("tag", handle());
+
+	// Another device claimed the card, stop working on it
+	if(scheduler && !TagClaims::Claim(uid, scheduler)) {
+		scheduler->DropClaimed(uid);
+		scheduler->RejectLater(worker, NFF_ERROR_TAG_CLAIMED);
+		return;
+	}
+
+	if(scheduler) {
+		worker->SetSession(&session);
+		worker->SetUid(uid);
+		scheduler->Queue(worker, this, generation, priority, deadline ? Scheduler::Now() + deadline : 0);
+
+		lastUse = Scheduler::Now();
+		if(idleTimeout) {
+			uv_timer_start(idleTimer, Tag::OnIdle, idleTimeout, 0);
+		}
+	}
+	else {
+		AsyncQueueWorker(worker);
+	}
+}
+
+/**
+* Disconnect an idle tag
+*/
+class tag_idleDisconnectWorker : public DeviceWorker {
+public:
+	tag_idleDisconnectWorker(TagSession *session)
+	: DeviceWorker(NULL), session(session) {}
+	~tag_idleDisconnectWorker() {}
+
+	bool NeedsSession() const {
+		return false;
+	}
+
+	// Only disconnects the tag if it is still the selected target
+	bool SelectsTarget() const {
+		return false;
+	}
+
+	void Execute () {
+		session->Disconnect();
+	}
+
+	void HandleOKCallback () {}
+
+private:
+
+	// Connection state of our tag
+	TagSession *session;
+};
+
+void Tag::OnIdle(uv_timer_t *timer) {
+	Tag *obj = static_cast<Tag*>(timer->data);
+
+	// Operations are still pending, or were queued since the timer started
+	uint64_t idle = Scheduler::Now() - obj->lastUse;
+	if(!obj->scheduler->IsIdle(obj) || idle < obj->idleTimeout) {
+		uv_timer_start(timer, Tag::OnIdle, obj->scheduler->IsIdle(obj) ? obj->idleTimeout - idle : obj->idleTimeout, 0);
+		return;
+	}
+	if(!obj->session.IsConnected()) {
+		return;
+	}
+
+	Nan::HandleScope scope;
+	tag_idleDisconnectWorker *worker = new tag_idleDisconnectWorker(&obj->session);
+	worker->SaveToPersistent("tag", obj->handle());
+	obj->scheduler->Queue(worker, obj, obj->generation, NFF_PRIORITY_BULK, 0);
+}
+
+/**
+* Disconnect the tag after the given time (ms) without operation, 0 to keep it connected
+*/
+NAN_METHOD(Tag::SetIdleTimeout) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+
+	if(!obj->scheduler) {
+		return;
+	}
+	if(!obj->idleTimer) {
+		obj->idleTimer = new uv_timer_t;
+		uv_timer_init(uv_default_loop(), obj->idleTimer);
+		obj->idleTimer->data = obj;
+
+		// Do not keep the process alive for it
+		uv_unref(reinterpret_cast<uv_handle_t*>(obj->idleTimer));
+	}
+
+	obj->idleTimeout = info[0]->Uint32Value();
+	if(obj->idleTimeout) {
+		uv_timer_start(obj->idleTimer, Tag::OnIdle, obj->idleTimeout, 0);
+	}
+	else {
+		uv_timer_stop(obj->idleTimer);
+	}
+}
+
+/**
+* Set the priority class and relative deadline of the next tag operations
+*/
+NAN_METHOD(Tag::SetPriority) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+
+	obj->priority = info[0]->Uint32Value();
+	obj->deadline = info[1]->Uint32Value();
+}
+
+/**
+* Measure the timings of the device reader with this tag
+*/
+class tag_calibrateWorker : public DeviceWorker {
+public:
+	tag_calibrateWorker(Callback *callback, MifareTag tag, TagSession *session, DeviceProfile *profile)
+	: DeviceWorker(callback), tag(tag), session(session), profile(profile), error(0) {}
+	~tag_calibrateWorker() {}
+
+	void Execute () {
+		switch(freefare_get_tag_type(tag)) {
+			case NTAG_21x:
+				calibrateNtag21x();
+				break;
+			case ULTRALIGHT:
+			case ULTRALIGHT_C:
+				error = measureLatency([this]() {
+					MifareUltralightPage data;
+					return mifare_ultralight_read(tag, 0, &data);
+				}, 1);
+				break;
+			case DESFIRE:
+				// GetVersion takes three frames
+				error = measureLatency([this]() {
+					struct mifare_desfire_version_info version;
+					return mifare_desfire_get_version(tag, &version);
+				}, 3);
+				break;
+			default:
+				error = NFF_ERROR_CALIBRATION_UNSUPPORTED;
+				return;
+		}
+		measured.Derive();
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> result = Null();
+		if(error >= 0) {
+			*profile = measured;
+			result = measured.ToObject();
+		}
+
+		v8::Local<v8::Value> argv[] = {
+			Nan::New<v8::Number>(error < 0 ? error : 0),
+			result
+		};
+
+		callback->Call(2, argv);
+	}
+private:
+
+	static uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Fastest of a few runs of a command taking the given number of frames
+	int measureLatency(std::function<int()> command, uint32_t frames) {
+		uint64_t fastest = UINT64_MAX;
+		for(int i = 0; i < NFF_PROFILE_SAMPLES; i++) {
+			uint64_t start = now();
+			int result = command();
+			if(result < 0) {
+				return result;
+			}
+			fastest = std::min(fastest, now() - start);
+		}
+		measured.commandLatency = fastest / frames;
+		return 0;
+	}
+
+	// Double the FAST_READ length until the reader fails, the transfer time per byte
+	// is the difference between the longest read and a single page
+	void calibrateNtag21x() {
+		uint8_t data[NFF_PROFILE_MAX_PAGES * 4];
+		error = measureLatency([this, &data]() {
+			return ntag21x_fast_read(tag, 0, 0, data);
+		}, 1);
+		if(error < 0) {
+			return;
+		}
+		if((error = ntag21x_get_info(tag)) < 0) {
+			return;
+		}
+		uint32_t pages = std::min<uint32_t>(ntag21x_get_last_page(tag) + 1, NFF_PROFILE_MAX_PAGES);
+
+		uint64_t duration = 0;
+		measured.maxPages = 1;
+		for(uint32_t count = 2; measured.maxPages < pages; count = std::min(count * 2, pages)) {
+			uint64_t start = now();
+			if(ntag21x_fast_read(tag, 0, count - 1, data) < 0) {
+				// The tag is halted by the failed command
+				session->Lost();
+				error = session->Connect();
+				break;
+			}
+			duration = now() - start;
+			measured.maxPages = count;
+		}
+		if(measured.maxPages > 1 && duration > measured.commandLatency) {
+			measured.byteLatency = (duration - measured.commandLatency) * 1000 / ((measured.maxPages - 1) * 4);
+		}
+	}
+
+	// Our current tag
+	MifareTag tag;
+
+	// Connection state of our tag
+	TagSession *session;
+
+	// Profile of the device, updated on the main thread
+	DeviceProfile *profile;
+	DeviceProfile measured;
+
+	// Error ID or 0
+	int error;
+
+};
+NAN_METHOD(Tag::Calibrate) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	Callback *callback = new Callback(info[0].As<v8::Function>());
+	if(!obj->profile) {
+		v8::Local<v8::Value> argv[] = {
+			Nan::New<v8::Number>(NFF_ERROR_CALIBRATION_UNSUPPORTED),
+			Nan::Null()
+		};
+		callback->Call(2, argv);
+		delete callback;
+		return;
+	}
+	obj->Queue(new tag_calibrateWorker(callback, obj->tag, &obj->session, obj->profile));
 }
 
 NAN_METHOD(Tag::GetTagType) {
@@ -100,6 +397,9 @@ NAN_METHOD(Tag::GetTagType) {
 		case ULTRALIGHT: typeStr = "MIFARE_ULTRALIGHT"; break;
 		case ULTRALIGHT_C: typeStr = "MIFARE_ULTRALIGHT_C"; break;
 		case NTAG_21x: typeStr = "NTAG_21x"; break;
+#ifdef FELICA_SC_RW
+		case FELICA: typeStr = "FELICA"; break;
+#endif
 	}
 
 	info.GetReturnValue().Set(Nan::New<v8::String>(typeStr).ToLocalChecked());
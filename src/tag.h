@@ -3,6 +3,8 @@
 
 #include <nan.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 extern "C" {
 	#include <nfc/nfc.h>
@@ -12,6 +14,14 @@ extern "C" {
 #include "common.h"
 #include "device.h"
 #include "endian.h"
+#include "memory.h"
+#include "result_table.h"
+#include "arena.h"
+#include "desfire_file_cache.h"
+#include "scheduler.h"
+#include "tag_claims.h"
+#include "tag_prefetch.h"
+#include "tag_session.h"
 
 
 
@@ -20,7 +30,7 @@ class Tag: public Nan::ObjectWrap {
 
 public:
 	static NAN_MODULE_INIT(Init);
-	static v8::Handle<v8::Value> Instantiate(MifareTag tag);
+	static v8::Handle<v8::Value> Instantiate(MifareTag tag, v8::Local<v8::Value> device, PrefetchCache *prefetched = NULL);
 
 private:
 	explicit Tag(MifareTag tag);
@@ -32,6 +42,9 @@ private:
 	static NAN_METHOD(GetTagType);
 	static NAN_METHOD(GetTagFriendlyName);
 	static NAN_METHOD(GetTagUID);
+	static NAN_METHOD(SetPriority);
+	static NAN_METHOD(SetIdleTimeout);
+	static NAN_METHOD(Calibrate);
 
 	static NAN_METHOD(mifareUltralight_connect);
 	static NAN_METHOD(mifareUltralight_disconnect);
@@ -44,6 +57,11 @@ private:
 	static NAN_METHOD(mifareClassic_read);
 	static NAN_METHOD(mifareClassic_initValue);
 	static NAN_METHOD(mifareClassic_readValue);
+	static NAN_METHOD(mifareClassic_readValues);
+	static NAN_METHOD(mifareClassic_readBlocks);
+	static NAN_METHOD(mifareClassic_writeBlocks);
+	static NAN_METHOD(mifareClassic_writeJournaled);
+	static NAN_METHOD(mifareClassic_recoverJournal);
 	static NAN_METHOD(mifareClassic_write);
 	static NAN_METHOD(mifareClassic_increment);
 	static NAN_METHOD(mifareClassic_decrement);
@@ -59,6 +77,7 @@ private:
 	static NAN_METHOD(mifareDesfire_getFileIds);
 	static NAN_METHOD(mifareDesfire_write);
 	static NAN_METHOD(mifareDesfire_read);
+	static NAN_METHOD(mifareDesfire_readFiles);
 
 	static NAN_METHOD(ntag21x_connect);
 	static NAN_METHOD(ntag21x_disconnect);
@@ -68,14 +87,53 @@ private:
 	static NAN_METHOD(ntag21x_get_subtype);
 	static NAN_METHOD(ntag21x_fast_read);
 
+#ifdef FELICA_SC_RW
+	static NAN_METHOD(felica_read);
+	static NAN_METHOD(felica_write);
+#endif
+
+	// Queue a worker on the device scheduler
+	void Queue(DeviceWorker *worker);
+
+	static void OnIdle(uv_timer_t *timer);
+
 private:
 	nfc_device* device;
 	std::string connstring;
 	MifareTag tag;
 
+	// UID, used to deduplicate the tag across devices
+	std::string uid;
+
+	// DESFire file settings of the selected application
+	DesfireFileCache desfireFiles;
+
+	// Data read when the tag was found, dropped on write
+	PrefetchCache prefetched;
+
+	// Connection state, the tag is disconnected after idleTimeout ms (0 for never) without operation
+	TagSession session;
+	uint32_t idleTimeout;
+	uv_timer_t *idleTimer;
+	uint64_t lastUse;
+
+	// Device the tag was found on, kept alive as long as the tag
+	Nan::Persistent<v8::Object> deviceHandle;
+	Scheduler *scheduler;
+
+	// Timings of the device reader
+	DeviceProfile *profile;
+
+	// Device generation the tag was found in, the tag is lost when the device is reopened
+	uint32_t generation;
+
+	// Priority class and relative deadline (ms, 0 for none) of tag operations
+	int priority;
+	uint32_t deadline;
 
 
 	static MifareTag constructorTag;
+	static PrefetchCache *constructorPrefetch;
 };
 
 
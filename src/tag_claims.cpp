@@ -0,0 +1,42 @@
+#include "tag_claims.h"
+
+#include <uv.h>
+
+std::atomic<uint32_t> TagClaims::window(0);
+std::mutex TagClaims::lock;
+std::map<std::string, TagClaims::Entry> TagClaims::claims;
+
+void TagClaims::SetWindow(uint32_t window) {
+	std::lock_guard<std::mutex> guard(lock);
+	TagClaims::window = window;
+	if(!window) {
+		claims.clear();
+	}
+}
+
+bool TagClaims::Claim(const std::string &uid, const void *owner) {
+	uint32_t window = TagClaims::window;
+	if(!window) {
+		return true;
+	}
+	uint64_t now = uv_hrtime() / 1000000;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// Forget cards that left every field
+	for(std::map<std::string, Entry>::iterator it = claims.begin(); it != claims.end(); ) {
+		if(it->second.expires <= now) {
+			it = claims.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+
+	std::map<std::string, Entry>::iterator it = claims.find(uid);
+	if(it != claims.end() && it->second.owner != owner) {
+		return false;
+	}
+	claims[uid] = {owner, now + window};
+	return true;
+}
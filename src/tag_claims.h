@@ -0,0 +1,40 @@
+#ifndef NFF_TAG_CLAIMS_H
+#define NFF_TAG_CLAIMS_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include "common.h"
+
+
+
+/**
+* Cross-device claims on tag UIDs, for readers with overlapping fields.
+* The first device that sees a UID claims it, other devices ignore the tag
+* until the claim was not refreshed for the dedupe window.
+* Owners are opaque pointers (the device scheduler), claims are thread safe.
+*/
+class TagClaims {
+
+public:
+	// Claim window in ms, 0 disables deduplication
+	static void SetWindow(uint32_t window);
+
+	// Claim or refresh a UID, false if another owner holds it
+	static bool Claim(const std::string &uid, const void *owner);
+
+private:
+	struct Entry {
+		const void *owner;
+		uint64_t expires;
+	};
+
+	static std::atomic<uint32_t> window;
+	static std::mutex lock;
+	static std::map<std::string, Entry> claims;
+};
+
+
+#endif /* NFF_TAG_CLAIMS_H */
@@ -0,0 +1,188 @@
+#include "tag.h"
+
+using namespace Nan;
+
+// FeliCa support needs the libfreefare version introducing it
+#ifdef FELICA_SC_RW
+
+// Blocks a Read Without Encryption command reliably carries (cards guarantee 4)
+#define NFF_FELICA_MAX_READ_BLOCKS 4
+
+// Blocks a Write Without Encryption command reliably carries (cards guarantee 1)
+#define NFF_FELICA_MAX_WRITE_BLOCKS 1
+
+// Size of a FeliCa block
+#define NFF_FELICA_BLOCK_SIZE 16
+
+static std::vector<uint8_t> blockList(v8::Local<v8::Value> value) {
+	std::vector<uint8_t> blocks;
+	v8::Local<v8::Array> list = value.As<v8::Array>();
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		blocks.push_back(Nan::Get(list, i).ToLocalChecked()->Uint32Value());
+	}
+	return blocks;
+}
+
+static uint8_t blocksPerCommand(v8::Local<v8::Value> value, uint8_t max) {
+	uint32_t count = value->IsNumber() ? value->Uint32Value() : 0;
+	return (count == 0 || count > max) ? max : count;
+}
+
+
+/**
+* Read blocks of a service without encryption, several blocks per command.
+* Yields to more urgent workers between two commands.
+*/
+class felica_readWorker : public DeviceWorker {
+public:
+	felica_readWorker(Callback *callback, MifareTag tag, uint16_t service, std::vector<uint8_t> blocks, uint8_t perCommand)
+	: DeviceWorker(callback), tag(tag), service(service), blocks(blocks), perCommand(perCommand), position(0), error(0) {
+		data.resize(blocks.size() * NFF_FELICA_BLOCK_SIZE);
+		NativeMemory::Allocated(NFF_MEMORY_BUFFERS, data.size());
+	}
+	~felica_readWorker() {
+		NativeMemory::Released(NFF_MEMORY_BUFFERS, data.size());
+	}
+
+	std::string Key() const {
+		std::string key = "felica_read:" + std::to_string(service) + ":" + std::to_string(perCommand);
+		for(size_t i = 0; i < blocks.size(); i++) {
+			key += "," + std::to_string(blocks[i]);
+		}
+		return key;
+	}
+
+	void Execute () {
+		while(position < blocks.size()) {
+			uint8_t count = std::min<size_t>(perCommand, blocks.size() - position);
+			ssize_t read = felica_read_ex(tag, service, count, &blocks[position], &data[position * NFF_FELICA_BLOCK_SIZE],
+				count * NFF_FELICA_BLOCK_SIZE);
+			if(read < 0) {
+				error = read;
+				return;
+			}
+			position += count;
+
+			if(position < blocks.size() && ShouldYield()) {
+				Yield();
+				return;
+			}
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> buf = Null();
+		if(!error) {
+			buf = Nan::CopyBuffer(reinterpret_cast<char*>(data.data()), data.size()).ToLocalChecked();
+		}
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			buf
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+
+	// Our current tag
+	MifareTag tag;
+
+	uint16_t service;
+	std::vector<uint8_t> blocks;
+
+	// Blocks read per command
+	uint8_t perCommand;
+
+	// Blocks read so far
+	size_t position;
+
+	// Read content, 16 bytes per block
+	std::vector<uint8_t> data;
+
+	// Error ID or 0
+	int error;
+
+};
+NAN_METHOD(Tag::felica_read) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	Callback *callback = new Callback(info[3].As<v8::Function>());
+	obj->Queue(new felica_readWorker(callback, obj->tag, info[0]->Uint32Value(), blockList(info[1]), blocksPerCommand(info[2], NFF_FELICA_MAX_READ_BLOCKS)));
+}
+
+
+/**
+* Write blocks of a service without encryption, several blocks per command
+*/
+class felica_writeWorker : public DeviceWorker {
+public:
+	felica_writeWorker(Callback *callback, MifareTag tag, uint16_t service, std::vector<uint8_t> blocks, uint8_t perCommand, v8::Local<v8::Object> buffer)
+	: DeviceWorker(callback), tag(tag), service(service), blocks(blocks), perCommand(perCommand), position(0), error(0) {
+		// The buffer is pinned for the worker lifetime and written without copy
+		SaveToPersistent("data", buffer);
+		data = reinterpret_cast<uint8_t*>(node::Buffer::Data(buffer));
+		this->blocks.resize(std::min(blocks.size(), node::Buffer::Length(buffer) / NFF_FELICA_BLOCK_SIZE));
+	}
+	~felica_writeWorker() {}
+
+	void Execute () {
+		while(position < blocks.size()) {
+			uint8_t count = std::min<size_t>(perCommand, blocks.size() - position);
+			ssize_t written = felica_write_ex(tag, service, count, &blocks[position], data + position * NFF_FELICA_BLOCK_SIZE,
+				count * NFF_FELICA_BLOCK_SIZE);
+			if(written < 0) {
+				error = written;
+				return;
+			}
+			position += count;
+
+			if(position < blocks.size() && ShouldYield()) {
+				Yield();
+				return;
+			}
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::Number>(position)
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+
+	// Our current tag
+	MifareTag tag;
+
+	uint16_t service;
+	std::vector<uint8_t> blocks;
+
+	// Blocks written per command
+	uint8_t perCommand;
+
+	// Blocks written so far
+	size_t position;
+
+	// Memory of the caller buffer, 16 bytes per block
+	uint8_t* data;
+
+	// Error ID or 0
+	int error;
+
+};
+NAN_METHOD(Tag::felica_write) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
+	Callback *callback = new Callback(info[4].As<v8::Function>());
+	obj->Queue(new felica_writeWorker(callback, obj->tag, info[0]->Uint32Value(), blockList(info[1]), blocksPerCommand(info[3], NFF_FELICA_MAX_WRITE_BLOCKS), info[2]->ToObject()));
+}
+
+#endif /* FELICA_SC_RW */
@@ -0,0 +1,91 @@
+#include "tag_filter.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+
+void TagFilter::SetRules(const std::vector<TagFilterRule> &rules) {
+	this->rules = rules;
+}
+
+bool TagFilter::Empty() const {
+	return rules.empty();
+}
+
+bool TagFilter::MatchTarget(const TagFilterRule &rule, const nfc_target &target) {
+#ifdef FELICA_SC_RW
+	// FeliCa targets have no ATQA and SAK, their UID is the IDm
+	if(target.nm.nmt == NMT_FELICA) {
+		if(rule.hasAtqa || rule.hasSak) {
+			return false;
+		}
+		return MatchUid(rule, target.nti.nfi.abtId, sizeof(target.nti.nfi.abtId));
+	}
+#endif
+	const nfc_iso14443a_info &info = target.nti.nai;
+	if(rule.hasAtqa && (((info.abtAtqa[0] << 8) | info.abtAtqa[1]) & rule.atqaMask) != (rule.atqa & rule.atqaMask)) {
+		return false;
+	}
+	if(rule.hasSak && (info.btSak & rule.sakMask) != (rule.sak & rule.sakMask)) {
+		return false;
+	}
+	return MatchUid(rule, info.abtUid, std::min(info.szUidLen, sizeof(info.abtUid)));
+}
+
+bool TagFilter::MatchUid(const TagFilterRule &rule, const uint8_t *bytes, size_t length) {
+	if(!rule.uidPrefix.empty()) {
+		char uid[NFF_FILTER_MAX_UID * 2 + 1] = "";
+		for(size_t i = 0; i < length && i < NFF_FILTER_MAX_UID; i++) {
+			snprintf(uid + i * 2, 3, "%02x", bytes[i]);
+		}
+		if(rule.uidPrefix.size() > strlen(uid) || strncasecmp(uid, rule.uidPrefix.c_str(), rule.uidPrefix.size())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+MifareTag* TagFilter::List(nfc_device *device, const Discovery &discovery) const {
+	nfc_target candidates[NFF_FILTER_MAX_CANDIDATES];
+	int count = discovery.ListTargets(device, candidates, NFF_FILTER_MAX_CANDIDATES);
+	if(count < 0) {
+		return NULL;
+	}
+
+	MifareTag *tags = (MifareTag*) malloc((count + 1) * sizeof(MifareTag));
+	if(!tags) {
+		return NULL;
+	}
+	size_t found = 0;
+	for(int i = 0; i < count; i++) {
+		// Rules matching the target, no tag is created if there is none
+		std::vector<const TagFilterRule*> matching;
+		for(size_t j = 0; j < rules.size(); j++) {
+			if(MatchTarget(rules[j], candidates[i])) {
+				matching.push_back(&rules[j]);
+			}
+		}
+		if(!rules.empty() && matching.empty()) {
+			continue;
+		}
+
+		MifareTag tag = discovery.NewTag(device, candidates[i]);
+		if(!tag) {
+			continue;
+		}
+		bool kept = rules.empty();
+		for(size_t j = 0; j < matching.size() && !kept; j++) {
+			kept = !matching[j]->hasType || matching[j]->type == freefare_get_tag_type(tag);
+		}
+		if(kept) {
+			tags[found++] = tag;
+		}
+		else {
+			freefare_free_tag(tag);
+		}
+	}
+	tags[found] = NULL;
+	return tags;
+}
@@ -0,0 +1,62 @@
+#ifndef NFF_TAG_FILTER_H
+#define NFF_TAG_FILTER_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+#include "discovery.h"
+
+// Targets listed at most by a filtered listing, as freefare_get_tags()
+#define NFF_FILTER_MAX_CANDIDATES 16
+
+// Longest UID compared to a prefix, in bytes
+#define NFF_FILTER_MAX_UID 10
+
+/**
+* Rule of a tag filter, fields not set match any tag.
+* ATQA and SAK are compared under their mask, the UID prefix is in hex.
+*/
+struct TagFilterRule {
+	bool hasType;
+	mifare_tag_type type;
+	std::string uidPrefix;
+	bool hasAtqa;
+	uint16_t atqa;
+	uint16_t atqaMask;
+	bool hasSak;
+	uint8_t sak;
+	uint8_t sakMask;
+};
+
+
+
+/**
+* Tags kept by a device listing: those matching one of the rules, all if
+* there is none. Targets are matched on their anticollision data before a
+* libfreefare tag is created for them, only the type check needs one.
+* FeliCa targets are matched on their IDm.
+*/
+class TagFilter {
+
+public:
+	void SetRules(const std::vector<TagFilterRule> &rules);
+	bool Empty() const;
+
+	// List the tags of a device found by the discovery, NULL terminated as freefare_get_tags()
+	MifareTag* List(nfc_device *device, const Discovery &discovery) const;
+
+private:
+	static bool MatchTarget(const TagFilterRule &rule, const nfc_target &target);
+	static bool MatchUid(const TagFilterRule &rule, const uint8_t *bytes, size_t length);
+
+	std::vector<TagFilterRule> rules;
+};
+
+
+#endif /* NFF_TAG_FILTER_H */
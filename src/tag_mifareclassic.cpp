@@ -1,16 +1,23 @@
 #include "tag.h"
+#include "classic_access.h"
+#include "classic_journal.h"
 
 using namespace Nan;
 
 
-class mifareClassic_connectWorker : public AsyncWorker {
+class mifareClassic_connectWorker : public DeviceWorker {
 public:
-	mifareClassic_connectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareClassic_connectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareClassic_connectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_classic_connect(tag);
+		error = session->Connect();
 	}
 
 	void HandleOKCallback () {
@@ -24,8 +31,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -34,18 +41,23 @@ private:
 NAN_METHOD(Tag::mifareClassic_connect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_connectWorker(callback, obj->tag));
+	obj->Queue(new mifareClassic_connectWorker(callback, &obj->session));
 }
 
 
-class mifareClassic_disconnectWorker : public AsyncWorker {
+class mifareClassic_disconnectWorker : public DeviceWorker {
 public:
-	mifareClassic_disconnectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareClassic_disconnectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareClassic_disconnectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_classic_disconnect(tag);
+		error = session->Disconnect();
 	}
 
 	void HandleOKCallback () {
@@ -59,8 +71,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -69,19 +81,22 @@ private:
 NAN_METHOD(Tag::mifareClassic_disconnect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_disconnectWorker(callback, obj->tag));
+	obj->Queue(new mifareClassic_disconnectWorker(callback, &obj->session));
 }
 
-class mifareClassic_authenticateWorker : public AsyncWorker {
+class mifareClassic_authenticateWorker : public DeviceWorker {
 public:
-	mifareClassic_authenticateWorker(Callback *callback, MifareTag tag, const MifareClassicBlockNumber block, const MifareClassicKey key, const MifareClassicKeyType keyType)
-	: AsyncWorker(callback), tag(tag), block(block), keyType(keyType), error(0) {
+	mifareClassic_authenticateWorker(Callback *callback, MifareTag tag, TagSession *session, const MifareClassicBlockNumber block, const MifareClassicKey key, const MifareClassicKeyType keyType)
+	: DeviceWorker(callback), tag(tag), session(session), block(block), keyType(keyType), error(0) {
 		memcpy(this->key, key, sizeof(MifareClassicKey));
 	}
 	~mifareClassic_authenticateWorker() {}
 
 	void Execute () {
 		error = mifare_classic_authenticate(tag, block, key, keyType);
+		if(error >= 0) {
+			session->SetCredential(TagSession::ClassicCredential(mifare_classic_block_sector(block), key, keyType));
+		}
 	}
 
 	void HandleOKCallback () {
@@ -98,6 +113,9 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Authentication state of our tag
+	TagSession *session;
+
 	// Block to read
 	MifareClassicBlockNumber block;
 
@@ -114,23 +132,47 @@ private:
 NAN_METHOD(Tag::mifareClassic_authenticate) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 
-	AsyncQueueWorker(new mifareClassic_authenticateWorker(
+	obj->Queue(new mifareClassic_authenticateWorker(
 		new Callback(info[3].As<v8::Function>()),
 		obj->tag,
+		&obj->session,
 		info[0]->Uint32Value(),
 		reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1])),
 		(std::string(*v8::String::Utf8Value(info[2]->ToString())) == "A") ? MFC_KEY_A : MFC_KEY_B
 	));
 }
 
-class mifareClassic_readWorker : public AsyncWorker {
+class mifareClassic_readWorker : public DeviceWorker {
 public:
-	mifareClassic_readWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block)
-	: AsyncWorker(callback), tag(tag), block(block), error(0) {}
+	mifareClassic_readWorker(Callback *callback, MifareTag tag, TagSession *session, PrefetchCache *prefetched, MifareClassicBlockNumber block)
+	: DeviceWorker(callback), tag(tag), session(session), prefetched(prefetched), block(block), error(0) {}
 	~mifareClassic_readWorker() {}
 
+	bool KeepsCredential() const {
+		return true;
+	}
+
+	bool Range(std::string *space, uint32_t *start, uint32_t *end) const {
+		*space = "mifareClassic_block";
+		*start = block;
+		*end = block + 1;
+		return true;
+	}
+
 	void Execute () {
+		// Prefetched with the key the sector is now authenticated with
+		std::string cached;
+		if(prefetched->Lookup("mifareClassic_block", 0, block, block + 1, 16, session->Credential(), &cached)) {
+			memcpy(data, cached.data(), sizeof(MifareClassicBlock));
+			return;
+		}
+
 		error = mifare_classic_read(tag, block, &data);
+
+		// The card halts on a failed read
+		if(error < 0) {
+			session->SetCredential(std::string());
+		}
 	}
 
 	void HandleOKCallback () {
@@ -150,6 +192,10 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Authentication state and data read on arrival
+	TagSession *session;
+	PrefetchCache *prefetched;
+
 	// Block to read
 	MifareClassicBlockNumber block;
 
@@ -163,14 +209,15 @@ private:
 NAN_METHOD(Tag::mifareClassic_read) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_readWorker(callback, obj->tag, info[0]->Uint32Value()));
+	uint32_t block = info[0]->Uint32Value();
+	obj->Queue(new mifareClassic_readWorker(callback, obj->tag, &obj->session, &obj->prefetched, block));
 }
 
 
-class mifareClassic_initValueWorker : public AsyncWorker {
+class mifareClassic_initValueWorker : public DeviceWorker {
 public:
 	mifareClassic_initValueWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block, const int32_t value, const MifareClassicBlockNumber adr)
-	: AsyncWorker(callback), tag(tag), block(block), value(value), adr(adr), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), value(value), adr(adr), error(0) {}
 	~mifareClassic_initValueWorker() {}
 
 	void Execute () {
@@ -202,17 +249,22 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_initValue) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[3].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_initValueWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Int32Value(), info[2]->Uint32Value()));
+	obj->Queue(new mifareClassic_initValueWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Int32Value(), info[2]->Uint32Value()));
 }
 
 
-class mifareClassic_readValueWorker : public AsyncWorker {
+class mifareClassic_readValueWorker : public DeviceWorker {
 public:
 	mifareClassic_readValueWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block)
-	: AsyncWorker(callback), tag(tag), block(block), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), error(0) {}
 	~mifareClassic_readValueWorker() {}
 
+	std::string Key() const {
+		return "mifareClassic_readValue:" + std::to_string(block);
+	}
+
 	void Execute () {
 		error = mifare_classic_read_value(tag, block, &value, &adr);
 	}
@@ -245,15 +297,505 @@ private:
 NAN_METHOD(Tag::mifareClassic_readValue) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_readValueWorker(callback, obj->tag, info[0]->Uint32Value()));
+	obj->Queue(new mifareClassic_readValueWorker(callback, obj->tag, info[0]->Uint32Value()));
 }
 
 
+#define NFF_CLASSIC_VALUE_RECORD_SIZE 9
+
+class mifareClassic_readValuesWorker : public DeviceWorker {
+public:
+	mifareClassic_readValuesWorker(Callback *callback, MifareTag tag, std::vector<MifareClassicBlockNumber> blocks)
+	: DeviceWorker(callback), tag(tag), blocks(blocks), results(blocks.size(), NFF_CLASSIC_VALUE_RECORD_SIZE) {}
+	~mifareClassic_readValuesWorker() {}
+
+	// Reads with the authentication left by the caller, so it never yields to
+	// a worker which could authenticate another sector or halt the tag
+	void Execute () {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			// Record: int32 error, int32 value, uint8 adr
+			int32_t value = 0;
+			MifareClassicBlockNumber adr = 0;
+			int error = mifare_classic_read_value(tag, blocks[i], &value, &adr);
+			results.SetInt32(i, 0, error < 0 ? error : 0);
+			results.SetInt32(i, 4, value);
+			results.SetUint8(i, 8, adr);
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(results.Valid() ? 0 : -1),
+			results.Release()
+		};
+
+		callback->Call(2, argv);
+	}
+private:
+
+	// Our current tag
+	MifareTag tag;
+
+	// Blocks to read
+	std::vector<MifareClassicBlockNumber> blocks;
+
+	// One record per block
+	ResultTable results;
+
+};
+NAN_METHOD(Tag::mifareClassic_readValues) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	Callback *callback = new Callback(info[1].As<v8::Function>());
+
+	v8::Local<v8::Array> list = info[0].As<v8::Array>();
+	std::vector<MifareClassicBlockNumber> blocks(list->Length());
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		blocks[i] = Nan::Get(list, i).ToLocalChecked()->Uint32Value();
+	}
+	obj->Queue(new mifareClassic_readValuesWorker(callback, obj->tag, blocks));
+}
+
+
+
+// Record: int32 error, uint8 key type, padding, block content
+#define NFF_CLASSIC_BLOCK_RECORD_SIZE 24
+// Record: int32 error, uint8 key type
+#define NFF_CLASSIC_WRITTEN_RECORD_SIZE 5
+
+// Batch operation on blocks of several sectors, authenticating once per sector
+class mifareClassic_accessWorker : public DeviceWorker {
+public:
+	mifareClassic_accessWorker(Callback *callback, MifareTag tag, TagSession *session, std::vector<MifareClassicBlockNumber> blocks,
+	  const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access, int operation, size_t stride)
+	: DeviceWorker(callback), tag(tag), blocks(blocks), position(0), results(blocks.size(), stride),
+	  authenticator(tag, session, keyA, keyB, access), operation(operation) {}
+	~mifareClassic_accessWorker() {}
+
+	void Execute () {
+		// Executed again after yielding, another worker may have authenticated meanwhile
+		authenticator.Reset();
+		size_t start = position;
+		for (; position < blocks.size(); position++) {
+			if(position > start && ShouldYield()) {
+				Yield();
+				return;
+			}
+
+			MifareClassicKeyType keyType = MFC_KEY_A;
+			int error = authenticator.Authenticate(blocks[position], operation, &keyType);
+			results.SetUint8(position, 4, error ? NFF_ACCESS_NO_KEY : (keyType == MFC_KEY_A ? 0 : 1));
+			if(!error) {
+				error = Operate(blocks[position]);
+
+				// A failed command halts the card and drops its authentication, whatever the error
+				if(error && error != NFF_ERROR_CLASSIC_ACCESS) {
+					authenticator.Reselect();
+				}
+			}
+			results.SetInt32(position, 0, error);
+		}
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(results.Valid() ? 0 : -1),
+			results.Release()
+		};
+
+		callback->Call(2, argv);
+	}
+
+protected:
+	// Read or write the block at the current position, once authenticated
+	virtual int Operate(MifareClassicBlockNumber block) = 0;
+
+	// Our current tag
+	MifareTag tag;
+
+	// Blocks to process, and next one
+	std::vector<MifareClassicBlockNumber> blocks;
+	size_t position;
+
+	// One record per block
+	ResultTable results;
+
+private:
+	ClassicAuthenticator authenticator;
+
+	// NFF_ACCESS_READ or NFF_ACCESS_WRITE
+	int operation;
+
+};
+
+class mifareClassic_readBlocksWorker : public mifareClassic_accessWorker {
+public:
+	mifareClassic_readBlocksWorker(Callback *callback, MifareTag tag, TagSession *session, std::vector<MifareClassicBlockNumber> blocks,
+	  const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access)
+	: mifareClassic_accessWorker(callback, tag, session, blocks, keyA, keyB, access, NFF_ACCESS_READ, NFF_CLASSIC_BLOCK_RECORD_SIZE) {}
+	~mifareClassic_readBlocksWorker() {}
+
+protected:
+	int Operate(MifareClassicBlockNumber block) {
+		MifareClassicBlock data;
+		if(mifare_classic_read(tag, block, &data) < 0) {
+			return NFF_ERROR_LIBNFC_UNKNOWN;
+		}
+		results.SetBytes(position, 8, data, sizeof(MifareClassicBlock));
+		return 0;
+	}
+};
+
+class mifareClassic_writeBlocksWorker : public mifareClassic_accessWorker {
+public:
+	mifareClassic_writeBlocksWorker(Callback *callback, MifareTag tag, TagSession *session, std::vector<MifareClassicBlockNumber> blocks,
+	  const unsigned char *data, const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access)
+	: mifareClassic_accessWorker(callback, tag, session, blocks, keyA, keyB, access, NFF_ACCESS_WRITE, NFF_CLASSIC_WRITTEN_RECORD_SIZE),
+	  data(data) {}
+	~mifareClassic_writeBlocksWorker() {}
+
+protected:
+	int Operate(MifareClassicBlockNumber block) {
+		// Trailers hold the keys, they are not written blindly in a batch
+		if(ClassicAccess::Group(block) == NFF_ACCESS_TRAILER) {
+			return NFF_ERROR_CLASSIC_ACCESS;
+		}
+		MifareClassicBlock content;
+		memcpy(content, data + position * sizeof(MifareClassicBlock), sizeof(MifareClassicBlock));
+		return mifare_classic_write(tag, block, content) < 0 ? NFF_ERROR_LIBNFC_UNKNOWN : 0;
+	}
+
+private:
+	// 16 bytes per block, kept alive by the persistent handle
+	const unsigned char *data;
+};
+
+// Blocks list, optional keys and access map of mifareClassic_readBlocks and mifareClassic_writeBlocks
+static std::vector<MifareClassicBlockNumber> blockList(v8::Local<v8::Value> value) {
+	v8::Local<v8::Array> list = value.As<v8::Array>();
+	std::vector<MifareClassicBlockNumber> blocks(list->Length());
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		blocks[i] = Nan::Get(list, i).ToLocalChecked()->Uint32Value();
+	}
+	return blocks;
+}
+static const unsigned char *optionalKey(v8::Local<v8::Value> value) {
+	if(!node::Buffer::HasInstance(value) || node::Buffer::Length(value) < sizeof(MifareClassicKey)) {
+		return NULL;
+	}
+	return reinterpret_cast<unsigned char*>(node::Buffer::Data(value));
+}
+static ClassicAccess accessMap(v8::Local<v8::Value> value) {
+	ClassicAccess access;
+	if(!value->IsObject()) {
+		return access;
+	}
+
+	// {sector: [C1C2C3 of blocks 0, 1, 2 and of the trailer]}
+	v8::Local<v8::Object> map = value.As<v8::Object>();
+	v8::Local<v8::Array> sectors = Nan::GetOwnPropertyNames(map).ToLocalChecked();
+	for (uint32_t i = 0; i < sectors->Length(); i++) {
+		v8::Local<v8::Value> sector = Nan::Get(sectors, i).ToLocalChecked();
+		v8::Local<v8::Value> groups = Nan::Get(map, sector).ToLocalChecked();
+		if(!groups->IsArray() || groups.As<v8::Array>()->Length() != 4) {
+			continue;
+		}
+		ClassicAccess::Conditions conditions;
+		for (uint32_t group = 0; group < 4; group++) {
+			conditions[group] = Nan::Get(groups.As<v8::Array>(), group).ToLocalChecked()->Uint32Value() & 0x07;
+		}
+		access.Set(sector->Uint32Value(), conditions);
+	}
+	return access;
+}
+
+NAN_METHOD(Tag::mifareClassic_readBlocks) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	Callback *callback = new Callback(info[4].As<v8::Function>());
+	obj->Queue(new mifareClassic_readBlocksWorker(callback, obj->tag, &obj->session, blockList(info[0]),
+		optionalKey(info[1]), optionalKey(info[2]), accessMap(info[3])));
+}
+
+NAN_METHOD(Tag::mifareClassic_writeBlocks) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
+	Callback *callback = new Callback(info[5].As<v8::Function>());
+	mifareClassic_writeBlocksWorker *worker = new mifareClassic_writeBlocksWorker(callback, obj->tag, &obj->session, blockList(info[0]),
+		reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1])), optionalKey(info[2]), optionalKey(info[3]), accessMap(info[4]));
+	worker->SaveToPersistent("data", info[1]);
+	obj->Queue(worker);
+}
+
+
+
+// Tear-safe writes of blocks of one sector, journaled in a block of another sector (see classic_journal.h)
+class mifareClassic_journalWorker : public DeviceWorker {
+public:
+	mifareClassic_journalWorker(Callback *callback, MifareTag tag, TagSession *session, MifareClassicBlockNumber journal,
+	  const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access)
+	: DeviceWorker(callback), tag(tag), journal(journal), outcome(NFF_JOURNAL_CLEAN), error(0),
+	  authenticator(tag, session, keyA, keyB, access) {}
+	~mifareClassic_journalWorker() {}
+
+protected:
+	// Finish the transaction of a pending record, reading only the journal block and the shadow sector
+	int Recover() {
+		MifareClassicBlock block;
+		int result = Read(journal, &block);
+		if(result) {
+			return result;
+		}
+
+		outcome = NFF_JOURNAL_CLEAN;
+		if(ClassicJournal::Blank(block)) {
+			record = ClassicJournal();
+			return 0;
+		}
+		if(!record.Decode(block)) {
+			record = ClassicJournal();
+			outcome = NFF_JOURNAL_TORN;
+			return 0;
+		}
+		if(record.state == NFF_JOURNAL_COMMITTED) {
+			return 0;
+		}
+
+		// A record with a valid CRC may still not come from a journaled write
+		if(!Fits(record.target, record.shadow, record.mask)) {
+			return NFF_ERROR_JOURNAL;
+		}
+
+		std::vector<MifareClassicBlockNumber> blocks = record.Blocks();
+		std::vector<uint8_t> contents(blocks.size() * sizeof(MifareClassicBlock));
+		for(size_t i = 0; i < blocks.size(); i++) {
+			if((result = Read(record.Shadow(blocks[i]), &block))) {
+				return result;
+			}
+			memcpy(&contents[i * sizeof(MifareClassicBlock)], block, sizeof(MifareClassicBlock));
+		}
+		if(ClassicJournal::Crc(contents.data(), contents.size()) != record.crc) {
+			return NFF_ERROR_JOURNAL;
+		}
+		if((result = Commit(blocks, contents.data()))) {
+			return result;
+		}
+		outcome = NFF_JOURNAL_RECOVERED;
+		return 0;
+	}
+
+	// Write the target blocks of a pending record, then mark it committed
+	int Commit(const std::vector<MifareClassicBlockNumber> &blocks, const uint8_t *contents) {
+		int result;
+		for(size_t i = 0; i < blocks.size(); i++) {
+			if((result = Write(blocks[i], contents + i * sizeof(MifareClassicBlock)))) {
+				return result;
+			}
+		}
+
+		MifareClassicBlock block;
+		record.state = NFF_JOURNAL_COMMITTED;
+		record.Encode(&block);
+		return Write(journal, block);
+	}
+
+	// Target and shadow sectors of the tag with the same size, the journal in
+	// a data block of a third sector, and only data blocks in the mask
+	bool Fits(MifareClassicSectorNumber target, MifareClassicSectorNumber shadow, uint16_t mask) const {
+		MifareClassicSectorNumber sectors = (freefare_get_tag_type(tag) == CLASSIC_1K) ? 16 : 40;
+		MifareClassicSectorNumber sector = mifare_classic_block_sector(journal);
+		if(target >= sectors || shadow >= sectors || shadow == target || sector == target || sector == shadow ||
+		  ClassicAccess::Group(journal) == NFF_ACCESS_TRAILER) {
+			return false;
+		}
+
+		// The last block of a sector is its trailer
+		uint16_t length = mifare_classic_sector_last_block(target) - mifare_classic_sector_first_block(target);
+		if(mifare_classic_sector_last_block(shadow) - mifare_classic_sector_first_block(shadow) != length) {
+			return false;
+		}
+		return mask && !(mask >> length);
+	}
+
+	int Read(MifareClassicBlockNumber block, MifareClassicBlock *data) {
+		MifareClassicKeyType keyType;
+		int result = authenticator.Authenticate(block, NFF_ACCESS_READ, &keyType);
+		if(!result && mifare_classic_read(tag, block, data) < 0) {
+			authenticator.Reselect();
+			result = NFF_ERROR_LIBNFC_UNKNOWN;
+		}
+		return result;
+	}
+
+	int Write(MifareClassicBlockNumber block, const uint8_t *data) {
+		MifareClassicKeyType keyType;
+		MifareClassicBlock content;
+		memcpy(content, data, sizeof(MifareClassicBlock));
+		int result = authenticator.Authenticate(block, NFF_ACCESS_WRITE, &keyType);
+		if(!result && mifare_classic_write(tag, block, content) < 0) {
+			authenticator.Reselect();
+			result = NFF_ERROR_LIBNFC_UNKNOWN;
+		}
+		return result;
+	}
+
+	// Our current tag
+	MifareTag tag;
+
+	// Block of the journal record, and the record
+	MifareClassicBlockNumber journal;
+	ClassicJournal record;
+
+	// NFF_JOURNAL_CLEAN, NFF_JOURNAL_RECOVERED or NFF_JOURNAL_TORN
+	int outcome;
+
+	// Error ID or 0
+	int error;
+
+private:
+	ClassicAuthenticator authenticator;
+};
+
+class mifareClassic_recoverJournalWorker : public mifareClassic_journalWorker {
+public:
+	mifareClassic_recoverJournalWorker(Callback *callback, MifareTag tag, TagSession *session, MifareClassicBlockNumber journal,
+	  const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access)
+	: mifareClassic_journalWorker(callback, tag, session, journal, keyA, keyB, access) {}
+	~mifareClassic_recoverJournalWorker() {}
+
+	void Execute () {
+		error = Recover();
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::Number>(outcome),
+			New<v8::Number>(record.version)
+		};
+
+		callback->Call(3, argv);
+	}
+};
+
+class mifareClassic_writeJournaledWorker : public mifareClassic_journalWorker {
+public:
+	mifareClassic_writeJournaledWorker(Callback *callback, MifareTag tag, TagSession *session, std::vector<MifareClassicBlockNumber> blocks,
+	  const unsigned char *data, MifareClassicBlockNumber journal, MifareClassicSectorNumber shadow,
+	  const unsigned char *keyA, const unsigned char *keyB, const ClassicAccess &access)
+	: mifareClassic_journalWorker(callback, tag, session, journal, keyA, keyB, access), blocks(blocks), data(data), shadow(shadow) {}
+	~mifareClassic_writeJournaledWorker() {}
+
+	// The whole transaction runs without yielding, so no other worker sees a half written sector
+	void Execute () {
+		ClassicJournal update;
+		std::vector<MifareClassicBlockNumber> targets;
+		std::vector<uint8_t> contents;
+		if(!Prepare(&update, &targets, &contents)) {
+			error = NFF_ERROR_JOURNAL;
+			return;
+		}
+
+		// A previous transaction torn while pending is finished first
+		if((error = Recover())) {
+			return;
+		}
+		update.version = record.version + 1;
+
+		for(size_t i = 0; i < targets.size(); i++) {
+			if((error = Write(update.Shadow(targets[i]), &contents[i * sizeof(MifareClassicBlock)]))) {
+				return;
+			}
+		}
+
+		MifareClassicBlock block;
+		record = update;
+		record.Encode(&block);
+		if((error = Write(journal, block))) {
+			return;
+		}
+		error = Commit(targets, contents.data());
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			New<v8::Number>(record.version)
+		};
+
+		callback->Call(2, argv);
+	}
+
+private:
+	// Pending record and contents of the blocks in ascending order, false if they do not fit a journaled write
+	bool Prepare(ClassicJournal *update, std::vector<MifareClassicBlockNumber> *targets, std::vector<uint8_t> *contents) const {
+		if(blocks.empty()) {
+			return false;
+		}
+		MifareClassicSectorNumber target = mifare_classic_block_sector(blocks[0]);
+		update->state = NFF_JOURNAL_PENDING;
+		update->target = target;
+		update->shadow = shadow;
+		for(size_t i = 0; i < blocks.size(); i++) {
+			if(mifare_classic_block_sector(blocks[i]) != target) {
+				return false;
+			}
+			int offset = blocks[i] - mifare_classic_sector_first_block(target);
+			if(update->mask & (1 << offset)) {
+				return false;
+			}
+			update->mask |= 1 << offset;
+		}
+		if(!Fits(target, shadow, update->mask)) {
+			return false;
+		}
+
+		*targets = update->Blocks();
+		for(size_t i = 0; i < targets->size(); i++) {
+			size_t index = std::find(blocks.begin(), blocks.end(), (*targets)[i]) - blocks.begin();
+			contents->insert(contents->end(), data + index * sizeof(MifareClassicBlock), data + (index + 1) * sizeof(MifareClassicBlock));
+		}
+		update->crc = ClassicJournal::Crc(contents->data(), contents->size());
+		return true;
+	}
+
+	// Blocks to write, with 16 bytes each kept alive by the persistent handle
+	std::vector<MifareClassicBlockNumber> blocks;
+	const unsigned char *data;
+
+	// Sector holding the new contents until they are committed
+	MifareClassicSectorNumber shadow;
+};
+
+NAN_METHOD(Tag::mifareClassic_writeJournaled) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
+	Callback *callback = new Callback(info[7].As<v8::Function>());
+	mifareClassic_writeJournaledWorker *worker = new mifareClassic_writeJournaledWorker(callback, obj->tag, &obj->session, blockList(info[0]),
+		reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1])), info[2]->Uint32Value(), info[3]->Uint32Value(),
+		optionalKey(info[4]), optionalKey(info[5]), accessMap(info[6]));
+	worker->SaveToPersistent("data", info[1]);
+	obj->Queue(worker);
+}
+
+NAN_METHOD(Tag::mifareClassic_recoverJournal) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
+	Callback *callback = new Callback(info[4].As<v8::Function>());
+	obj->Queue(new mifareClassic_recoverJournalWorker(callback, obj->tag, &obj->session, info[0]->Uint32Value(),
+		optionalKey(info[1]), optionalKey(info[2]), accessMap(info[3])));
+}
 
-class mifareClassic_writeWorker : public AsyncWorker {
+class mifareClassic_writeWorker : public DeviceWorker {
 public:
 	mifareClassic_writeWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block, const MifareClassicBlock data)
-	: AsyncWorker(callback), tag(tag), block(block), error(0) {
+	: DeviceWorker(callback), tag(tag), block(block), error(0) {
 		memcpy(this->data, data, sizeof(MifareClassicBlock));
 	}
 	~mifareClassic_writeWorker() {}
@@ -286,15 +828,16 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_write) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
+	obj->Queue(new mifareClassic_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
 }
 
 
-class mifareClassic_incrementWorker : public AsyncWorker {
+class mifareClassic_incrementWorker : public DeviceWorker {
 public:
 	mifareClassic_incrementWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block, const uint32_t amount)
-	: AsyncWorker(callback), tag(tag), block(block), amount(amount), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), amount(amount), error(0) {}
 	~mifareClassic_incrementWorker() {}
 
 	void Execute () {
@@ -325,16 +868,17 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_increment) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_incrementWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value()));
+	obj->Queue(new mifareClassic_incrementWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value()));
 }
 
 
 
-class mifareClassic_decrementWorker : public AsyncWorker {
+class mifareClassic_decrementWorker : public DeviceWorker {
 public:
 	mifareClassic_decrementWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block, const uint32_t amount)
-	: AsyncWorker(callback), tag(tag), block(block), amount(amount), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), amount(amount), error(0) {}
 	~mifareClassic_decrementWorker() {}
 
 	void Execute () {
@@ -365,15 +909,16 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_decrement) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_decrementWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value()));
+	obj->Queue(new mifareClassic_decrementWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value()));
 }
 
 
-class mifareClassic_restoreWorker : public AsyncWorker {
+class mifareClassic_restoreWorker : public DeviceWorker {
 public:
 	mifareClassic_restoreWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block)
-	: AsyncWorker(callback), tag(tag), block(block), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), error(0) {}
 	~mifareClassic_restoreWorker() {}
 
 	void Execute () {
@@ -403,15 +948,16 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_restore) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_restoreWorker(callback, obj->tag, info[0]->Uint32Value()));
+	obj->Queue(new mifareClassic_restoreWorker(callback, obj->tag, info[0]->Uint32Value()));
 }
 
 
-class mifareClassic_transferWorker : public AsyncWorker {
+class mifareClassic_transferWorker : public DeviceWorker {
 public:
 	mifareClassic_transferWorker(Callback *callback, MifareTag tag, MifareClassicBlockNumber block)
-	: AsyncWorker(callback), tag(tag), block(block), error(0) {}
+	: DeviceWorker(callback), tag(tag), block(block), error(0) {}
 	~mifareClassic_transferWorker() {}
 
 	void Execute () {
@@ -441,6 +987,7 @@ private:
 };
 NAN_METHOD(Tag::mifareClassic_transfer) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareClassic_transferWorker(callback, obj->tag, info[0]->Uint32Value()));
+	obj->Queue(new mifareClassic_transferWorker(callback, obj->tag, info[0]->Uint32Value()));
 }
@@ -3,14 +3,19 @@
 using namespace Nan;
 
 
-class mifareDesfire_connectWorker : public AsyncWorker {
+class mifareDesfire_connectWorker : public DeviceWorker {
 public:
-	mifareDesfire_connectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareDesfire_connectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareDesfire_connectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_desfire_connect(tag);
+		error = session->Connect();
 	}
 
 	void HandleOKCallback () {
@@ -24,8 +29,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -34,18 +39,23 @@ private:
 NAN_METHOD(Tag::mifareDesfire_connect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_connectWorker(callback, obj->tag));
+	obj->Queue(new mifareDesfire_connectWorker(callback, &obj->session));
 }
 
 
-class mifareDesfire_disconnectWorker : public AsyncWorker {
+class mifareDesfire_disconnectWorker : public DeviceWorker {
 public:
-	mifareDesfire_disconnectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareDesfire_disconnectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareDesfire_disconnectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_desfire_disconnect(tag);
+		error = session->Disconnect();
 	}
 
 	void HandleOKCallback () {
@@ -59,8 +69,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -69,18 +79,27 @@ private:
 NAN_METHOD(Tag::mifareDesfire_disconnect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_disconnectWorker(callback, obj->tag));
+	obj->Queue(new mifareDesfire_disconnectWorker(callback, &obj->session));
 }
 
 
-class mifareDesfire_authenticateWorker : public AsyncWorker {
+class mifareDesfire_authenticateWorker : public DeviceWorker {
 public:
-	mifareDesfire_authenticateWorker(Callback *callback, MifareTag tag, const uint8_t key_no, MifareDESFireKey key)
-	: AsyncWorker(callback), tag(tag), key_no(key_no), key(key), error(0) {}
+	mifareDesfire_authenticateWorker(Callback *callback, MifareTag tag, TagSession *session, DesfireFileCache *files, const uint8_t key_no, const uint8_t *key, size_t keyLength)
+	: DeviceWorker(callback), tag(tag), session(session), files(files), key_no(key_no), keyLength(keyLength), error(0) {
+		memcpy(this->key, key, keyLength);
+	}
 	~mifareDesfire_authenticateWorker() {}
 
 	void Execute () {
-		error = mifare_desfire_authenticate(tag, key_no, key);
+		MifareDESFireKey desfireKey = (keyLength == 8) ? mifare_desfire_des_key_new(key) : mifare_desfire_3des_key_new(key);
+		error = mifare_desfire_authenticate(tag, key_no, desfireKey);
+		mifare_desfire_key_free(desfireKey);
+
+		uint32_t aid;
+		if(error >= 0 && files->GetSelected(&aid)) {
+			session->SetCredential(TagSession::DesfireCredential(aid, key_no, key, keyLength));
+		}
 	}
 
 	void HandleOKCallback () {
@@ -97,9 +116,14 @@ private:
 	// Our current tag
 	MifareTag tag;
 
-	// Key
+	// Authentication state and selected application of our tag
+	TagSession *session;
+	DesfireFileCache *files;
+
+	// Key, DES (8 bytes) or 3DES (16 bytes)
 	uint8_t key_no;
-	MifareDESFireKey key;
+	uint8_t key[16];
+	size_t keyLength;
 
 	// Error ID or 0
 	int error;
@@ -108,38 +132,46 @@ private:
 NAN_METHOD(Tag::mifareDesfire_authenticate_des) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 
-	MifareDESFireKey key = mifare_desfire_des_key_new(reinterpret_cast<uint8_t*>(node::Buffer::Data(info[1])));
-
-	AsyncQueueWorker(new mifareDesfire_authenticateWorker(
+	// The key is built by the worker, from a copy
+	obj->Queue(new mifareDesfire_authenticateWorker(
 		new Callback(info[2].As<v8::Function>()),
 		obj->tag,
+		&obj->session,
+		&obj->desfireFiles,
 		info[0]->Uint32Value(),
-		key
+		reinterpret_cast<uint8_t*>(node::Buffer::Data(info[1])),
+		8
 	));
-
-	mifare_desfire_key_free(key);
 }
 NAN_METHOD(Tag::mifareDesfire_authenticate_3des) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 
-	MifareDESFireKey key = mifare_desfire_3des_key_new(reinterpret_cast<uint8_t*>(node::Buffer::Data(info[1])));
-
-	AsyncQueueWorker(new mifareDesfire_authenticateWorker(
+	// The key is built by the worker, from a copy
+	obj->Queue(new mifareDesfire_authenticateWorker(
 		new Callback(info[2].As<v8::Function>()),
 		obj->tag,
+		&obj->session,
+		&obj->desfireFiles,
 		info[0]->Uint32Value(),
-		key
+		reinterpret_cast<uint8_t*>(node::Buffer::Data(info[1])),
+		16
 	));
-
-	mifare_desfire_key_free(key);
 }
 
-class mifareDesfire_getApplicationIdsWorker : public AsyncWorker {
+class mifareDesfire_getApplicationIdsWorker : public DeviceWorker {
 public:
 	mifareDesfire_getApplicationIdsWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	: DeviceWorker(callback), tag(tag), aids(NULL), count(0), error(0) {}
+
+	~mifareDesfire_getApplicationIdsWorker() {
+		if(aids) {
+			mifare_desfire_free_application_ids(aids);
+		}
+	}
 
-	~mifareDesfire_getApplicationIdsWorker() {}
+	std::string Key() const {
+		return "mifareDesfire_getApplicationIds";
+	}
 
 	void Execute () {
 		error = mifare_desfire_get_application_ids(tag, &aids, &count);
@@ -148,19 +180,19 @@ public:
 	void HandleOKCallback () {
 		Nan::HandleScope scope;
 
+		// One uint32 record per application
 		uint32_t aid;
-		v8::Local<v8::Array> results = New<v8::Array>(count);
+		ResultTable results(count, 4);
 		for (uint32_t d = 0; d < count; d++) {
 			aid = 0;
 			memcpy(&aid, reinterpret_cast<uint8_t*>(aids[d]), 3);
 			aid = htole32(aid);
-			Nan::Set(results, New<v8::Number>(d), New<v8::Number>(aid));
+			results.SetUint32(d, 0, aid);
 		}
-		mifare_desfire_free_application_ids(aids);
 
 		v8::Local<v8::Value> argv[] = {
 			New<v8::Number>(error),
-			results,
+			results.Release(),
 		};
 
 		callback->Call(2, argv);
@@ -179,15 +211,15 @@ private:
 NAN_METHOD(Tag::mifareDesfire_getApplicationIds) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_getApplicationIdsWorker(callback, obj->tag));
+	obj->Queue(new mifareDesfire_getApplicationIdsWorker(callback, obj->tag));
 }
 
 
 
-class mifareDesfire_selectApplicationWorker : public AsyncWorker {
+class mifareDesfire_selectApplicationWorker : public DeviceWorker {
 public:
-	mifareDesfire_selectApplicationWorker(Callback *callback, MifareTag tag, uint8_t *aid)
-	: AsyncWorker(callback), tag(tag), error(0) {
+	mifareDesfire_selectApplicationWorker(Callback *callback, MifareTag tag, DesfireFileCache *files, uint8_t *aid)
+	: DeviceWorker(callback), tag(tag), files(files), error(0) {
 		this->aid = aid[2] | (aid[1]<<8) | (aid[0]<<16);
 	}
 
@@ -196,6 +228,12 @@ public:
 
 	void Execute () {
 		error = mifare_desfire_select_application(tag, mifare_desfire_aid_new(aid));
+		if(error >= 0) {
+			files->Select(aid);
+		}
+		else {
+			files->Reset();
+		}
 	}
 
 	void HandleOKCallback () {
@@ -211,6 +249,9 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// File settings cache of the tag
+	DesfireFileCache *files;
+
 	uint32_t aid;
 
 	// Error ID or 0
@@ -220,18 +261,24 @@ private:
 NAN_METHOD(Tag::mifareDesfire_selectApplication) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_selectApplicationWorker(callback, obj->tag, reinterpret_cast<unsigned char*>(node::Buffer::Data(info[0]))));
+	obj->Queue(new mifareDesfire_selectApplicationWorker(callback, obj->tag, &obj->desfireFiles, reinterpret_cast<unsigned char*>(node::Buffer::Data(info[0]))));
 }
 
 
 
 
-class mifareDesfire_getFileIdsWorker : public AsyncWorker {
+class mifareDesfire_getFileIdsWorker : public DeviceWorker {
 public:
 	mifareDesfire_getFileIdsWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	: DeviceWorker(callback), tag(tag), files(NULL), count(0), error(0) {}
+
+	~mifareDesfire_getFileIdsWorker() {
+		free(files);
+	}
 
-	~mifareDesfire_getFileIdsWorker() {}
+	std::string Key() const {
+		return "mifareDesfire_getFileIds";
+	}
 
 	void Execute () {
 		error = mifare_desfire_get_file_ids(tag, &files, &count);
@@ -240,14 +287,15 @@ public:
 	void HandleOKCallback () {
 		Nan::HandleScope scope;
 
-		v8::Local<v8::Array> results = New<v8::Array>(count);
+		// One uint8 record per file
+		ResultTable results(count, 1);
 		for (uint32_t d = 0; d < count; d++) {
-			Nan::Set(results, New<v8::Number>(d), New<v8::Number>(files[d]));
+			results.SetUint8(d, 0, files[d]);
 		}
 
 		v8::Local<v8::Value> argv[] = {
 			New<v8::Number>(error),
-			results,
+			results.Release(),
 		};
 
 		callback->Call(2, argv);
@@ -266,33 +314,117 @@ private:
 NAN_METHOD(Tag::mifareDesfire_getFileIds) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_getFileIdsWorker(callback, obj->tag));
+	obj->Queue(new mifareDesfire_getFileIdsWorker(callback, obj->tag));
 }
 
 
-class mifareDesfire_readWorker : public AsyncWorker {
+/*
+* Read count bytes of a file in commands of chunk bytes (0 for a single one),
+* returns the number of bytes read or the error
+*/
+static ssize_t readChunked(MifareTag tag, uint8_t file, off_t offset, size_t count, uint8_t *data, size_t chunk) {
+	if(!chunk) {
+		chunk = count;
+	}
+	size_t done = 0;
+	while(done < count) {
+		size_t length = std::min(chunk, count - done);
+		ssize_t bytes = mifare_desfire_read_data(tag, file, offset + done, length, data + done);
+		if(bytes < 0) {
+			return bytes;
+		}
+		done += bytes;
+		if((size_t) bytes < length) {
+			break;
+		}
+	}
+	return done;
+}
+
+class mifareDesfire_readWorker : public DeviceWorker {
 public:
-	mifareDesfire_readWorker(Callback *callback, MifareTag tag, uint8_t file, off_t offset, size_t length)
-	: AsyncWorker(callback), tag(tag), file(file), offset(offset), length(length), error(0) {}
-	~mifareDesfire_readWorker() {}
+	mifareDesfire_readWorker(Callback *callback, MifareTag tag, TagSession *session, DesfireFileCache *files, PrefetchCache *prefetched,
+	  uint8_t file, off_t offset, size_t length, size_t chunkSize)
+	: DeviceWorker(callback), tag(tag), session(session), files(files), prefetched(prefetched), file(file), offset(offset), length(length),
+	  chunkSize(chunkSize), data(NULL), allocated(0), error(0) {}
+	~mifareDesfire_readWorker() {
+		free(data);
+		NativeMemory::Released(NFF_MEMORY_BUFFERS, allocated);
+	}
+
+	bool Range(std::string *space, uint32_t *start, uint32_t *end) const {
+		*space = "mifareDesfire_file:" + std::to_string(file);
+		*start = offset;
+		*end = length ? offset + length : UINT32_MAX;
+		return true;
+	}
+
+	bool Extend(uint32_t start, uint32_t end) {
+		offset = start;
+		length = (end == UINT32_MAX) ? 0 : end - start;
+		return true;
+	}
+
+	bool KeepsCredential() const {
+		return true;
+	}
 
 	void Execute () {
-		data = (uint8_t*) malloc((length+1)*sizeof(uint8_t));
-		error = mifare_desfire_read_data(tag, file, offset, length, data);
+		// Prefetched in the application now selected, with the key now authenticated if one was needed
+		uint32_t aid;
+		std::string cached;
+		if(files->GetSelected(&aid) && prefetched->Lookup("mifareDesfire_file:" + std::to_string(file), aid, offset,
+		  length ? offset + length : 0, 1, session->Credential(), &cached)) {
+			data = (uint8_t*) malloc(cached.size() + 1);
+			if(!data) {
+				error = -1;
+				return;
+			}
+			allocated = cached.size() + 1;
+			NativeMemory::Allocated(NFF_MEMORY_BUFFERS, allocated);
+			memcpy(data, cached.data(), cached.size());
+			error = cached.size();
+			return;
+		}
+
+		// A zero length means the whole file, starting at offset
+		size_t count = length;
+		if(count == 0) {
+			ssize_t size = files->GetFileSize(tag, file);
+			if(size < 0) {
+				error = size;
+				return;
+			}
+			if(size <= offset) {
+				return;
+			}
+			count = size - offset;
+		}
+
+		data = (uint8_t*) malloc((count+1)*sizeof(uint8_t));
+		allocated = count + 1;
+		NativeMemory::Allocated(NFF_MEMORY_BUFFERS, allocated);
+		error = readChunked(tag, file, offset, count, data, chunkSize);
+
+		// DESFire cards drop the authentication on errors
+		if(error < 0) {
+			session->SetCredential(std::string());
+		}
 	}
 
 	void HandleOKCallback () {
 		Nan::HandleScope scope;
 
+		// Positive error is the number of bytes read, from which this callback gets its range
 		v8::Local<v8::Value> buf = Null();
-		if(error > 0) {
-			buf =  Nan::CopyBuffer(reinterpret_cast<char*>(data), length).ToLocalChecked();
-			error = 0;
+		if(error >= 0) {
+			size_t from = std::min<size_t>(callbackStart - offset, error);
+			size_t to = std::min<size_t>((size_t) callbackEnd - offset, error);
+			buf =  Nan::CopyBuffer(reinterpret_cast<char*>(data) + from, to - from).ToLocalChecked();
 		}
-		free(data);
 
 		v8::Local<v8::Value> argv[] = {
-			New<v8::Number>(error),
+			New<v8::Number>(error < 0 ? error : 0),
 			buf
 		};
 
@@ -303,11 +435,27 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Authentication state of the tag
+	TagSession *session;
+
+	// File settings cache of the tag
+	DesfireFileCache *files;
+
+	// Data read on arrival
+	PrefetchCache *prefetched;
+
 	uint8_t file;
 	off_t offset;
 	size_t length;
+
+	// Bytes read per command, 0 for all
+	size_t chunkSize;
+
 	uint8_t* data;
 
+	// Size of data
+	size_t allocated;
+
 	// Error ID or 0
 	int error;
 
@@ -315,15 +463,22 @@ private:
 NAN_METHOD(Tag::mifareDesfire_read) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[3].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_readWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value(), info[2]->Uint32Value()));
+	uint32_t file = info[0]->Uint32Value();
+	uint32_t offset = info[1]->Uint32Value();
+	uint32_t length = info[2]->Uint32Value();
+	obj->Queue(new mifareDesfire_readWorker(callback, obj->tag, &obj->session, &obj->desfireFiles, &obj->prefetched, file, offset, length,
+		obj->profile ? obj->profile->chunkSize : 0));
 }
 
 
-class mifareDesfire_writeWorker : public AsyncWorker {
+class mifareDesfire_writeWorker : public DeviceWorker {
 public:
-	mifareDesfire_writeWorker(Callback *callback, MifareTag tag, uint8_t file, off_t offset, size_t length, uint8_t *data)
-	: AsyncWorker(callback), tag(tag), file(file), offset(offset), length(length), error(0) {
-		memcpy(this->data, data, length);
+	mifareDesfire_writeWorker(Callback *callback, MifareTag tag, uint8_t file, off_t offset, size_t length, v8::Local<v8::Object> buffer)
+	: DeviceWorker(callback), tag(tag), file(file), offset(offset), error(0) {
+		// The buffer is pinned for the worker lifetime and written without copy
+		SaveToPersistent("data", buffer);
+		data = reinterpret_cast<uint8_t*>(node::Buffer::Data(buffer));
+		this->length = std::min(length, node::Buffer::Length(buffer));
 	}
 	~mifareDesfire_writeWorker() {}
 
@@ -342,10 +497,10 @@ public:
 
 		v8::Local<v8::Value> argv[] = {
 			New<v8::Number>(error),
-			New<v8::Number>(count),
+			New<v8::Number>(count)
 		};
 
-		callback->Call(1, argv);
+		callback->Call(2, argv);
 	}
 private:
 
@@ -355,6 +510,8 @@ private:
 	uint8_t file;
 	off_t offset;
 	size_t length;
+
+	// Memory of the caller buffer
 	uint8_t* data;
 
 	// Error ID or 0
@@ -363,6 +520,300 @@ private:
 };
 NAN_METHOD(Tag::mifareDesfire_write) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[4].As<v8::Function>());
-	AsyncQueueWorker(new mifareDesfire_writeWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value(), info[2]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[3]))));
+	obj->Queue(new mifareDesfire_writeWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value(), info[2]->Uint32Value(), info[3]->ToObject()));
+}
+
+
+/**
+* Read several files, possibly across applications, in one worker
+*
+* The result is a single buffer made of an index table followed by the payloads:
+*   uint32 count
+*   count * { int32 error, uint32 offset, uint32 length }   (in request order)
+*   payloads
+* All integers are little endian.
+*/
+struct mifareDesfire_fileRead {
+	// Position of the request in the caller list
+	uint32_t index;
+
+	// Application
+	uint32_t aid;
+
+	// Key (keyLength is 0 when no authentication is required)
+	uint8_t keyNo;
+	uint8_t key[16];
+	size_t keyLength;
+
+	// Data to read
+	uint8_t file;
+	off_t offset;
+	size_t length;
+};
+
+#define NFF_DESFIRE_READFILES_HEADER_SIZE 4
+#define NFF_DESFIRE_READFILES_ENTRY_SIZE 12
+
+class mifareDesfire_readFilesWorker : public DeviceWorker {
+public:
+	mifareDesfire_readFilesWorker(Callback *callback, MifareTag tag, DesfireFileCache *files, std::vector<mifareDesfire_fileRead> requests, size_t chunkSize)
+	: DeviceWorker(callback), tag(tag), files(files), requests(requests), chunkSize(chunkSize), position(0),
+	  errors(NULL), offsets(NULL), data(NULL), size(0), error(0) {}
+	~mifareDesfire_readFilesWorker() {
+		if(data) {
+			free(data);
+			NativeMemory::Released(NFF_MEMORY_BUFFERS, size);
+		}
+	}
+
+	void Execute () {
+		// Executed again after yielding to a more urgent worker
+		if(!data) {
+			prepare();
+			if(error < 0) {
+				return;
+			}
+		}
+		readFiles();
+	}
+
+	void HandleOKCallback () {
+		Nan::HandleScope scope;
+
+		v8::Local<v8::Value> buf = Null();
+		if(error >= 0 && data) {
+			// Node takes ownership of the memory
+			buf = Nan::NewBuffer(reinterpret_cast<char*>(data), size).ToLocalChecked();
+			NativeMemory::Released(NFF_MEMORY_BUFFERS, size);
+			data = NULL;
+		}
+
+		v8::Local<v8::Value> argv[] = {
+			New<v8::Number>(error),
+			buf
+		};
+
+		callback->Call(2, argv);
+	}
+private:
+
+	// Order the requests and allocate the result
+	void prepare() {
+		size_t count = requests.size();
+		errors = arena.New<int>(count);
+		offsets = arena.New<uint32_t>(count);
+		size_t *lengths = arena.New<size_t>(count);
+		if(count && (!errors || !offsets || !lengths)) {
+			error = -1;
+			return;
+		}
+		std::fill(errors, errors + count, 0);
+
+		// Group requests by application then by key, so each application is
+		// selected once and each key is used for one authentication
+		std::stable_sort(requests.begin(), requests.end(),
+		[](const mifareDesfire_fileRead &a, const mifareDesfire_fileRead &b) {
+			if(a.aid != b.aid) return a.aid < b.aid;
+			if(a.keyNo != b.keyNo) return a.keyNo < b.keyNo;
+			if(a.keyLength != b.keyLength) return a.keyLength < b.keyLength;
+			return memcmp(a.key, b.key, a.keyLength) < 0;
+		});
+
+		// Resolve whole file reads (length 0) before allocating. Applications
+		// are visited backward so the first one to read is left selected.
+		for (size_t i = count; i-- > 0;) {
+			mifareDesfire_fileRead &request = requests[i];
+			if(request.length > 0) {
+				continue;
+			}
+			if(!files->IsSelected(request.aid) || !files->HasSettings(request.file)) {
+				int result = selectApplication(request.aid);
+				if(result < 0) {
+					errors[request.index] = result;
+					continue;
+				}
+			}
+			ssize_t fileSize = files->GetFileSize(tag, request.file);
+			if(fileSize < 0) {
+				errors[request.index] = fileSize;
+				continue;
+			}
+			request.length = (fileSize > request.offset) ? fileSize - request.offset : 0;
+		}
+
+		// Allocate the whole result once, payloads are laid out in request order
+		for (size_t i = 0; i < count; i++) {
+			lengths[requests[i].index] = requests[i].length;
+		}
+		size = NFF_DESFIRE_READFILES_HEADER_SIZE + count * NFF_DESFIRE_READFILES_ENTRY_SIZE;
+		for (size_t i = 0; i < count; i++) {
+			offsets[i] = size;
+			size += lengths[i];
+		}
+		data = (uint8_t*) malloc(size);
+		if(!data) {
+			error = -1;
+			return;
+		}
+		NativeMemory::Allocated(NFF_MEMORY_BUFFERS, size);
+		writeUint32(data, count);
+	}
+
+	// Read the files, from the current position
+	void readFiles() {
+		size_t count = requests.size();
+		size_t start = position;
+
+		// A preempting worker may have changed the selection or authentication
+		const mifareDesfire_fileRead *authenticated = NULL;
+		int selectError = 0;
+		int authError = 0;
+		for (; position < count; position++) {
+			size_t i = position;
+			const mifareDesfire_fileRead &request = requests[i];
+			uint8_t *entry = data + NFF_DESFIRE_READFILES_HEADER_SIZE + request.index * NFF_DESFIRE_READFILES_ENTRY_SIZE;
+			int result = errors[request.index];
+
+			if(i > start && ShouldYield()) {
+				Yield();
+				return;
+			}
+
+			// After a yield the selection is redone even if cached, it also resets the authentication
+			if(i == start || requests[i-1].aid != request.aid) {
+				selectError = selectApplication(request.aid, i == start && start > 0);
+				authenticated = NULL;
+			}
+
+			if(result < 0) {
+				// Nothing to do, size resolution failed
+			}
+			else if(selectError < 0) {
+				result = selectError;
+			}
+			else if(request.keyLength > 0) {
+				if(!authenticated || !sameKey(*authenticated, request)) {
+					MifareDESFireKey key = (request.keyLength == 8) ?
+						mifare_desfire_des_key_new(request.key) :
+						mifare_desfire_3des_key_new(request.key);
+					authError = mifare_desfire_authenticate(tag, request.keyNo, key);
+					mifare_desfire_key_free(key);
+					authenticated = &request;
+				}
+				result = authError;
+			}
+
+			if(result >= 0 && request.length > 0) {
+				ssize_t bytes = readChunked(tag, request.file, request.offset, request.length, data + offsets[request.index], chunkSize);
+				result = (bytes < 0) ? (int)bytes : 0;
+			}
+			else if(result > 0) {
+				result = 0;
+			}
+
+			writeUint32(entry, (uint32_t)result);
+			writeUint32(entry + 4, offsets[request.index]);
+			writeUint32(entry + 8, (result < 0) ? 0 : request.length);
+		}
+	}
+
+	// Select an application unless it is already selected, or always when forced
+	int selectApplication(uint32_t aid, bool force = false) {
+		if(!force && files->IsSelected(aid)) {
+			return 0;
+		}
+
+		MifareDESFireAID desfireAid = mifare_desfire_aid_new(aid);
+		int result = mifare_desfire_select_application(tag, desfireAid);
+		free(desfireAid);
+
+		if(result < 0) {
+			files->Reset();
+		}
+		else {
+			files->Select(aid);
+		}
+		return result;
+	}
+
+	static void writeUint32(uint8_t *dst, uint32_t value) {
+		value = htole32(value);
+		memcpy(dst, &value, sizeof(value));
+	}
+
+	static bool sameKey(const mifareDesfire_fileRead &a, const mifareDesfire_fileRead &b) {
+		return a.keyNo == b.keyNo
+			&& a.keyLength == b.keyLength
+			&& memcmp(a.key, b.key, a.keyLength) == 0;
+	}
+
+	// Our current tag
+	MifareTag tag;
+
+	// File settings cache of the tag
+	DesfireFileCache *files;
+
+	// Requested reads, sorted once prepared
+	std::vector<mifareDesfire_fileRead> requests;
+
+	// Bytes read per command, 0 for all
+	size_t chunkSize;
+
+	size_t position;
+
+	// Intermediates of the batch, released with the worker
+	Arena arena;
+
+	// Size resolution error and payload offset, by request index, in the arena
+	int *errors;
+	uint32_t *offsets;
+
+	// Index table and payloads
+	uint8_t* data;
+	size_t size;
+
+	// Error ID or 0
+	int error;
+
+};
+NAN_METHOD(Tag::mifareDesfire_readFiles) {
+	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+
+	v8::Local<v8::Array> list = info[0].As<v8::Array>();
+	std::vector<mifareDesfire_fileRead> requests(list->Length());
+	for (uint32_t i = 0; i < list->Length(); i++) {
+		v8::Local<v8::Object> item = Nan::Get(list, i).ToLocalChecked()->ToObject();
+		mifareDesfire_fileRead &request = requests[i];
+
+		request.index = i;
+
+		// Application ID, most significant byte first
+		v8::Local<v8::Value> aidBuffer = Nan::Get(item, Nan::New("aid").ToLocalChecked()).ToLocalChecked();
+		if(!node::Buffer::HasInstance(aidBuffer) || node::Buffer::Length(aidBuffer) < 3) {
+			return Nan::ThrowTypeError("readFiles aid must be a Buffer of 3 bytes");
+		}
+		uint8_t *aid = reinterpret_cast<uint8_t*>(node::Buffer::Data(aidBuffer));
+		request.aid = aid[2] | (aid[1]<<8) | (aid[0]<<16);
+
+		request.keyLength = 0;
+		v8::Local<v8::Value> key = Nan::Get(item, Nan::New("key").ToLocalChecked()).ToLocalChecked();
+		if(node::Buffer::HasInstance(key)) {
+			// DES or 3DES key, anything else would be read past its end or truncated
+			request.keyLength = node::Buffer::Length(key);
+			if(request.keyLength != 8 && request.keyLength != 16) {
+				return Nan::ThrowTypeError("readFiles key must be 8 (DES) or 16 (3DES) bytes long");
+			}
+			memcpy(request.key, node::Buffer::Data(key), request.keyLength);
+		}
+		request.keyNo = Nan::Get(item, Nan::New("keyNo").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+
+		request.file = Nan::Get(item, Nan::New("file").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+		request.offset = Nan::Get(item, Nan::New("offset").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+		request.length = Nan::Get(item, Nan::New("length").ToLocalChecked()).ToLocalChecked()->Uint32Value();
+	}
+
+	Callback *callback = new Callback(info[1].As<v8::Function>());
+	obj->Queue(new mifareDesfire_readFilesWorker(callback, obj->tag, &obj->desfireFiles, requests, obj->profile ? obj->profile->chunkSize : 0));
 }
@@ -3,14 +3,19 @@
 using namespace Nan;
 
 
-class mifareUltralight_connectWorker : public AsyncWorker {
+class mifareUltralight_connectWorker : public DeviceWorker {
 public:
-	mifareUltralight_connectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareUltralight_connectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareUltralight_connectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_ultralight_connect(tag);
+		error = session->Connect();
 	}
 
 	void HandleOKCallback () {
@@ -24,8 +29,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -34,18 +39,23 @@ private:
 NAN_METHOD(Tag::mifareUltralight_connect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareUltralight_connectWorker(callback, obj->tag));
+	obj->Queue(new mifareUltralight_connectWorker(callback, &obj->session));
 }
 
 
-class mifareUltralight_disconnectWorker : public AsyncWorker {
+class mifareUltralight_disconnectWorker : public DeviceWorker {
 public:
-	mifareUltralight_disconnectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	mifareUltralight_disconnectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~mifareUltralight_disconnectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = mifare_ultralight_disconnect(tag);
+		error = session->Disconnect();
 	}
 
 	void HandleOKCallback () {
@@ -59,8 +69,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -69,17 +79,33 @@ private:
 NAN_METHOD(Tag::mifareUltralight_disconnect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new mifareUltralight_disconnectWorker(callback, obj->tag));
+	obj->Queue(new mifareUltralight_disconnectWorker(callback, &obj->session));
 }
 
 
-class mifareUltralight_readWorker : public AsyncWorker {
+class mifareUltralight_readWorker : public DeviceWorker {
 public:
-	mifareUltralight_readWorker(Callback *callback, MifareTag tag, MifareUltralightPageNumber page)
-	: AsyncWorker(callback), tag(tag), page(page), error(0) {}
+	mifareUltralight_readWorker(Callback *callback, MifareTag tag, PrefetchCache *prefetched, MifareUltralightPageNumber page)
+	: DeviceWorker(callback), tag(tag), prefetched(prefetched), page(page), error(0) {}
 	~mifareUltralight_readWorker() {}
 
+	bool KeepsCredential() const {
+		return true;
+	}
+
+	bool Range(std::string *space, uint32_t *start, uint32_t *end) const {
+		*space = "mifareUltralight_page";
+		*start = page;
+		*end = page + 1;
+		return true;
+	}
+
 	void Execute () {
+		std::string cached;
+		if(prefetched->Lookup("mifareUltralight_page", 0, page, page + 1, 4, std::string(), &cached)) {
+			memcpy(data, cached.data(), sizeof(data));
+			return;
+		}
 		error = mifare_ultralight_read(tag, page, &data);
 	}
 
@@ -100,6 +126,9 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Data read on arrival
+	PrefetchCache *prefetched;
+
 	// Page to read
 	MifareUltralightPageNumber page;
 
@@ -113,14 +142,15 @@ private:
 NAN_METHOD(Tag::mifareUltralight_read) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new mifareUltralight_readWorker(callback, obj->tag, info[0]->Uint32Value()));
+	uint32_t page = info[0]->Uint32Value();
+	obj->Queue(new mifareUltralight_readWorker(callback, obj->tag, &obj->prefetched, page));
 }
 
 
-class mifareUltralight_writeWorker : public AsyncWorker {
+class mifareUltralight_writeWorker : public DeviceWorker {
 public:
 	mifareUltralight_writeWorker(Callback *callback, MifareTag tag, MifareUltralightPageNumber page, MifareUltralightPage data)
-	: AsyncWorker(callback), tag(tag), page(page), error(0) {
+	: DeviceWorker(callback), tag(tag), page(page), error(0) {
 		memcpy(this->data, data, sizeof(this->data));
 	}
 	~mifareUltralight_writeWorker() {}
@@ -155,6 +185,7 @@ private:
 };
 NAN_METHOD(Tag::mifareUltralight_write) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new mifareUltralight_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
+	obj->Queue(new mifareUltralight_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
 }
@@ -3,17 +3,19 @@
 using namespace Nan;
 
 
-class ntag21x_connectWorker : public AsyncWorker {
+class ntag21x_connectWorker : public DeviceWorker {
 public:
-	ntag21x_connectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	ntag21x_connectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~ntag21x_connectWorker() {}
 
-	void Execute () {
-		error = ntag21x_connect(tag);
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
 
-		// TODO: implement error handling
-		ntag21x_get_info(tag);
+	void Execute () {
+		error = session->Connect();
 	}
 
 	void HandleOKCallback () {
@@ -27,8 +29,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -37,18 +39,23 @@ private:
 NAN_METHOD(Tag::ntag21x_connect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_connectWorker(callback, obj->tag));
+	obj->Queue(new ntag21x_connectWorker(callback, &obj->session));
 }
 
 
-class ntag21x_disconnectWorker : public AsyncWorker {
+class ntag21x_disconnectWorker : public DeviceWorker {
 public:
-	ntag21x_disconnectWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	ntag21x_disconnectWorker(Callback *callback, TagSession *session)
+	: DeviceWorker(callback), session(session), error(0) {}
 	~ntag21x_disconnectWorker() {}
 
+	// Connection workers manage the session themselves
+	bool NeedsSession() const {
+		return false;
+	}
+
 	void Execute () {
-		error = ntag21x_disconnect(tag);
+		error = session->Disconnect();
 	}
 
 	void HandleOKCallback () {
@@ -62,8 +69,8 @@ public:
 	}
 private:
 
-	// Our current tag
-	MifareTag tag;
+	// Connection state of our tag
+	TagSession *session;
 
 	// Error ID or 0
 	int error;
@@ -72,17 +79,33 @@ private:
 NAN_METHOD(Tag::ntag21x_disconnect) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_disconnectWorker(callback, obj->tag));
+	obj->Queue(new ntag21x_disconnectWorker(callback, &obj->session));
 }
 
 
-class ntag21x_readWorker : public AsyncWorker {
+class ntag21x_readWorker : public DeviceWorker {
 public:
-	ntag21x_readWorker(Callback *callback, MifareTag tag, uint8_t page)
-	: AsyncWorker(callback), tag(tag), page(page), error(0) {}
+	ntag21x_readWorker(Callback *callback, MifareTag tag, PrefetchCache *prefetched, uint8_t page)
+	: DeviceWorker(callback), tag(tag), prefetched(prefetched), page(page), error(0) {}
 	~ntag21x_readWorker() {}
 
+	bool KeepsCredential() const {
+		return true;
+	}
+
+	bool Range(std::string *space, uint32_t *start, uint32_t *end) const {
+		*space = "ntag21x_page";
+		*start = page;
+		*end = page + 1;
+		return true;
+	}
+
 	void Execute () {
+		std::string cached;
+		if(prefetched->Lookup("ntag21x_page", 0, page, page + 1, 4, std::string(), &cached)) {
+			memcpy(data, cached.data(), sizeof(data));
+			return;
+		}
 		error = ntag21x_read4(tag, page, &data[0]);
 	}
 
@@ -103,6 +126,9 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Data read on arrival
+	PrefetchCache *prefetched;
+
 	// Page to read
 	uint8_t page;
 
@@ -116,42 +142,80 @@ private:
 NAN_METHOD(Tag::ntag21x_read4) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[1].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_readWorker(callback, obj->tag, info[0]->Uint32Value()));
+	uint32_t page = info[0]->Uint32Value();
+	obj->Queue(new ntag21x_readWorker(callback, obj->tag, &obj->prefetched, page));
 }
 
 // ntag21x_fast_read
 
-class ntag21x_fastReadWorker : public AsyncWorker {
+class ntag21x_fastReadWorker : public DeviceWorker {
 public:
-	ntag21x_fastReadWorker(Callback *callback, MifareTag tag, uint8_t start_page, uint8_t end_page)
-	: AsyncWorker(callback), tag(tag), start_page(start_page), end_page(end_page), error(0) {}
-	~ntag21x_fastReadWorker() {}
+	ntag21x_fastReadWorker(Callback *callback, MifareTag tag, PrefetchCache *prefetched, uint8_t start_page, uint8_t end_page, uint32_t maxPages)
+	: DeviceWorker(callback), tag(tag), prefetched(prefetched), start_page(start_page), end_page(end_page), maxPages(maxPages), data(NULL), error(0) {
+		// avoid this for now
+		if(start_page > end_page) {
+			this->end_page = start_page;
+		}
+	}
+	~ntag21x_fastReadWorker() {
+		if(data) {
+			free(data);
+			NativeMemory::Released(NFF_MEMORY_BUFFERS, length + 1);
+		}
+	}
+
+	bool Range(std::string *space, uint32_t *start, uint32_t *end) const {
+		*space = "ntag21x_page";
+		*start = start_page;
+		*end = end_page + 1;
+		return true;
+	}
+
+	bool Extend(uint32_t start, uint32_t end) {
+		if(end - 1 > 0xff) {
+			return false;
+		}
+		start_page = start;
+		end_page = end - 1;
+		return true;
+	}
+
+	bool KeepsCredential() const {
+		return true;
+	}
 
 	void Execute () {
-		// avoid this for now
-		if(start_page > end_page) {			
-			end_page = start_page;
-		}				
-		
 		int no_pages = end_page - start_page + 1;
 		length = no_pages * 4;
 		
 		data = (uint8_t*) malloc((length*sizeof(uint8_t))+1);
-		error = ntag21x_fast_read(tag, start_page, end_page, data);
+		NativeMemory::Allocated(NFF_MEMORY_BUFFERS, length + 1);
+
+		std::string cached;
+		if(data && prefetched->Lookup("ntag21x_page", 0, start_page, end_page + 1, 4, std::string(), &cached)) {
+			memcpy(data, cached.data(), length);
+			return;
+		}
+
+		// Split in reads the reader answers in one frame
+		uint32_t chunk = maxPages ? maxPages : no_pages;
+		for(uint32_t page = start_page; page <= end_page && error >= 0; page += chunk) {
+			uint32_t last = std::min<uint32_t>(page + chunk - 1, end_page);
+			error = ntag21x_fast_read(tag, page, last, data + (page - start_page) * 4);
+		}
 	}
 
 	void HandleOKCallback () {
 		Nan::HandleScope scope;
 
-		Nan::MaybeLocal<v8::Object> buf =  Nan::CopyBuffer(reinterpret_cast<char*>(data), length);	
+		// Pages requested by this callback
+		Nan::MaybeLocal<v8::Object> buf =  Nan::CopyBuffer(reinterpret_cast<char*>(data) + (callbackStart - start_page) * 4, (callbackEnd - callbackStart) * 4);
 	
 		v8::Local<v8::Value> argv[] = {
 			New<v8::Number>(error),
 			buf.ToLocalChecked()
 		};
 
-		free(data);
-
 		callback->Call(2, argv);
 	}
 private:
@@ -159,12 +223,18 @@ private:
 	// Our current tag
 	MifareTag tag;
 
+	// Data read on arrival
+	PrefetchCache *prefetched;
+
 	// Page to read
 	uint8_t start_page;
 
 	// Page to read
 	uint8_t end_page;
 
+	// Pages read at once, 0 for all
+	uint32_t maxPages;
+
 	// Page content
 	uint8_t* data;
 
@@ -178,14 +248,16 @@ private:
 NAN_METHOD(Tag::ntag21x_fast_read) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());	
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_fastReadWorker(callback, obj->tag, info[0]->Uint32Value(), info[1]->Uint32Value()));
+	uint32_t start = info[0]->Uint32Value();
+	uint32_t end = std::max(start, info[1]->Uint32Value());
+	obj->Queue(new ntag21x_fastReadWorker(callback, obj->tag, &obj->prefetched, start, end, obj->profile ? obj->profile->maxPages : 0));
 }
 
 
-class ntag21x_writeWorker : public AsyncWorker {
+class ntag21x_writeWorker : public DeviceWorker {
 public:
 	ntag21x_writeWorker(Callback *callback, MifareTag tag, uint8_t page, uint8_t data[4])
-	: AsyncWorker(callback), tag(tag), page(page), error(0) {
+	: DeviceWorker(callback), tag(tag), page(page), error(0) {
 		memcpy(this->data, data, sizeof(this->data));
 	}
 	~ntag21x_writeWorker() {}
@@ -220,17 +292,22 @@ private:
 };
 NAN_METHOD(Tag::ntag21x_write) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
+	obj->prefetched.Clear();
 	Callback *callback = new Callback(info[2].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
+	obj->Queue(new ntag21x_writeWorker(callback, obj->tag, info[0]->Uint32Value(), reinterpret_cast<unsigned char*>(node::Buffer::Data(info[1]))));
 }
 
-class ntag21x_getSubTypeWorker : public AsyncWorker {
+class ntag21x_getSubTypeWorker : public DeviceWorker {
 public:
 	ntag21x_getSubTypeWorker(Callback *callback, MifareTag tag)
-	: AsyncWorker(callback), tag(tag), error(0) {}
+	: DeviceWorker(callback), tag(tag), error(0) {}
 
 	~ntag21x_getSubTypeWorker() {}
 
+	std::string Key() const {
+		return "ntag21x_get_subtype";
+	}
+
 	void Execute () {
 		ntag_tag_subtype st = ntag21x_get_subtype(tag);
 		switch(st) {
@@ -274,6 +351,6 @@ private:
 NAN_METHOD(Tag::ntag21x_get_subtype) {
 	Tag* obj = ObjectWrap::Unwrap<Tag>(info.This());
 	Callback *callback = new Callback(info[0].As<v8::Function>());
-	AsyncQueueWorker(new ntag21x_getSubTypeWorker(callback, obj->tag));
+	obj->Queue(new ntag21x_getSubTypeWorker(callback, obj->tag));
 }
 
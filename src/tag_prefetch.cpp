@@ -0,0 +1,208 @@
+#include "tag_prefetch.h"
+#include "memory.h"
+#include "tag_session.h"
+
+static void prefetchUltralight(MifareTag tag, const PrefetchEntry &entry, PrefetchCache *cache) {
+	if(mifare_ultralight_connect(tag) < 0) {
+		return;
+	}
+	for(uint32_t page = entry.start; page < entry.start + entry.count; page++) {
+		MifareUltralightPage data;
+		if(mifare_ultralight_read(tag, page, &data) < 0) {
+			break;
+		}
+		cache->Store("mifareUltralight_page", 0, page, 4, data, sizeof(data), false, std::string());
+	}
+	mifare_ultralight_disconnect(tag);
+}
+
+static void prefetchNtag21x(MifareTag tag, const PrefetchEntry &entry, PrefetchCache *cache, Arena *arena) {
+	if(!entry.count || ntag21x_connect(tag) < 0) {
+		return;
+	}
+	uint8_t *data = arena->New<uint8_t>(entry.count * 4);
+	if(data && ntag21x_fast_read(tag, entry.start, entry.start + entry.count - 1, data) >= 0) {
+		cache->Store("ntag21x_page", 0, entry.start, 4, data, entry.count * 4, false, std::string());
+	}
+	ntag21x_disconnect(tag);
+}
+
+static void prefetchClassic(MifareTag tag, const PrefetchEntry &entry, PrefetchCache *cache) {
+	if(!entry.count || mifare_classic_connect(tag) < 0) {
+		return;
+	}
+
+	// Authenticate again on each sector
+	int sector = -1;
+	for(uint32_t block = entry.start; block < entry.start + entry.count; block++) {
+		if(mifare_classic_block_sector(block) != sector) {
+			sector = mifare_classic_block_sector(block);
+			if(mifare_classic_authenticate(tag, block, entry.key, entry.keyType) < 0) {
+				break;
+			}
+		}
+		MifareClassicBlock data;
+		if(mifare_classic_read(tag, block, &data) < 0) {
+			break;
+		}
+		cache->Store("mifareClassic_block", 0, block, 16, data, sizeof(data), false, TagSession::ClassicCredential(sector, entry.key, entry.keyType));
+	}
+	mifare_classic_disconnect(tag);
+}
+
+static void prefetchDesfire(MifareTag tag, const PrefetchEntry &entry, PrefetchCache *cache, Arena *arena) {
+	if(mifare_desfire_connect(tag) < 0) {
+		return;
+	}
+
+	MifareDESFireAID aid = mifare_desfire_aid_new(entry.aid);
+	int error = mifare_desfire_select_application(tag, aid);
+	free(aid);
+
+	if(error >= 0 && entry.keyLength) {
+		MifareDESFireKey key = (entry.keyLength == 8) ?
+			mifare_desfire_des_key_new(entry.key) :
+			mifare_desfire_3des_key_new(entry.key);
+		error = mifare_desfire_authenticate(tag, entry.keyNo, key);
+		mifare_desfire_key_free(key);
+	}
+
+	size_t length = entry.count;
+	if(error >= 0 && !length) {
+		struct mifare_desfire_file_settings settings;
+		error = mifare_desfire_get_file_settings(tag, entry.file, &settings);
+		if(error >= 0 && (settings.file_type == MDFT_STANDARD_DATA_FILE || settings.file_type == MDFT_BACKUP_DATA_FILE)
+		&& settings.settings.standard_file.file_size > entry.start) {
+			length = settings.settings.standard_file.file_size - entry.start;
+		}
+	}
+
+	if(error >= 0 && length) {
+		uint8_t *data = arena->New<uint8_t>(length);
+		ssize_t bytes = data ? mifare_desfire_read_data(tag, entry.file, entry.start, length, data) : -1;
+		if(bytes >= 0) {
+			cache->Store("mifareDesfire_file:" + std::to_string(entry.file), entry.aid, entry.start, 1, data, bytes, !entry.count,
+				entry.keyLength ? TagSession::DesfireCredential(entry.aid, entry.keyNo, entry.key, entry.keyLength) : std::string());
+		}
+	}
+	mifare_desfire_disconnect(tag);
+}
+
+PrefetchCache::PrefetchCache() {}
+PrefetchCache::PrefetchCache(const PrefetchCache &other) : regions(other.regions) {
+	// Copies are only made before the tag is handed to JS
+	NativeMemory::Allocated(NFF_MEMORY_CACHES, Size());
+}
+PrefetchCache::~PrefetchCache() {
+	NativeMemory::Released(NFF_MEMORY_CACHES, Size());
+}
+
+PrefetchCache& PrefetchCache::operator=(const PrefetchCache &other) {
+	if(this != &other) {
+		NativeMemory::Released(NFF_MEMORY_CACHES, Size());
+		regions = other.regions;
+		NativeMemory::Allocated(NFF_MEMORY_CACHES, Size());
+	}
+	return *this;
+}
+
+void PrefetchCache::Fill(MifareTag tag, const std::vector<PrefetchEntry> &profile, Arena *arena) {
+	int type;
+	switch(freefare_get_tag_type(tag)) {
+		case ULTRALIGHT:
+		case ULTRALIGHT_C:
+			type = NFF_PREFETCH_ULTRALIGHT;
+			break;
+		case CLASSIC_1K:
+		case CLASSIC_4K:
+			type = NFF_PREFETCH_CLASSIC;
+			break;
+		case DESFIRE:
+			type = NFF_PREFETCH_DESFIRE;
+			break;
+		case NTAG_21x:
+			type = NFF_PREFETCH_NTAG21X;
+			break;
+		default:
+			return;
+	}
+
+	for(size_t i = 0; i < profile.size(); i++) {
+		if(profile[i].type != type) {
+			continue;
+		}
+		switch(type) {
+			case NFF_PREFETCH_ULTRALIGHT:
+				prefetchUltralight(tag, profile[i], this);
+				break;
+			case NFF_PREFETCH_CLASSIC:
+				prefetchClassic(tag, profile[i], this);
+				break;
+			case NFF_PREFETCH_DESFIRE:
+				prefetchDesfire(tag, profile[i], this, arena);
+				break;
+			case NFF_PREFETCH_NTAG21X:
+				prefetchNtag21x(tag, profile[i], this, arena);
+				break;
+		}
+	}
+}
+
+void PrefetchCache::Store(const std::string &space, uint32_t aid, uint32_t start, size_t unit, const uint8_t *data, size_t length, bool toEnd,
+  const std::string &credential) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Region region;
+	region.space = space;
+	region.aid = aid;
+	region.start = start * unit;
+	region.data.assign(reinterpret_cast<const char*>(data), length);
+	region.toEnd = toEnd;
+	region.credential = credential;
+	regions.push_back(region);
+	NativeMemory::Allocated(NFF_MEMORY_CACHES, length);
+}
+
+bool PrefetchCache::Lookup(const std::string &space, uint32_t aid, uint32_t start, uint32_t end, size_t unit, const std::string &credential,
+  std::string *data) {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t from = (uint64_t) start * unit;
+	uint64_t to = (uint64_t) end * unit;
+	for(size_t i = 0; i < regions.size(); i++) {
+		const Region &region = regions[i];
+		if(region.space != space || region.aid != aid || from < region.start
+		|| (!region.credential.empty() && region.credential != credential)) {
+			continue;
+		}
+		uint64_t regionEnd = region.start + region.data.size();
+		if(!end) {
+			if(!region.toEnd || from > regionEnd) {
+				continue;
+			}
+			to = regionEnd;
+		}
+		if(to <= regionEnd) {
+			data->assign(region.data, from - region.start, to - from);
+			return true;
+		}
+	}
+	return false;
+}
+
+void PrefetchCache::Clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	NativeMemory::Released(NFF_MEMORY_CACHES, Size());
+	regions.clear();
+}
+
+size_t PrefetchCache::Size() const {
+	size_t size = 0;
+	for(size_t i = 0; i < regions.size(); i++) {
+		size += regions[i].data.size();
+	}
+	return size;
+}
+
+bool PrefetchCache::Empty() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return regions.empty();
+}
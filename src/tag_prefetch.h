@@ -0,0 +1,96 @@
+#ifndef NFF_TAG_PREFETCH_H
+#define NFF_TAG_PREFETCH_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+#include "arena.h"
+
+/* Kind of tag a prefetch entry applies to */
+#define NFF_PREFETCH_ULTRALIGHT 0
+#define NFF_PREFETCH_CLASSIC 1
+#define NFF_PREFETCH_DESFIRE 2
+#define NFF_PREFETCH_NTAG21X 3
+
+/**
+* Region read on tag arrival.
+* Ultralight and NTAG: pages [start, start + count)
+* Classic: blocks [start, start + count), authenticated with key (6 bytes) and keyType
+* DESFire: file of application aid from offset start, count bytes or the whole file if 0,
+* authenticated with keyNo and a DES (8 bytes) or 3DES (16 bytes) key if keyLength is set
+*/
+struct PrefetchEntry {
+	int type;
+	uint32_t start;
+	uint32_t count;
+	uint32_t aid;
+	uint8_t file;
+	uint8_t keyNo;
+	uint8_t key[16];
+	uint8_t keyLength;
+	MifareClassicKeyType keyType;
+};
+
+
+
+/**
+* Data read from a tag before it was handed to JS. Regions are stored by
+* address space (as DeviceWorker::Range()), with the credential (see
+* TagSession) the tag had to be authenticated with to read them. The read
+* workers answer from it in queue order, when the tag is in the same
+* authentication, skipping the read. It is dropped when the tag is written.
+*/
+class PrefetchCache {
+
+public:
+	PrefetchCache();
+	PrefetchCache(const PrefetchCache &other);
+	~PrefetchCache();
+	PrefetchCache& operator=(const PrefetchCache &other);
+
+	// Read the profile entries matching the tag type, errors are ignored.
+	// Read buffers are taken from the arena of the listing.
+	void Fill(MifareTag tag, const std::vector<PrefetchEntry> &profile, Arena *arena);
+
+	void Store(const std::string &space, uint32_t aid, uint32_t start, size_t unit, const uint8_t *data, size_t length, bool toEnd,
+	  const std::string &credential);
+
+	// Data of units [start, end) of a space, end 0 meaning up to the end of a whole file,
+	// if it was read without authentication or with the given credential
+	bool Lookup(const std::string &space, uint32_t aid, uint32_t start, uint32_t end, size_t unit, const std::string &credential,
+	  std::string *data);
+
+	void Clear();
+	bool Empty();
+
+private:
+	// Bytes held, for the native memory accounting
+	size_t Size() const;
+
+	struct Region {
+		std::string space;
+		uint32_t aid;
+		uint32_t start;
+		std::string data;
+
+		// The region ends with its file
+		bool toEnd;
+
+		// Authentication used to read it, empty if none
+		std::string credential;
+	};
+
+	// Workers look up while writes queued from JS clear
+	std::mutex mutex;
+	std::vector<Region> regions;
+};
+
+
+#endif /* NFF_TAG_PREFETCH_H */
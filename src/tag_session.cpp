@@ -0,0 +1,114 @@
+#include "tag_session.h"
+
+TagSession::TagSession(MifareTag tag, DesfireFileCache *files) : tag(tag), files(files), connected(false) {}
+TagSession::~TagSession() {}
+
+int TagSession::Connect() {
+	if(connected || !tag) {
+		return 0;
+	}
+
+	int error;
+	switch(freefare_get_tag_type(tag)) {
+		case ULTRALIGHT:
+		case ULTRALIGHT_C:
+			error = mifare_ultralight_connect(tag);
+			break;
+		case CLASSIC_1K:
+		case CLASSIC_4K:
+			error = mifare_classic_connect(tag);
+			break;
+		case DESFIRE:
+			files->Reset();
+			error = mifare_desfire_connect(tag);
+			break;
+		case NTAG_21x:
+			error = ntag21x_connect(tag);
+
+			// Connected even if the information can not be read
+			if(error >= 0) {
+				ntag21x_get_info(tag);
+			}
+			break;
+		default:
+			return 0;
+	}
+
+	credential.clear();
+	if(error >= 0) {
+		connected = true;
+	}
+	return error;
+}
+
+int TagSession::Disconnect() {
+	if(!connected) {
+		return 0;
+	}
+
+	files->Reset();
+	int error = DisconnectTag(tag);
+
+	credential.clear();
+	if(error >= 0) {
+		connected = false;
+	}
+	return error;
+}
+
+int TagSession::DisconnectTag(MifareTag tag) {
+	switch(freefare_get_tag_type(tag)) {
+		case ULTRALIGHT:
+		case ULTRALIGHT_C:
+			return mifare_ultralight_disconnect(tag);
+		case CLASSIC_1K:
+		case CLASSIC_4K:
+			return mifare_classic_disconnect(tag);
+		case DESFIRE:
+			return mifare_desfire_disconnect(tag);
+		case NTAG_21x:
+			return ntag21x_disconnect(tag);
+		default:
+			return 0;
+	}
+}
+
+void TagSession::Lost() {
+	if(!connected) {
+		return;
+	}
+
+	// Release the target on our side, the tag does not answer anymore
+	Disconnect();
+	Forget();
+}
+
+void TagSession::Forget() {
+	connected = false;
+	credential.clear();
+	files->Reset();
+}
+
+bool TagSession::IsConnected() {
+	return connected;
+}
+
+void TagSession::SetCredential(const std::string &credential) {
+	this->credential = credential;
+}
+
+const std::string& TagSession::Credential() const {
+	return credential;
+}
+
+std::string TagSession::ClassicCredential(MifareClassicSectorNumber sector, const uint8_t *key, MifareClassicKeyType keyType) {
+	std::string credential = "classic:" + std::to_string(sector) + (keyType == MFC_KEY_A ? ":A:" : ":B:");
+	credential.append(reinterpret_cast<const char*>(key), sizeof(MifareClassicKey));
+	return credential;
+}
+
+std::string TagSession::DesfireCredential(uint32_t aid, uint8_t keyNo, const uint8_t *key, size_t keyLength) {
+	std::string credential = "desfire:" + std::to_string(aid) + ":" + std::to_string(keyNo) + ":";
+	credential.append(reinterpret_cast<const char*>(key), keyLength);
+	return credential;
+}
@@ -0,0 +1,70 @@
+#ifndef NFF_TAG_SESSION_H
+#define NFF_TAG_SESSION_H
+
+#include <atomic>
+#include <string>
+
+extern "C" {
+	#include <nfc/nfc.h>
+	#include <freefare.h>
+}
+
+#include "common.h"
+#include "desfire_file_cache.h"
+
+
+
+/**
+* Connection state of a tag. Workers of a tag connect it lazily before
+* executing, explicit connect/disconnect are idempotent, and the tag is
+* considered disconnected when it leaves the field or when the device
+* selects another target.
+* Connect() and Disconnect() talk to the tag and run on worker threads.
+*/
+class TagSession {
+
+public:
+	TagSession(MifareTag tag, DesfireFileCache *files);
+	~TagSession();
+
+	// Connect with the function of the tag type, 0 if already connected
+	int Connect();
+
+	// Disconnect, 0 if not connected
+	int Disconnect();
+
+	// The tag left the field or another target was selected, forget the connection
+	void Lost();
+
+	// Forget the connection without talking to the tag, when the device is gone
+	void Forget();
+
+	// Disconnect a tag with the function of its type
+	static int DisconnectTag(MifareTag tag);
+
+	bool IsConnected();
+
+	// Authentication the tag is in, empty if none. Set by the authentication workers
+	// and cleared by the scheduler before any worker which may change it.
+	void SetCredential(const std::string &credential);
+	const std::string& Credential() const;
+
+	// Credentials of a Classic sector key and of a DESFire application key
+	static std::string ClassicCredential(MifareClassicSectorNumber sector, const uint8_t *key, MifareClassicKeyType keyType);
+	static std::string DesfireCredential(uint32_t aid, uint8_t keyNo, const uint8_t *key, size_t keyLength);
+
+private:
+	// Our current tag
+	MifareTag tag;
+
+	// DESFire file settings, only valid during a connection
+	DesfireFileCache *files;
+
+	std::atomic<bool> connected;
+
+	// Only used by the workers, which a device runs one at a time
+	std::string credential;
+};
+
+
+#endif /* NFF_TAG_SESSION_H */
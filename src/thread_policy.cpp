@@ -0,0 +1,109 @@
+#include "thread_policy.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+ThreadPolicy::ThreadPolicy() : enabled(false), policy(NFF_THREAD_OTHER), priority(0), nice(0),
+  savedAffinity(false), savedScheduler(false), schedPolicy(SCHED_OTHER), savedNice(false), niceValue(0) {
+	schedParam.sched_priority = 0;
+}
+
+int ThreadPolicy::Apply() {
+	savedAffinity = savedScheduler = savedNice = false;
+#ifdef __linux__
+	pthread_t thread = pthread_self();
+
+	if(!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(size_t i = 0; i < cpus.size(); i++) {
+			if(cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+				CPU_SET(cpus[i], &set);
+			}
+		}
+		int error = pthread_getaffinity_np(thread, sizeof(affinity), &affinity);
+		if(!error) {
+			error = pthread_setaffinity_np(thread, sizeof(set), &set);
+		}
+		if(error) {
+			return error;
+		}
+		savedAffinity = true;
+	}
+
+	if(policy != NFF_THREAD_OTHER) {
+		int error = pthread_getschedparam(thread, &schedPolicy, &schedParam);
+		if(!error) {
+			struct sched_param param;
+			param.sched_priority = priority;
+			error = pthread_setschedparam(thread, policy == NFF_THREAD_FIFO ? SCHED_FIFO : SCHED_RR, &param);
+		}
+		if(error) {
+			Restore();
+			return error;
+		}
+		savedScheduler = true;
+	}
+	else if(nice) {
+		// Linux threads have their own nice value
+		pid_t tid = syscall(SYS_gettid);
+		errno = 0;
+		niceValue = getpriority(PRIO_PROCESS, tid);
+		if(niceValue == -1 && errno) {
+			return errno;
+		}
+
+		// Pool threads are shared, a nice value they could not get back from is refused
+		if(nice > niceValue && !CanLowerNice(tid, niceValue)) {
+			return EPERM;
+		}
+		if(setpriority(PRIO_PROCESS, tid, nice)) {
+			int error = errno;
+			Restore();
+			return error;
+		}
+		savedNice = true;
+	}
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+#ifdef __linux__
+bool ThreadPolicy::CanLowerNice(pid_t tid, int value) {
+	// RLIMIT_NICE allows nice values down to 20 - limit
+	struct rlimit limit;
+	if(!getrlimit(RLIMIT_NICE, &limit) && (limit.rlim_cur == RLIM_INFINITY || 20 - value <= (int) limit.rlim_cur)) {
+		return true;
+	}
+
+	// Otherwise CAP_SYS_NICE is needed, tried one step below the current value
+	if(value <= -20 || setpriority(PRIO_PROCESS, tid, value - 1)) {
+		return false;
+	}
+	setpriority(PRIO_PROCESS, tid, value);
+	return true;
+}
+#endif
+
+void ThreadPolicy::Restore() {
+#ifdef __linux__
+	pthread_t thread = pthread_self();
+	if(savedNice) {
+		setpriority(PRIO_PROCESS, syscall(SYS_gettid), niceValue);
+	}
+	if(savedScheduler) {
+		pthread_setschedparam(thread, schedPolicy, &schedParam);
+	}
+	if(savedAffinity) {
+		pthread_setaffinity_np(thread, sizeof(affinity), &affinity);
+	}
+#endif
+	savedAffinity = savedScheduler = savedNice = false;
+}
@@ -0,0 +1,57 @@
+#ifndef NFF_THREAD_POLICY_H
+#define NFF_THREAD_POLICY_H
+
+#include <vector>
+#include <sched.h>
+
+/* Scheduling classes */
+#define NFF_THREAD_OTHER 0
+#define NFF_THREAD_FIFO 1
+#define NFF_THREAD_RR 2
+
+
+
+/**
+* CPU set and scheduling class given to the thread running a device worker.
+* Workers run on the libuv thread pool, so the policy is applied to the pool
+* thread for the time of the worker and its previous state restored after.
+*/
+class ThreadPolicy {
+
+public:
+	ThreadPolicy();
+
+	// Apply to the calling thread and save its previous state, 0 or an errno
+	int Apply();
+	void Restore();
+
+	bool enabled;
+
+	// CPUs the thread may run on, any if empty
+	std::vector<int> cpus;
+
+	// Class, realtime priority for FIFO and RR, nice value for OTHER
+	int policy;
+	int priority;
+	int nice;
+
+private:
+	// State of the thread before Apply()
+	bool savedAffinity;
+#ifdef __linux__
+	cpu_set_t affinity;
+#endif
+	bool savedScheduler;
+	int schedPolicy;
+	struct sched_param schedParam;
+	bool savedNice;
+	int niceValue;
+
+#ifdef __linux__
+	// Whether the thread may go back to a nice value below its current one
+	static bool CanLowerNice(pid_t tid, int value);
+#endif
+};
+
+
+#endif /* NFF_THREAD_POLICY_H */
@@ -0,0 +1,149 @@
+/**
+* Checks of the native code that runs without a reader: access conditions of
+* MIFARE Classic sectors, journal records and the key rotation progress table.
+* Built with the addon, run by `npm test`.
+*/
+#include "../src/classic_access.h"
+#include "../src/classic_journal.h"
+#include "../src/key_rotation.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool ok, const char *condition, int line) {
+	if(!ok) {
+		fprintf(stderr, "native_check:%d: %s\n", line, condition);
+		failures++;
+	}
+}
+
+static void checkAccess() {
+	ClassicAccess::Conditions conditions;
+
+	// Transport configuration: data blocks with key A or B, key B readable
+	const uint8_t transport[] = {0xff, 0x07, 0x80};
+	CHECK(ClassicAccess::Parse(transport, &conditions));
+	CHECK(conditions[0] == 0 && conditions[1] == 0 && conditions[2] == 0 && conditions[3] == 1);
+
+	// Data blocks read with key A or B and written with key B, trailer 011
+	const uint8_t keyB[] = {0x78, 0x77, 0x88};
+	CHECK(ClassicAccess::Parse(keyB, &conditions));
+	CHECK(conditions[0] == 4 && conditions[1] == 4 && conditions[2] == 4 && conditions[3] == 3);
+
+	// Inverted copy not matching
+	const uint8_t corrupted[] = {0xff, 0x07, 0x81};
+	CHECK(!ClassicAccess::Parse(corrupted, &conditions));
+
+	// Groups of the small and the large sectors
+	CHECK(ClassicAccess::Group(2) == 2);
+	CHECK(ClassicAccess::Group(3) == NFF_ACCESS_TRAILER);
+	CHECK(ClassicAccess::Group(128 + 7) == 1);
+	CHECK(ClassicAccess::Group(128 + 15) == NFF_ACCESS_TRAILER);
+
+	MifareClassicKeyType keyType;
+	ClassicAccess::Conditions written = {{4, 4, 4, 3}};
+	CHECK(ClassicAccess::KeyFor(written, 1, NFF_ACCESS_READ, true, true, &keyType) && keyType == MFC_KEY_A);
+	CHECK(ClassicAccess::KeyFor(written, 1, NFF_ACCESS_WRITE, true, true, &keyType) && keyType == MFC_KEY_B);
+	CHECK(!ClassicAccess::KeyFor(written, 1, NFF_ACCESS_WRITE, true, false, &keyType));
+	CHECK(ClassicAccess::KeyFor(written, 3, NFF_ACCESS_READ, false, true, &keyType) && keyType == MFC_KEY_B);
+
+	// A readable key B can not authenticate
+	ClassicAccess::Conditions open = {{0, 0, 0, 1}};
+	CHECK(!ClassicAccess::KeyFor(open, 1, NFF_ACCESS_WRITE, false, true, &keyType));
+	CHECK(ClassicAccess::KeyFor(open, 1, NFF_ACCESS_WRITE, true, true, &keyType) && keyType == MFC_KEY_A);
+}
+
+static void checkJournal() {
+	// ISO/IEC 14443-3 annex B examples
+	const uint8_t zeros[] = {0x00, 0x00};
+	const uint8_t bytes[] = {0x12, 0x34};
+	CHECK(ClassicJournal::Crc(zeros, sizeof(zeros)) == 0x1ea0);
+	CHECK(ClassicJournal::Crc(bytes, sizeof(bytes)) == 0xcf26);
+
+	ClassicJournal record;
+	record.version = 7;
+	record.state = NFF_JOURNAL_PENDING;
+	record.target = 4;
+	record.shadow = 5;
+	record.mask = 0x0005;
+	record.crc = 0xbeef;
+
+	MifareClassicBlock block;
+	record.Encode(&block);
+	ClassicJournal decoded;
+	CHECK(decoded.Decode(block));
+	CHECK(decoded.version == 7 && decoded.state == NFF_JOURNAL_PENDING && decoded.target == 4 && decoded.shadow == 5);
+	CHECK(decoded.mask == 0x0005 && decoded.crc == 0xbeef);
+
+	std::vector<MifareClassicBlockNumber> blocks = decoded.Blocks();
+	CHECK(blocks.size() == 2 && blocks[0] == 16 && blocks[1] == 18);
+	CHECK(decoded.Shadow(18) == 22);
+
+	// A torn record
+	block[5] ^= 0x01;
+	CHECK(!decoded.Decode(block));
+
+	memset(block, 0, sizeof(block));
+	CHECK(ClassicJournal::Blank(block));
+	CHECK(!decoded.Decode(block));
+}
+
+static void checkRotationTable() {
+	char directory[] = "/tmp/nff_check_XXXXXX";
+	if(!mkdtemp(directory)) {
+		CHECK(!"temporary directory");
+		return;
+	}
+	std::string path = std::string(directory) + "/progress";
+
+	int error;
+	std::shared_ptr<RotationTable> table = RotationTable::Open(path, 4, &error);
+	CHECK(table != NULL);
+	if(table) {
+		CHECK(table->State("04a1b2c3d4e5f6") == NFF_ROTATION_UNKNOWN);
+		CHECK(table->Record("04a1b2c3d4e5f6", NFF_ROTATION_FAILED));
+		CHECK(table->Record("04a1b2c3d4e5f6", NFF_ROTATION_DONE));
+		CHECK(table->Record("01020304", NFF_ROTATION_FAILED));
+		CHECK(table->Record("05060708", NFF_ROTATION_FAILED));
+		CHECK(table->Record("090a0b0c", NFF_ROTATION_FAILED));
+		CHECK(!table->Record("0d0e0f10", NFF_ROTATION_FAILED));
+
+		// Devices opening the same file share the table
+		CHECK(RotationTable::Open(path, 0, &error) == table);
+		table.reset();
+	}
+
+	// Progress survives reopening the file, with its own capacity
+	table = RotationTable::Open(path, 16, &error);
+	CHECK(table != NULL);
+	if(table) {
+		uint32_t capacity, entries, rotated;
+		table->Stats(&capacity, &entries, &rotated);
+		CHECK(capacity == 4 && entries == 4 && rotated == 1);
+		CHECK(table->State("04a1b2c3d4e5f6") == NFF_ROTATION_DONE);
+		CHECK(table->State("01020304") == NFF_ROTATION_FAILED);
+		table.reset();
+	}
+
+	unlink(path.c_str());
+	rmdir(directory);
+}
+
+int main() {
+	checkAccess();
+	checkJournal();
+	checkRotationTable();
+
+	if(failures) {
+		fprintf(stderr, "native_check: %d failed\n", failures);
+		return 1;
+	}
+	printf("native_check: ok\n");
+	return 0;
+}